@@ -0,0 +1,36 @@
+extends Node2D
+
+## Compares the rays cast by a uniform and an adaptive sweep turning over the same blocks.
+
+const BlockLayout = preload("res://benchmark/block_layout.gd")
+const BLOCK_COUNT: int = 24
+const FRAME_COUNT: int = 600
+const ROTATION_STEP: float = 0.01
+
+@onready var uniform: LineOfSight2D = $Uniform
+@onready var adaptive: LineOfSight2D = $Adaptive
+
+var frames: int = 0
+var uniform_rays: int = 0
+var adaptive_rays: int = 0
+
+func _ready() -> void:
+  BlockLayout.place_blocks_2d(self, BlockLayout.create_rng(), BLOCK_COUNT, 500.0, 120.0, false)
+
+func _process(_delta: float) -> void:
+  # The counters hold the sweeps of the previous frame.
+  if frames > 0:
+    uniform_rays += uniform.get_rays_cast()
+    adaptive_rays += adaptive.get_rays_cast()
+  frames += 1
+
+  uniform.rotation += ROTATION_STEP
+  adaptive.rotation = uniform.rotation
+
+  if frames > FRAME_COUNT:
+    var sweeps: float = FRAME_COUNT
+    print("Uniform:  %.1f rays per frame" % (uniform_rays / sweeps))
+    print("Adaptive: %.1f rays per frame (subdivisions: %d)" % [
+      adaptive_rays / sweeps, adaptive.adaptive_subdivisions
+    ])
+    get_tree().quit()
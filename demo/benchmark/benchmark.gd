@@ -0,0 +1,146 @@
+extends Node
+
+## Headless benchmark of the line of sight nodes.
+##
+## Spawns `agents` nodes and `occluders` blocks at positions drawn from a fixed seed, turns the
+## agents for `frames` frames, then writes the totals and the percentiles of the per-node update
+## times as JSON. Every setting can be overridden from the command line:
+##   godot --headless --path demo res://benchmark/benchmark.tscn -- --dimension=3d --agents=200
+
+const BLOCK_2D_SCENE: PackedScene = preload("res://2D/block_2d.tscn")
+const BLOCK_3D_SCENE: PackedScene = preload("res://3D/block_3d.tscn")
+const ROTATION_STEP: float = 0.01
+
+var settings: Dictionary = {
+  "dimension": "2d",
+  "agents": 100,
+  "occluders": 200,
+  "resolution": 1.0,
+  "frames": 300,
+  "warmup": 10,
+  "seed": 1234,
+  "occluder_index": false,
+  "server": false,
+  "parallel_physics_queries": false,
+  "output": "user://benchmark.json",
+}
+
+var agents: Array[Node] = []
+var frame: int = 0
+var times := PackedInt64Array()
+var frame_times := PackedInt64Array()
+var last_ticks: int = 0
+var rays: int = 0
+var edges: int = 0
+var vertices: int = 0
+
+func _ready() -> void:
+  for argument in OS.get_cmdline_user_args():
+    var pair: PackedStringArray = argument.trim_prefix("--").split("=", true, 1)
+    if pair.size() == 2 and settings.has(pair[0]):
+      if settings[pair[0]] is bool:
+        settings[pair[0]] = pair[1] == "true"
+      else:
+        settings[pair[0]] = type_convert(pair[1], typeof(settings[pair[0]]))
+
+  LineOfSightServer.parallel_physics_queries = settings["parallel_physics_queries"]
+  var rng := RandomNumberGenerator.new()
+  rng.seed = settings["seed"]
+  if settings["dimension"] == "3d":
+    spawn_3d(rng)
+  else:
+    spawn_2d(rng)
+
+func spawn_2d(rng: RandomNumberGenerator) -> void:
+  var extent: float = 40.0 * sqrt(settings["occluders"] + settings["agents"])
+  for i in settings["occluders"]:
+    var block: Node2D = BLOCK_2D_SCENE.instantiate()
+    block.position = Vector2(rng.randf_range(-extent, extent), rng.randf_range(-extent, extent))
+    add_child(block)
+  for i in settings["agents"]:
+    var agent := LineOfSight2D.new()
+    agent.radius = 400.0
+    agent.resolution = settings["resolution"]
+    agent.use_occluder_index = settings["occluder_index"]
+    if settings["server"]:
+      agent.update_mode = LineOfSight2D.UPDATE_SERVER
+    agent.position = Vector2(rng.randf_range(-extent, extent), rng.randf_range(-extent, extent))
+    agent.rotation = rng.randf_range(0, TAU)
+    add_child(agent)
+    agents.append(agent)
+
+func spawn_3d(rng: RandomNumberGenerator) -> void:
+  var extent: float = 2.0 * sqrt(settings["occluders"] + settings["agents"])
+  for i in settings["occluders"]:
+    var block: Node3D = BLOCK_3D_SCENE.instantiate()
+    block.position = Vector3(rng.randf_range(-extent, extent), 0, rng.randf_range(-extent, extent))
+    add_child(block)
+  for i in settings["agents"]:
+    var agent := LineOfSight3D.new()
+    agent.radius = 20.0
+    agent.resolution = settings["resolution"]
+    agent.use_occluder_index = settings["occluder_index"]
+    if settings["server"]:
+      agent.update_mode = LineOfSight3D.UPDATE_SERVER
+    agent.position = Vector3(rng.randf_range(-extent, extent), 0, rng.randf_range(-extent, extent))
+    agent.rotation.z = rng.randf_range(0, TAU)
+    add_child(agent)
+    agents.append(agent)
+
+func _process(_delta: float) -> void:
+  # The counters hold the updates of the previous frame. The wall time of the frames shows the
+  # scaling of the server, where the update times of the nodes overlap.
+  var ticks: int = Time.get_ticks_usec()
+  if frame > settings["warmup"]:
+    frame_times.append(ticks - last_ticks)
+    for agent in agents:
+      times.append(agent.get_update_time_usec())
+      rays += agent.get_rays_cast()
+      edges += agent.get_edges_resolved()
+      vertices += agent.get_vertices_emitted()
+  last_ticks = ticks
+  frame += 1
+
+  for agent in agents:
+    if agent is Node2D:
+      agent.rotation += ROTATION_STEP
+    else:
+      agent.rotation.z += ROTATION_STEP
+
+  if frame > settings["warmup"] + settings["frames"]:
+    finish()
+
+func percentile(sorted: PackedInt64Array, ratio: float) -> int:
+  if sorted.is_empty():
+    return 0
+  return sorted[mini(sorted.size() - 1, int(ratio * sorted.size()))]
+
+func finish() -> void:
+  times.sort()
+  frame_times.sort()
+  var frames: float = settings["frames"]
+  var total_usec: int = 0
+  for time in times:
+    total_usec += time
+  var results: Dictionary = {
+    "settings": settings,
+    "rays_per_frame": rays / frames,
+    # The throughput of the updates, which include building the meshes.
+    "rays_per_msec": rays * 1000.0 / maxi(total_usec, 1),
+    # Stays flat across resolutions while the cost of a view point doesn't depend on their count.
+    "usec_per_ray": total_usec / maxf(rays, 1.0),
+    "edges_per_frame": edges / frames,
+    "vertices_per_frame": vertices / frames,
+    "update_usec_p50": percentile(times, 0.5),
+    "update_usec_p99": percentile(times, 0.99),
+    "frame_usec_p50": percentile(frame_times, 0.5),
+  }
+
+  var json: String = JSON.stringify(results, "  ")
+  var file := FileAccess.open(settings["output"], FileAccess.WRITE)
+  if file:
+    file.store_string(json)
+  else:
+    push_error("Can't write the results to %s." % settings["output"])
+  print(json)
+  get_tree().quit()
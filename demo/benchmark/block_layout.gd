@@ -0,0 +1,60 @@
+extends RefCounted
+
+## Places the blocks of the checks at random, from a generator with a fixed seed, so that every run
+## sees the same layout.
+
+const BLOCK_2D_SCENE: PackedScene = preload("res://2D/block_2d.tscn")
+const BLOCK_3D_SCENE: PackedScene = preload("res://3D/block_3d.tscn")
+const SEED: int = 1234
+
+static func create_rng() -> RandomNumberGenerator:
+  var rng := RandomNumberGenerator.new()
+  rng.seed = SEED
+  return rng
+
+## A random position within extent of the origin along both axes, and at least clearance away from
+## it. With whole_pixels, the coordinates are whole numbers.
+static func random_position(
+  rng: RandomNumberGenerator, extent: float, clearance: float, whole_pixels: bool = false
+) -> Vector2:
+  while true:
+    var position: Vector2
+    if whole_pixels:
+      var whole_extent := int(extent)
+      position = Vector2(
+        rng.randi_range(-whole_extent, whole_extent), rng.randi_range(-whole_extent, whole_extent)
+      )
+    else:
+      position = Vector2(rng.randf_range(-extent, extent), rng.randf_range(-extent, extent))
+    if position.length() >= clearance:
+      return position
+  return Vector2.ZERO
+
+## Add blocks to a 2D parent at random positions, turned at random with rotated.
+static func place_blocks_2d(
+  parent: Node, rng: RandomNumberGenerator, count: int, extent: float, clearance: float,
+  rotated: bool, whole_pixels: bool = false
+) -> Array[Node2D]:
+  var blocks: Array[Node2D] = []
+  for i in count:
+    var block: Node2D = BLOCK_2D_SCENE.instantiate()
+    block.position = random_position(rng, extent, clearance, whole_pixels)
+    if rotated:
+      block.rotation = rng.randf_range(0, TAU)
+    parent.add_child(block)
+    blocks.append(block)
+  return blocks
+
+## Add blocks to a 3D parent at random positions in the XZ plane, turned at random around Y.
+static func place_blocks_3d(
+  parent: Node, rng: RandomNumberGenerator, count: int, extent: float, clearance: float
+) -> Array[Node3D]:
+  var blocks: Array[Node3D] = []
+  for i in count:
+    var block: Node3D = BLOCK_3D_SCENE.instantiate()
+    var position := random_position(rng, extent, clearance)
+    block.position = Vector3(position.x, 0, position.y)
+    block.rotation.y = rng.randf_range(0, TAU)
+    parent.add_child(block)
+    blocks.append(block)
+  return blocks
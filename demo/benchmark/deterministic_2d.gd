@@ -0,0 +1,72 @@
+extends Node2D
+
+## Checks that a deterministic sweep gives the same bits as the golden view committed with it.
+##
+## A node with deterministic and use_occluder_index sweeps a seeded layout of blocks. The blocks are
+## not rotated and stand on whole pixels, so that building the layout itself never takes a sine.
+## Every view point is compared bit for bit with GOLDEN_PATH. The first run, without a golden yet,
+## writes it instead, to be committed and compared against on the other platforms. After a change
+## that moves the view on purpose, write the golden again with --update. Exits with a non-zero code
+## on failure:
+##   godot --headless --path demo res://benchmark/deterministic_2d.tscn
+##   godot --headless --path demo res://benchmark/deterministic_2d.tscn -- --update
+
+const BlockLayout = preload("res://benchmark/block_layout.gd")
+const BLOCK_COUNT: int = 40
+const EXTENT: int = 500
+const RADIUS: float = 400.0
+const GOLDEN_PATH: String = "res://benchmark/deterministic_2d.json"
+
+var agent: LineOfSight2D
+var frames: int = 0
+
+func _ready() -> void:
+  var rng := BlockLayout.create_rng()
+  BlockLayout.place_blocks_2d(self, rng, BLOCK_COUNT, EXTENT, 150.0, false, true)
+
+  agent = LineOfSight2D.new()
+  agent.angle = 360.0
+  agent.radius = RADIUS
+  agent.deterministic = true
+  agent.use_occluder_index = true
+  add_child(agent)
+
+func _process(_delta: float) -> void:
+  # Let the blocks enter the index and the node sweep first.
+  frames += 1
+  if frames == 3:
+    run()
+
+## Encode every point as the hexadecimal bytes of its coordinates, so the comparison is bit exact
+## and the golden shows which points moved.
+func encode(points: PackedVector2Array) -> PackedStringArray:
+  var encoded := PackedStringArray()
+  for point in points:
+    encoded.append(PackedVector2Array([point]).to_byte_array().hex_encode())
+  return encoded
+
+func run() -> void:
+  var points: PackedStringArray = encode(agent.get_view_points())
+  if "--update" in OS.get_cmdline_user_args() or not FileAccess.file_exists(GOLDEN_PATH):
+    var file := FileAccess.open(GOLDEN_PATH, FileAccess.WRITE)
+    if not file:
+      push_error("Can't write the golden view to %s." % GOLDEN_PATH)
+      get_tree().quit(1)
+      return
+    file.store_string(JSON.stringify({"points": points}, "  "))
+    print("Wrote %d view points to %s, commit it." % [points.size(), GOLDEN_PATH])
+    get_tree().quit(0)
+    return
+
+  var golden: Dictionary = JSON.parse_string(FileAccess.get_file_as_string(GOLDEN_PATH))
+  var expected: Array = golden["points"]
+
+  var mismatches: int = 0
+  for i in mini(points.size(), expected.size()):
+    if points[i] != expected[i]:
+      if mismatches == 0:
+        print("First mismatch at point %d: %s, expected %s" % [i, points[i], expected[i]])
+      mismatches += 1
+  print("View points: %d, expected %d" % [points.size(), expected.size()])
+  print("Mismatches: %d" % mismatches)
+  get_tree().quit(1 if mismatches > 0 or points.size() != expected.size() else 0)
@@ -0,0 +1,95 @@
+extends Node
+
+## Checks the distance textures of the 2D and 3D nodes against the distances of the rays they cast.
+##
+## Each texel of the texture holds the distance of the view along one step of the sweep, which is
+## where a ray was cast, so it must match a physics ray cast along the same step within TOLERANCE.
+## Exits with a non-zero code on failure:
+##   godot --headless --path demo res://benchmark/distance_texture.tscn
+
+const BlockLayout = preload("res://benchmark/block_layout.gd")
+const BLOCK_COUNT: int = 40
+const EXTENT_2D: float = 500.0
+const RADIUS_2D: float = 400.0
+const EXTENT_3D: float = 40.0
+const RADIUS_3D: float = 30.0
+const ANGLE: float = 270.0
+const TOLERANCE: float = 0.01
+
+var agent_2d: LineOfSight2D
+var agent_3d: LineOfSight3D
+var frames: int = 0
+
+func _ready() -> void:
+  # The blocks stay out of the way of the nodes, at the origin.
+  var rng := BlockLayout.create_rng()
+  var world_2d := Node2D.new()
+  add_child(world_2d)
+  BlockLayout.place_blocks_2d(world_2d, rng, BLOCK_COUNT, EXTENT_2D, 0.2 * EXTENT_2D, true)
+  var world_3d := Node3D.new()
+  add_child(world_3d)
+  for block in BlockLayout.place_blocks_3d(world_3d, rng, BLOCK_COUNT, EXTENT_3D, 0.2 * EXTENT_3D):
+    block.scale = Vector3(3, 3, 3)
+
+  agent_2d = LineOfSight2D.new()
+  agent_2d.angle = ANGLE
+  agent_2d.radius = RADIUS_2D
+  agent_2d.distance_from_origin = 0.0
+  agent_2d.render_mode = LineOfSight2D.RENDER_DISTANCE_TEXTURE
+  world_2d.add_child(agent_2d)
+
+  agent_3d = LineOfSight3D.new()
+  agent_3d.angle = ANGLE
+  agent_3d.radius = RADIUS_3D
+  agent_3d.distance_from_origin = 0.0
+  agent_3d.render_mode = LineOfSight3D.RENDER_DISTANCE_TEXTURE
+  world_3d.add_child(agent_3d)
+
+func _process(_delta: float) -> void:
+  # Let the blocks enter the physics spaces and the nodes sweep first.
+  frames += 1
+  if frames == 3:
+    run()
+
+func run() -> void:
+  var errors: int = 0
+  errors += check(agent_2d.get_distance_texture(), agent_2d.rotation_degrees, cast_2d)
+  errors += check(agent_3d.get_distance_texture(), agent_3d.rotation_degrees.z, cast_3d)
+  get_tree().quit(1 if errors > 0 else 0)
+
+## Compare every texel with a ray cast along its step, and return the number of mismatches.
+func check(texture: Texture2D, rotation_degrees: float, cast: Callable) -> int:
+  var image: Image = texture.get_image()
+  if image == null or image.get_width() < 2:
+    print("The distance texture is empty.")
+    return 1
+  if image.get_format() != Image.FORMAT_RF:
+    print("The distance texture should be in FORMAT_RF.")
+    return 1
+
+  # The texels span the cone from its start, one step apart.
+  var width: int = image.get_width()
+  var start: float = deg_to_rad(rotation_degrees - ANGLE / 2.0)
+  var step: float = deg_to_rad(ANGLE) / (width - 1)
+  var mismatches: int = 0
+  for i in width:
+    var expected: float = cast.call(Vector2.from_angle(start + step * i))
+    var actual: float = image.get_pixel(i, 0).r
+    if absf(expected - actual) > TOLERANCE * expected + TOLERANCE:
+      mismatches += 1
+  print("Distance mismatches: %d / %d" % [mismatches, width])
+  return mismatches
+
+func cast_2d(direction: Vector2) -> float:
+  var from: Vector2 = agent_2d.global_position
+  var query := PhysicsRayQueryParameters2D.create(from, from + direction * RADIUS_2D)
+  var hit: Dictionary = agent_2d.get_world_2d().direct_space_state.intersect_ray(query)
+  return from.distance_to(hit["position"]) if hit else RADIUS_2D
+
+func cast_3d(direction: Vector2) -> float:
+  # The 3D sweep turns in the XZ plane.
+  var from: Vector3 = agent_3d.global_position
+  var to: Vector3 = from + Vector3(direction.x, 0, direction.y) * RADIUS_3D
+  var query := PhysicsRayQueryParameters3D.create(from, to)
+  var hit: Dictionary = agent_3d.get_world_3d().direct_space_state.intersect_ray(query)
+  return from.distance_to(hit["position"]) if hit else RADIUS_3D
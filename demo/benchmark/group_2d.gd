@@ -0,0 +1,75 @@
+extends Node2D
+
+## Checks that the members of a LineOfSightGroup see the same views as when they sweep alone.
+##
+## Two members with different cones stand on the same spot, so the group clips both views from one
+## shared sweep. A twin of each member stands there too, out of the group. Their views are measured
+## along directions spread over the cone, and must match within TOLERANCE along every direction.
+## The cones start on whole degrees, so at a resolution of one ray per degree the shared sweep casts
+## its rays along the same directions as the twins. Exits with a non-zero code on failure:
+##   godot --headless --path demo res://benchmark/group_2d.tscn
+
+const ViewChecks = preload("res://benchmark/view_checks.gd")
+const BlockLayout = preload("res://benchmark/block_layout.gd")
+const BLOCK_COUNT: int = 40
+const EXTENT: float = 500.0
+const RADIUS: float = 400.0
+const PROBE_COUNT: int = 256
+const TOLERANCE: float = 1.0
+
+var group: LineOfSightGroup
+var members: Array[LineOfSight2D] = []
+var twins: Array[LineOfSight2D] = []
+var ticks: int = 0
+
+func _ready() -> void:
+  BlockLayout.place_blocks_2d(self, BlockLayout.create_rng(), BLOCK_COUNT, EXTENT, 150.0, true)
+
+  group = LineOfSightGroup.new()
+  add_child(group)
+  # The rotation and the angle of each cone, in degrees.
+  for cone in [Vector2(0.0, 90.0), Vector2(45.0, 120.0)]:
+    var member := create_node(cone.x, cone.y)
+    group.add_member(member)
+    members.append(member)
+    twins.append(create_node(cone.x, cone.y))
+
+func create_node(node_rotation: float, node_angle: float) -> LineOfSight2D:
+  var node := ViewChecks.create_node(node_angle, RADIUS)
+  node.rotation_degrees = node_rotation
+  node.resolution = 1.0
+  add_child(node)
+  return node
+
+func _physics_process(_delta: float) -> void:
+  # This runs before the group, so the stats and the views are those of the last tick.
+  ticks += 1
+  if ticks == 3:
+    run()
+
+func run() -> void:
+  var errors: int = 0
+  var stats: Dictionary = group.get_stats()
+  print("Shared sweeps: %d, members shared: %d" % [stats["shared_sweeps"], stats["members_shared"]])
+  if stats["members_shared"] != members.size():
+    print("The members should share one sweep.")
+    errors += 1
+
+  for i in members.size():
+    # The probes stay clear of the edges of the cone, where the views end.
+    var member: LineOfSight2D = members[i]
+    var cone: float = deg_to_rad(member.angle)
+    var start: float = member.rotation - cone / 2.0
+    var mismatches: int = 0
+    for j in PROBE_COUNT:
+      var direction := Vector2.from_angle(start + cone * (j + 0.5) / PROBE_COUNT)
+      var error: float = (
+        ViewChecks.measure(member, direction) - ViewChecks.measure(twins[i], direction)
+      )
+      if absf(error) > TOLERANCE:
+        mismatches += 1
+    print("Member %d mismatches: %d / %d" % [i, mismatches, PROBE_COUNT])
+    if mismatches > 0:
+      errors += 1
+
+  get_tree().quit(1 if errors > 0 else 0)
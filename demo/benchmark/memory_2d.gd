@@ -0,0 +1,50 @@
+extends Node2D
+
+## Checks that the nodes don't grow the memory while they update their mesh every frame.
+##
+## Exits with a non-zero code when the static memory or the object count grew between the end of
+## the warmup and the last frame, so it can run headless:
+##   godot --headless --path demo res://benchmark/memory_2d.tscn
+
+const BlockLayout = preload("res://benchmark/block_layout.gd")
+const BLOCK_COUNT: int = 100
+const AGENT_COUNT: int = 20
+const EXTENT: float = 600.0
+const FRAME_COUNT: int = 10000
+# The buffers grow during the first sweeps, until they hold the largest view.
+const WARMUP: int = 500
+const ROTATION_STEP: float = 0.01
+# Allocations of the engine itself, unrelated to the nodes, stay below this.
+const MAX_GROWTH_BYTES: int = 256 * 1024
+
+var agents: Array[LineOfSight2D] = []
+var frames: int = 0
+var start_memory: int = 0
+var start_objects: int = 0
+
+func _ready() -> void:
+  # The nodes are placed from the same generator, after the blocks.
+  var rng := BlockLayout.create_rng()
+  BlockLayout.place_blocks_2d(self, rng, BLOCK_COUNT, EXTENT, 0.0, false)
+  for i in AGENT_COUNT:
+    var agent := LineOfSight2D.new()
+    agent.radius = 400.0
+    agent.position = Vector2(rng.randf_range(-EXTENT, EXTENT), rng.randf_range(-EXTENT, EXTENT))
+    agent.rotation = rng.randf_range(0, TAU)
+    add_child(agent)
+    agents.append(agent)
+
+func _process(_delta: float) -> void:
+  frames += 1
+  for agent in agents:
+    agent.rotation += ROTATION_STEP
+
+  if frames == WARMUP:
+    start_memory = Performance.get_monitor(Performance.MEMORY_STATIC)
+    start_objects = Performance.get_monitor(Performance.OBJECT_COUNT)
+  elif frames == FRAME_COUNT:
+    var growth: int = Performance.get_monitor(Performance.MEMORY_STATIC) - start_memory
+    var objects: int = Performance.get_monitor(Performance.OBJECT_COUNT) - start_objects
+    print("Static memory growth: %d bytes over %d frames" % [growth, FRAME_COUNT - WARMUP])
+    print("Object count growth: %d" % objects)
+    get_tree().quit(1 if growth > MAX_GROWTH_BYTES or objects > 0 else 0)
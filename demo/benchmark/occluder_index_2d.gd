@@ -0,0 +1,80 @@
+extends Node2D
+
+## Checks the 2D occluder index against the physics server and times both on the same rays.
+##
+## Exits with a non-zero code when a ray hits something else than with the physics server, so it
+## can run headless:
+##   godot --headless --path demo res://benchmark/occluder_index_2d.tscn
+
+const BlockLayout = preload("res://benchmark/block_layout.gd")
+const BLOCK_COUNT: int = 400
+const RAY_COUNT: int = 20000
+const EXTENT: float = 1500.0
+const TOLERANCE: float = 0.5
+# Half the diagonal of a block: rays starting closer to a block may start inside it, where the
+# physics server ignores it.
+const BLOCK_CLEARANCE: float = 45.0
+
+var blocks := PackedVector2Array()
+var frames: int = 0
+
+func _ready() -> void:
+  var rng := BlockLayout.create_rng()
+  for block in BlockLayout.place_blocks_2d(self, rng, BLOCK_COUNT, EXTENT, 0.0, true):
+    blocks.append(block.position)
+
+func _physics_process(_delta: float) -> void:
+  # Let the physics server register the bodies first.
+  frames += 1
+  if frames == 3:
+    run()
+
+func is_inside_block(point: Vector2) -> bool:
+  for block in blocks:
+    if block.distance_to(point) < BLOCK_CLEARANCE:
+      return true
+  return false
+
+func run() -> void:
+  var rng := RandomNumberGenerator.new()
+  rng.seed = 4321
+  var rays: Array[PackedVector2Array] = []
+  while rays.size() < RAY_COUNT:
+    var from := Vector2(rng.randf_range(-EXTENT, EXTENT), rng.randf_range(-EXTENT, EXTENT))
+    if is_inside_block(from):
+      continue
+    var to := from + Vector2.from_angle(rng.randf_range(0, TAU)) * rng.randf_range(100, 800)
+    rays.append(PackedVector2Array([from, to]))
+
+  var space: PhysicsDirectSpaceState2D = get_world_2d().direct_space_state
+  var query := PhysicsRayQueryParameters2D.new()
+  var physics_hits: Array[Dictionary] = []
+  var start: int = Time.get_ticks_usec()
+  for ray in rays:
+    query.from = ray[0]
+    query.to = ray[1]
+    physics_hits.append(space.intersect_ray(query))
+  var physics_usec: int = Time.get_ticks_usec() - start
+
+  var index_hits: Array[Dictionary] = []
+  start = Time.get_ticks_usec()
+  for ray in rays:
+    index_hits.append(LineOfSightServer.intersect_occluder_ray_2d(ray[0], ray[1]))
+  var index_usec: int = Time.get_ticks_usec() - start
+
+  var mismatches: int = 0
+  for i in RAY_COUNT:
+    var expected: Dictionary = physics_hits[i]
+    var actual: Dictionary = index_hits[i]
+    if expected.is_empty() != actual.is_empty():
+      mismatches += 1
+    elif not expected.is_empty():
+      if expected["position"].distance_to(actual["position"]) > TOLERANCE:
+        mismatches += 1
+
+  print("Physics server: %.3f usec per ray" % (physics_usec / float(RAY_COUNT)))
+  print("Occluder index: %.3f usec per ray (kernel: %s)" % [
+    index_usec / float(RAY_COUNT), LineOfSightServer.get_occluder_kernel()
+  ])
+  print("Mismatches: %d / %d" % [mismatches, RAY_COUNT])
+  get_tree().quit(1 if mismatches > 0 else 0)
@@ -0,0 +1,108 @@
+extends Node2D
+
+## Checks that the ray cache predicts the same view as casting every ray, and that the cached rays
+## are cast again once they are too old.
+##
+## Two nodes stand on the same spot, with and without the cache. While they drift slowly, their
+## views are measured along fixed directions and must match within TOLERANCE. Then they stand still,
+## where every ray could be predicted forever, and the cached node must still cast each direction at
+## least once every RAY_CACHE_MAX_AGE + 1 sweeps. Besides the convex blocks, a stepped body and a
+## concave one stand in view: their parallel sides share a normal, so neighbouring cached rays may
+## hit two different sides and must not be predicted from each other. Exits with a non-zero code
+## on failure:
+##   godot --headless --path demo res://benchmark/ray_cache_2d.tscn
+
+const ViewChecks = preload("res://benchmark/view_checks.gd")
+const BlockLayout = preload("res://benchmark/block_layout.gd")
+const BLOCK_COUNT: int = 40
+const EXTENT: float = 500.0
+const RADIUS: float = 400.0
+const MOVING_FRAMES: int = 200
+const STILL_FRAMES: int = 90
+const MOVE_STEP := Vector2(0.5, 0.25)
+const ROTATION_STEP: float = 0.002
+const PROBE_COUNT: int = 64
+const TOLERANCE: float = 1.0
+# Matches LineOfSightCore::RAY_CACHE_MAX_AGE.
+const RAY_CACHE_MAX_AGE: int = 8
+
+var cached: LineOfSight2D
+var uncached: LineOfSight2D
+var frames: int = 0
+var mismatches: int = 0
+var probes: int = 0
+var still_rays: int = 0
+
+func _ready() -> void:
+  BlockLayout.place_blocks_2d(self, BlockLayout.create_rng(), BLOCK_COUNT, EXTENT, 150.0, true)
+  add_steps(Vector2(-250, 0))
+  add_cup(Vector2(0, 250))
+
+  cached = create_node(true)
+  uncached = create_node(false)
+
+## Add a staircase facing the origin, which is to its right: each step is a parallel side at a
+## different distance.
+func add_steps(at: Vector2) -> void:
+  var body := StaticBody2D.new()
+  body.position = at
+  for i in 5:
+    var shape := RectangleShape2D.new()
+    shape.size = Vector2(20.0 * (i + 1), 20.0)
+    var collision := CollisionShape2D.new()
+    collision.shape = shape
+    collision.position = Vector2(10.0 * (i + 1) - 100.0, 20.0 * (i - 2))
+    body.add_child(collision)
+  add_child(body)
+
+## Add a U shape opening towards the origin, with its inner and outer bottom sides parallel.
+func add_cup(at: Vector2) -> void:
+  var body := StaticBody2D.new()
+  body.position = at
+  var collision := CollisionPolygon2D.new()
+  collision.polygon = PackedVector2Array([
+    Vector2(-60, -40), Vector2(-40, -40), Vector2(-40, 20), Vector2(40, 20),
+    Vector2(40, -40), Vector2(60, -40), Vector2(60, 40), Vector2(-60, 40),
+  ])
+  body.add_child(collision)
+  add_child(body)
+
+func create_node(use_ray_cache: bool) -> LineOfSight2D:
+  var node := ViewChecks.create_node(360.0, RADIUS)
+  node.use_ray_cache = use_ray_cache
+  add_child(node)
+  return node
+
+func _process(_delta: float) -> void:
+  # This runs before the nodes, so they were both swept from the same spot in the last frame.
+  if frames > 0 and frames <= MOVING_FRAMES:
+    for i in PROBE_COUNT:
+      var direction := Vector2.from_angle(TAU * (i + 0.5) / PROBE_COUNT)
+      probes += 1
+      var error: float = (
+        ViewChecks.measure(cached, direction) - ViewChecks.measure(uncached, direction)
+      )
+      if absf(error) > TOLERANCE:
+        mismatches += 1
+  elif frames > MOVING_FRAMES + 1:
+    still_rays += cached.get_rays_cast()
+  frames += 1
+
+  if frames <= MOVING_FRAMES:
+    cached.position += MOVE_STEP
+    cached.rotation += ROTATION_STEP
+    uncached.transform = cached.transform
+  elif frames > MOVING_FRAMES + STILL_FRAMES + 1:
+    finish()
+
+func finish() -> void:
+  # Every direction of the sweep is cast at least once every RAY_CACHE_MAX_AGE + 1 sweeps.
+  var directions: int = int(cached.angle * cached.resolution) + 1
+  var still_sweeps: int = STILL_FRAMES
+  var expected_rays: int = int(still_sweeps * directions / (RAY_CACHE_MAX_AGE + 1.0))
+  var stats: Dictionary = cached.get_stats()
+
+  print("View mismatches: %d / %d" % [mismatches, probes])
+  print("Rays cast while still: %d, at least %d expected" % [still_rays, expected_rays])
+  print("Last sweep: %d hits, %d misses" % [stats["ray_cache_hits"], stats["ray_cache_misses"]])
+  get_tree().quit(1 if mismatches > 0 or still_rays < expected_rays else 0)
@@ -0,0 +1,62 @@
+extends Node2D
+
+## Checks the shadowcast mode against a small hand-built layer whose visible cells are known.
+##
+## Exits with a non-zero code when a cell is seen or hidden against the expectation, so it can run
+## headless:
+##   godot --headless --path demo res://benchmark/shadowcast_2d.tscn
+
+const TileLayout = preload("res://benchmark/tile_layout.gd")
+
+# A single wall east of the node, and a whole column of walls west of it.
+const WALLS: Array[Vector2i] = [
+  Vector2i(2, 0),
+  Vector2i(-2, -4), Vector2i(-2, -3), Vector2i(-2, -2), Vector2i(-2, -1), Vector2i(-2, 0),
+  Vector2i(-2, 1), Vector2i(-2, 2), Vector2i(-2, 3), Vector2i(-2, 4),
+]
+# The walls themselves are seen, like the empty cells around the node.
+const VISIBLE: Array[Vector2i] = [
+  Vector2i(0, 0), Vector2i(1, 0), Vector2i(2, 0), Vector2i(-2, 0), Vector2i(-1, 1),
+  Vector2i(0, 3), Vector2i(0, -3), Vector2i(3, 3), Vector2i(3, -3), Vector2i(5, 4),
+]
+# The cells right behind the walls.
+const HIDDEN: Array[Vector2i] = [
+  Vector2i(3, 0), Vector2i(4, 0), Vector2i(-3, 0), Vector2i(-3, 1), Vector2i(-4, -1),
+  Vector2i(-4, 0), Vector2i(-5, 2),
+]
+
+var tile_map: TileMap
+var agent: LineOfSight2D
+var frames: int = 0
+
+func _ready() -> void:
+  tile_map = TileLayout.create_tile_map(WALLS)
+  add_child(tile_map)
+
+  agent = LineOfSight2D.new()
+  agent.mode = LineOfSight2D.MODE_SHADOWCAST
+  agent.angle = 360.0
+  agent.radius = 12.0 * TileLayout.TILE_SIZE
+  agent.position = tile_map.map_to_local(Vector2i.ZERO)
+  add_child(agent)
+  agent.tile_map = agent.get_path_to(tile_map)
+
+func _process(_delta: float) -> void:
+  # Let the node read the layer and sweep first.
+  frames += 1
+  if frames == 3:
+    run()
+
+func run() -> void:
+  var errors: int = 0
+  for cell in VISIBLE:
+    if not agent.is_point_in_view(tile_map.map_to_local(cell)):
+      print("Cell %s should be visible." % cell)
+      errors += 1
+  for cell in HIDDEN:
+    if agent.is_point_in_view(tile_map.map_to_local(cell)):
+      print("Cell %s should be hidden." % cell)
+      errors += 1
+
+  print("Shadowcast errors: %d / %d" % [errors, VISIBLE.size() + HIDDEN.size()])
+  get_tree().quit(1 if errors > 0 else 0)
@@ -0,0 +1,71 @@
+extends Node2D
+
+## Checks the simplification of the indexed mesh.
+##
+## Without a tolerance, a node without occluders in range keeps every point of its arc, since no
+## three of them are collinear. A node facing a long flat wall sees a single straight outline, which
+## collapses to its ends with a tolerance. Every node must emit at most as many vertices as it would
+## without simplifying. Exits with a non-zero code on failure:
+##   godot --headless --path demo res://benchmark/simplify_2d.tscn
+
+const ViewChecks = preload("res://benchmark/view_checks.gd")
+const RADIUS: float = 400.0
+const WALL_DISTANCE: float = 100.0
+const TOLERANCE: float = 1.0
+# The two ends of the wall and the origin of the fan.
+const COLLAPSED_VERTICES: int = 3
+
+var arc: LineOfSight2D
+var wall_exact: LineOfSight2D
+var wall_simplified: LineOfSight2D
+var frames: int = 0
+
+func _ready() -> void:
+  # The wall faces the nodes at the origin, and is long enough to cover their whole cone.
+  var wall := StaticBody2D.new()
+  var shape := CollisionShape2D.new()
+  var rectangle := RectangleShape2D.new()
+  rectangle.size = Vector2(20, 1000)
+  shape.shape = rectangle
+  wall.add_child(shape)
+  wall.position = Vector2(WALL_DISTANCE + 10, 0)
+  add_child(wall)
+
+  # Far from the wall, so the node only sees its arc.
+  arc = create_node("Arc", Vector2(0, 2000), 0.0)
+  wall_exact = create_node("WallExact", Vector2.ZERO, 0.0)
+  wall_simplified = create_node("WallSimplified", Vector2.ZERO, TOLERANCE)
+
+func create_node(node_name: String, position: Vector2, tolerance: float) -> LineOfSight2D:
+  var node := ViewChecks.create_node(90.0, RADIUS)
+  node.name = node_name
+  node.position = position
+  node.indexed_mesh = true
+  node.simplify_tolerance = tolerance
+  add_child(node)
+  return node
+
+func _process(_delta: float) -> void:
+  # Let the wall enter the physics space and the nodes sweep first.
+  frames += 1
+  if frames == 3:
+    run()
+
+func run() -> void:
+  var errors: int = 0
+  for node in [arc, wall_exact, wall_simplified]:
+    var emitted: int = node.get_vertices_emitted()
+    var unsimplified: int = node.get_vertices_unsimplified()
+    print("%s: %d vertices, %d unsimplified" % [node.name, emitted, unsimplified])
+    if unsimplified < emitted:
+      print("More vertices than without simplifying.")
+      errors += 1
+
+  if arc.get_vertices_emitted() != arc.get_vertices_unsimplified():
+    print("The arc should keep every vertex without a tolerance.")
+    errors += 1
+  if wall_simplified.get_vertices_emitted() > COLLAPSED_VERTICES:
+    print("The wall should collapse to %d vertices." % COLLAPSED_VERTICES)
+    errors += 1
+
+  get_tree().quit(1 if errors > 0 else 0)
@@ -0,0 +1,45 @@
+extends RefCounted
+
+## Builds the TileMaps of the checks from a list of used cells, with a single square tile whose
+## collision covers it, so that the physics server sees the same walls.
+
+const TILE_SIZE: int = 16
+
+## The cells of a square map filled at random, from a fixed seed so that every run sees the same
+## walls.
+static func random_cells(layout_seed: int, size: int, fill_ratio: float) -> Array[Vector2i]:
+  var rng := RandomNumberGenerator.new()
+  rng.seed = layout_seed
+  var cells: Array[Vector2i] = []
+  for y in size:
+    for x in size:
+      if rng.randf() < fill_ratio:
+        cells.append(Vector2i(x, y))
+  return cells
+
+static func create_tile_map(cells: Array[Vector2i]) -> TileMap:
+  var image := Image.create(TILE_SIZE, TILE_SIZE, false, Image.FORMAT_RGBA8)
+  image.fill(Color.WHITE)
+  var source := TileSetAtlasSource.new()
+  source.texture = ImageTexture.create_from_image(image)
+  source.texture_region_size = Vector2i(TILE_SIZE, TILE_SIZE)
+  source.create_tile(Vector2i.ZERO)
+
+  var tile_set := TileSet.new()
+  tile_set.tile_size = Vector2i(TILE_SIZE, TILE_SIZE)
+  tile_set.add_physics_layer()
+  var source_id: int = tile_set.add_source(source)
+
+  # The collision polygons are centered on the tile.
+  var half: float = TILE_SIZE / 2.0
+  var tile_data: TileData = source.get_tile_data(Vector2i.ZERO, 0)
+  tile_data.add_collision_polygon(0)
+  tile_data.set_collision_polygon_points(0, 0, PackedVector2Array([
+    Vector2(-half, -half), Vector2(half, -half), Vector2(half, half), Vector2(-half, half)
+  ]))
+
+  var tile_map := TileMap.new()
+  tile_map.tile_set = tile_set
+  for cell in cells:
+    tile_map.set_cell(0, cell, source_id, Vector2i.ZERO)
+  return tile_map
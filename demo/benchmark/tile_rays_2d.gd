@@ -0,0 +1,77 @@
+extends Node2D
+
+## Checks the rays cast over the tiles of a TileMap against the physics server, on the same rays.
+##
+## Exits with a non-zero code when a ray hits something else than with the physics server, so it
+## can run headless:
+##   godot --headless --path demo res://benchmark/tile_rays_2d.tscn
+
+const TileLayout = preload("res://benchmark/tile_layout.gd")
+const MAP_SIZE: int = 80
+const FILL_RATIO: float = 0.15
+const RAY_COUNT: int = 5000
+const TOLERANCE: float = 0.5
+
+var tile_map: TileMap
+var agent: LineOfSight2D
+var frames: int = 0
+
+func _ready() -> void:
+  tile_map = TileLayout.create_tile_map(TileLayout.random_cells(1234, MAP_SIZE, FILL_RATIO))
+  add_child(tile_map)
+
+  agent = LineOfSight2D.new()
+  agent.use_tile_map = true
+  agent.render_enabled = false
+  add_child(agent)
+  agent.tile_map = agent.get_path_to(tile_map)
+
+func _physics_process(_delta: float) -> void:
+  # Let the physics server register the tiles first.
+  frames += 1
+  if frames == 3:
+    run()
+
+func run() -> void:
+  var rng := RandomNumberGenerator.new()
+  rng.seed = 4321
+  var extent: float = MAP_SIZE * TileLayout.TILE_SIZE
+  var rays: Array[PackedVector2Array] = []
+  while rays.size() < RAY_COUNT:
+    var from := Vector2(rng.randf_range(0, extent), rng.randf_range(0, extent))
+    # The physics server ignores the shape a ray starts in, so start in the empty cells.
+    if tile_map.get_cell_source_id(0, tile_map.local_to_map(from)) != -1:
+      continue
+    var to := from + Vector2.from_angle(rng.randf_range(0, TAU)) * rng.randf_range(50, 400)
+    rays.append(PackedVector2Array([from, to]))
+
+  var space: PhysicsDirectSpaceState2D = get_world_2d().direct_space_state
+  var query := PhysicsRayQueryParameters2D.new()
+  var physics_hits: Array[Dictionary] = []
+  var start: int = Time.get_ticks_usec()
+  for ray in rays:
+    query.from = ray[0]
+    query.to = ray[1]
+    physics_hits.append(space.intersect_ray(query))
+  var physics_usec: int = Time.get_ticks_usec() - start
+
+  var tile_hits: Array[Dictionary] = []
+  start = Time.get_ticks_usec()
+  for ray in rays:
+    tile_hits.append(agent.intersect_tile_ray(ray[0], ray[1]))
+  var tile_usec: int = Time.get_ticks_usec() - start
+
+  var mismatches: int = 0
+  for i in RAY_COUNT:
+    var expected: Dictionary = physics_hits[i]
+    var actual: Dictionary = tile_hits[i]
+    if expected.is_empty() != actual.is_empty():
+      mismatches += 1
+    elif not expected.is_empty():
+      if expected["position"].distance_to(actual["position"]) > TOLERANCE:
+        mismatches += 1
+
+  print("Physics server: %.3f usec per ray" % (physics_usec / float(RAY_COUNT)))
+  print("Tile map:       %.3f usec per ray" % (tile_usec / float(RAY_COUNT)))
+  print("Mismatches: %d / %d" % [mismatches, RAY_COUNT])
+  get_tree().quit(1 if mismatches > 0 else 0)
@@ -0,0 +1,25 @@
+extends RefCounted
+
+## Creates the nodes of the checks comparing views, and measures their views along directions.
+
+## A node seeing a cone from its origin, without the gap around it, to be added by the caller once
+## the check has set it up.
+static func create_node(angle: float, radius: float) -> LineOfSight2D:
+  var node := LineOfSight2D.new()
+  node.angle = angle
+  node.radius = radius
+  node.distance_from_origin = 0.0
+  return node
+
+## Find how far the view reaches along a direction, by bisecting the points in view. The view is
+## star-shaped around its origin, so the points in view along a direction form a single segment.
+static func measure(node: LineOfSight2D, direction: Vector2) -> float:
+  var low: float = 0.0
+  var high: float = node.radius
+  for i in 24:
+    var middle: float = (low + high) / 2.0
+    if node.is_point_in_view(node.global_position + direction * middle):
+      low = middle
+    else:
+      high = middle
+  return low
@@ -0,0 +1,130 @@
+#include "fixedtrig.h"
+
+#include <godot_cpp/core/math.hpp>
+
+using namespace godot;
+
+// The arctangent of 2^-i in 2^-32 turns, for every iteration i.
+static const int32_t ARCTANGENTS[FixedTrig::ITERATIONS] = {
+  536870912, 316933406, 167458907, 85004756, 42667331, 21354465, 10679838, 5340245,
+  2670163,   1335087,   667544,    333772,   166886,   83443,    41722,    20861,
+  10430,     5215,      2608,      1304,     652,      326,      163,      81,
+  41,        20,        10,        5,        3,        1,
+};
+
+// The inverse of the length gained by the rotations of the iterations, in fixed point.
+static const int64_t CORDIC_GAIN = 652032874;
+
+/// @brief Map an angle to a fraction of a turn. Only operations rounded exactly by IEEE 754 are
+/// used, so every platform gets the same fraction.
+/// @param p_degrees The angle in degrees.
+/// @return The angle in 2^-32 turns, wrapped to one turn.
+uint32_t FixedTrig::to_turns(const double p_degrees) {
+  double turns = Math::fposmod(p_degrees, 360.0) / 360.0;
+  return (uint32_t)(int64_t)Math::floor(turns * 4294967296.0 + 0.5);
+}
+
+/// @brief Compute the sine and the cosine of an angle in fixed point.
+/// @param p_turns The angle in 2^-32 turns.
+/// @param r_sin The sine, where ONE is 1.
+/// @param r_cos The cosine, where ONE is 1.
+void FixedTrig::get_sin_cos(const uint32_t p_turns, int32_t &r_sin, int32_t &r_cos) {
+  // CORDIC only converges within about a quarter turn, so rotate from the closest axis.
+  uint32_t quadrant = ((p_turns + (1u << 29)) >> 30) & 3;
+  int64_t angle = (int32_t)(p_turns - (quadrant << 30));
+
+  int64_t x = CORDIC_GAIN;
+  int64_t y = 0;
+  for (int i = 0; i < ITERATIONS; i++) {
+    int64_t next_x;
+    if (angle >= 0) {
+      next_x = x - (y >> i);
+      y += x >> i;
+      angle -= ARCTANGENTS[i];
+    } else {
+      next_x = x + (y >> i);
+      y -= x >> i;
+      angle += ARCTANGENTS[i];
+    }
+    x = next_x;
+  }
+
+  switch (quadrant) {
+    case 0:
+      r_cos = (int32_t)x;
+      r_sin = (int32_t)y;
+      break;
+    case 1:
+      r_cos = (int32_t)-y;
+      r_sin = (int32_t)x;
+      break;
+    case 2:
+      r_cos = (int32_t)-x;
+      r_sin = (int32_t)-y;
+      break;
+    default:
+      r_cos = (int32_t)y;
+      r_sin = (int32_t)-x;
+      break;
+  }
+}
+
+/// @brief Get the direction of an angle, like Vector2(cos, sin) but the same on every platform.
+/// @param p_degrees The angle in degrees.
+Vector2 FixedTrig::get_unit_vector(const double p_degrees) {
+  int32_t sin;
+  int32_t cos;
+  get_sin_cos(to_turns(p_degrees), sin, cos);
+  // Dividing by a power of two is exact, and the rounding to real_t is the same everywhere.
+  return Vector2((double)cos / ONE, (double)sin / ONE);
+}
+
+/// @brief Measure the angle of a vector in fixed point.
+/// @param p_vector The vector, of any length.
+/// @return The angle in 2^-32 turns, or 0 for a zero vector.
+uint32_t FixedTrig::get_turns(const Vector2 &p_vector) {
+  // Dividing by the largest coordinate is rounded exactly, and keeps every bit of the shorter one.
+  double scale = MAX(Math::abs((double)p_vector.x), Math::abs((double)p_vector.y));
+  if (scale == 0) {
+    return 0;
+  }
+  int64_t x = (int64_t)Math::floor(p_vector.x / scale * ONE + 0.5);
+  int64_t y = (int64_t)Math::floor(p_vector.y / scale * ONE + 0.5);
+
+  // CORDIC only converges within about a quarter turn, so start from the closest axis.
+  uint32_t turns = 0;
+  if (Math::abs(y) > Math::abs(x)) {
+    turns = y > 0 ? 1u << 30 : 3u << 30;
+    int64_t next_x = y > 0 ? y : -y;
+    y = y > 0 ? -x : x;
+    x = next_x;
+  } else if (x < 0) {
+    x = -x;
+    y = -y;
+    turns = 2u << 30;
+  }
+
+  // Rotate the vector onto the X axis, adding up the angles it turned by.
+  for (int i = 0; i < ITERATIONS; i++) {
+    int64_t next_x;
+    if (y > 0) {
+      next_x = x + (y >> i);
+      y -= x >> i;
+      turns += ARCTANGENTS[i];
+    } else {
+      next_x = x - (y >> i);
+      y += x >> i;
+      turns -= ARCTANGENTS[i];
+    }
+    x = next_x;
+  }
+  return turns;
+}
+
+/// @brief Get the angle of a vector, like atan2 but the same on every platform.
+/// @param p_vector The vector, of any length.
+/// @return The angle in degrees, from -180 to 180, or 0 for a zero vector.
+double FixedTrig::get_angle(const Vector2 &p_vector) {
+  // A single multiplication is rounded the same way everywhere.
+  return (double)(int32_t)get_turns(p_vector) * (360.0 / 4294967296.0);
+}
@@ -0,0 +1,27 @@
+#ifndef FIXED_TRIG_H
+#define FIXED_TRIG_H
+
+#include <godot_cpp/variant/vector2.hpp>
+
+using namespace godot;
+
+/// @brief Sines and cosines computed in fixed point, which give the same bits on every platform.
+///
+/// The sines of the standard library differ between platforms and compilers in their last bits,
+/// which is enough for two peers of a lockstep game to disagree about a ray grazing a corner. The
+/// angles are mapped to 32-bit fractions of a turn and rotated with CORDIC (shifts and adds over a
+/// table of arctangents), so only integer arithmetic runs between the angle and the result. The
+/// angles of vectors are measured the other way around, by rotating them onto the X axis.
+class FixedTrig {
+public:
+  static const int ITERATIONS = 30;  // The CORDIC iterations, one bit of precision each.
+  static const int ONE = 1 << 30;    // The fixed-point value of 1 of the sines and cosines.
+
+  static uint32_t to_turns(const double p_degrees);
+  static void get_sin_cos(const uint32_t p_turns, int32_t &r_sin, int32_t &r_cos);
+  static Vector2 get_unit_vector(const double p_degrees);
+  static uint32_t get_turns(const Vector2 &p_vector);
+  static double get_angle(const Vector2 &p_vector);
+};
+
+#endif
@@ -1,8 +1,23 @@
 #include "lineofsight2d.h"
 
+#include "lineofsightserver.h"
+
+#include <godot_cpp/classes/circle_shape2d.hpp>
+#include <godot_cpp/classes/collision_object2d.hpp>
+#include <godot_cpp/classes/collision_polygon2d.hpp>
+#include <godot_cpp/classes/collision_shape2d.hpp>
+#include <godot_cpp/classes/engine.hpp>
+#include <godot_cpp/classes/scene_tree.hpp>
+#include <godot_cpp/classes/physics_server2d.hpp>
+#include <godot_cpp/classes/rendering_server.hpp>
+#include <godot_cpp/classes/tile_map.hpp>
+#include <godot_cpp/classes/tile_set.hpp>
 #include <godot_cpp/classes/time.hpp>
+#include <godot_cpp/classes/window.hpp>
 #include <godot_cpp/core/class_db.hpp>
 
+#include <cstring>
+
 using namespace godot;
 
 void LineOfSight2D::_bind_methods() {
@@ -67,192 +82,1458 @@ void LineOfSight2D::_bind_methods() {
       "set_radius", "get_radius"
   );
 
+  ClassDB::bind_method(D_METHOD("get_mode"), &LineOfSight2D::get_mode);
+  ClassDB::bind_method(D_METHOD("set_mode", "p_mode"), &LineOfSight2D::set_mode);
+  ClassDB::add_property(
+      "LineOfSight2D",
+      PropertyInfo(Variant::INT, "mode", PROPERTY_HINT_ENUM, "Raycast,Analytic,Shadowcast"),
+      "set_mode", "get_mode"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_occluder_root"), &LineOfSight2D::get_occluder_root);
+  ClassDB::bind_method(
+      D_METHOD("set_occluder_root", "p_occluder_root"), &LineOfSight2D::set_occluder_root
+  );
+  ClassDB::add_property(
+      "LineOfSight2D", PropertyInfo(Variant::NODE_PATH, "occluder_root"), "set_occluder_root",
+      "get_occluder_root"
+  );
+
+  ClassDB::bind_method(D_METHOD("refresh_occluders"), &LineOfSight2D::refresh_occluders);
+
+  ClassDB::bind_method(D_METHOD("get_tile_map"), &LineOfSight2D::get_tile_map);
+  ClassDB::bind_method(D_METHOD("set_tile_map", "p_tile_map"), &LineOfSight2D::set_tile_map);
+  ClassDB::add_property(
+      "LineOfSight2D",
+      PropertyInfo(Variant::NODE_PATH, "tile_map", PROPERTY_HINT_NODE_PATH_VALID_TYPES, "TileMap"),
+      "set_tile_map", "get_tile_map"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_tile_map_layer"), &LineOfSight2D::get_tile_map_layer);
+  ClassDB::bind_method(
+      D_METHOD("set_tile_map_layer", "p_tile_map_layer"), &LineOfSight2D::set_tile_map_layer
+  );
+  ClassDB::add_property(
+      "LineOfSight2D", PropertyInfo(Variant::INT, "tile_map_layer", PROPERTY_HINT_RANGE, "0,64,1"),
+      "set_tile_map_layer", "get_tile_map_layer"
+  );
+
+  ClassDB::bind_method(D_METHOD("refresh_tiles"), &LineOfSight2D::refresh_tiles);
+  ClassDB::bind_method(D_METHOD("update_tiles", "p_cells"), &LineOfSight2D::update_tiles);
+
+  BIND_ENUM_CONSTANT(MODE_RAYCAST);
+  BIND_ENUM_CONSTANT(MODE_ANALYTIC);
+  BIND_ENUM_CONSTANT(MODE_SHADOWCAST);
+
+  ClassDB::bind_method(D_METHOD("get_update_mode"), &LineOfSight2D::get_update_mode);
+  ClassDB::bind_method(
+      D_METHOD("set_update_mode", "p_update_mode"), &LineOfSight2D::set_update_mode
+  );
+  ClassDB::add_property(
+      "LineOfSight2D",
+      PropertyInfo(
+          Variant::INT, "update_mode", PROPERTY_HINT_ENUM, "Process,Server,Scheduled,Physics"
+      ),
+      "set_update_mode", "get_update_mode"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_update_priority"), &LineOfSight2D::get_update_priority);
+  ClassDB::bind_method(
+      D_METHOD("set_update_priority", "p_update_priority"), &LineOfSight2D::set_update_priority
+  );
+  ClassDB::add_property(
+      "LineOfSight2D",
+      PropertyInfo(Variant::FLOAT, "update_priority", PROPERTY_HINT_RANGE, "0,100,0.01"),
+      "set_update_priority", "get_update_priority"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_lod_scale"), &LineOfSight2D::get_lod_scale);
+
+  ClassDB::bind_method(D_METHOD("get_incremental"), &LineOfSight2D::get_incremental);
+  ClassDB::bind_method(
+      D_METHOD("set_incremental", "p_incremental"), &LineOfSight2D::set_incremental
+  );
+  ClassDB::add_property(
+      "LineOfSight2D", PropertyInfo(Variant::BOOL, "incremental"), "set_incremental",
+      "get_incremental"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_collision_mask"), &LineOfSight2D::get_collision_mask);
+  ClassDB::bind_method(
+      D_METHOD("set_collision_mask", "p_collision_mask"), &LineOfSight2D::set_collision_mask
+  );
+  ClassDB::add_property(
+      "LineOfSight2D",
+      PropertyInfo(Variant::INT, "collision_mask", PROPERTY_HINT_LAYERS_2D_PHYSICS),
+      "set_collision_mask", "get_collision_mask"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_exclude"), &LineOfSight2D::get_exclude);
+  ClassDB::bind_method(D_METHOD("set_exclude", "p_exclude"), &LineOfSight2D::set_exclude);
+  ClassDB::add_property(
+      "LineOfSight2D", PropertyInfo(Variant::ARRAY, "exclude", PROPERTY_HINT_ARRAY_TYPE, "RID"),
+      "set_exclude", "get_exclude"
+  );
+
+  ClassDB::bind_method(
+      D_METHOD("get_use_occluder_index"), &LineOfSight2D::get_use_occluder_index
+  );
+  ClassDB::bind_method(
+      D_METHOD("set_use_occluder_index", "p_use_occluder_index"),
+      &LineOfSight2D::set_use_occluder_index
+  );
+  ClassDB::add_property(
+      "LineOfSight2D", PropertyInfo(Variant::BOOL, "use_occluder_index"),
+      "set_use_occluder_index", "get_use_occluder_index"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_use_tile_map"), &LineOfSight2D::get_use_tile_map);
+  ClassDB::bind_method(
+      D_METHOD("set_use_tile_map", "p_use_tile_map"), &LineOfSight2D::set_use_tile_map
+  );
+  ClassDB::add_property(
+      "LineOfSight2D", PropertyInfo(Variant::BOOL, "use_tile_map"), "set_use_tile_map",
+      "get_use_tile_map"
+  );
+
+  ClassDB::bind_method(
+      D_METHOD("get_adaptive_subdivisions"), &LineOfSight2D::get_adaptive_subdivisions
+  );
+  ClassDB::bind_method(
+      D_METHOD("set_adaptive_subdivisions", "p_adaptive_subdivisions"),
+      &LineOfSight2D::set_adaptive_subdivisions
+  );
+  ClassDB::add_property(
+      "LineOfSight2D",
+      PropertyInfo(Variant::INT, "adaptive_subdivisions", PROPERTY_HINT_RANGE, "0,8,1"),
+      "set_adaptive_subdivisions", "get_adaptive_subdivisions"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_use_ray_cache"), &LineOfSight2D::get_use_ray_cache);
+  ClassDB::bind_method(
+      D_METHOD("set_use_ray_cache", "p_use_ray_cache"), &LineOfSight2D::set_use_ray_cache
+  );
+  ClassDB::add_property(
+      "LineOfSight2D", PropertyInfo(Variant::BOOL, "use_ray_cache"), "set_use_ray_cache",
+      "get_use_ray_cache"
+  );
+
+  ClassDB::bind_method(
+      D_METHOD("get_ray_cache_tolerance"), &LineOfSight2D::get_ray_cache_tolerance
+  );
+  ClassDB::bind_method(
+      D_METHOD("set_ray_cache_tolerance", "p_ray_cache_tolerance"),
+      &LineOfSight2D::set_ray_cache_tolerance
+  );
+  ClassDB::add_property(
+      "LineOfSight2D",
+      PropertyInfo(Variant::FLOAT, "ray_cache_tolerance", PROPERTY_HINT_RANGE, "0,64,0.01"),
+      "set_ray_cache_tolerance", "get_ray_cache_tolerance"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_deterministic"), &LineOfSight2D::get_deterministic);
+  ClassDB::bind_method(
+      D_METHOD("set_deterministic", "p_deterministic"), &LineOfSight2D::set_deterministic
+  );
+  ClassDB::add_property(
+      "LineOfSight2D", PropertyInfo(Variant::BOOL, "deterministic"), "set_deterministic",
+      "get_deterministic"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_render_enabled"), &LineOfSight2D::get_render_enabled);
+  ClassDB::bind_method(
+      D_METHOD("set_render_enabled", "p_render_enabled"), &LineOfSight2D::set_render_enabled
+  );
+  ClassDB::add_property(
+      "LineOfSight2D", PropertyInfo(Variant::BOOL, "render_enabled"), "set_render_enabled",
+      "get_render_enabled"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_render_mode"), &LineOfSight2D::get_render_mode);
+  ClassDB::bind_method(
+      D_METHOD("set_render_mode", "p_render_mode"), &LineOfSight2D::set_render_mode
+  );
+  ClassDB::add_property(
+      "LineOfSight2D",
+      PropertyInfo(Variant::INT, "render_mode", PROPERTY_HINT_ENUM, "Mesh,Distance Texture"),
+      "set_render_mode", "get_render_mode"
+  );
+
+  BIND_ENUM_CONSTANT(RENDER_MESH);
+  BIND_ENUM_CONSTANT(RENDER_DISTANCE_TEXTURE);
+
+  ClassDB::bind_method(D_METHOD("get_distance_texture"), &LineOfSight2D::get_distance_texture);
+
+  ClassDB::bind_method(D_METHOD("get_indexed_mesh"), &LineOfSight2D::get_indexed_mesh);
+  ClassDB::bind_method(
+      D_METHOD("set_indexed_mesh", "p_indexed_mesh"), &LineOfSight2D::set_indexed_mesh
+  );
+  ClassDB::add_property(
+      "LineOfSight2D", PropertyInfo(Variant::BOOL, "indexed_mesh"), "set_indexed_mesh",
+      "get_indexed_mesh"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_simplify_tolerance"), &LineOfSight2D::get_simplify_tolerance);
+  ClassDB::bind_method(
+      D_METHOD("set_simplify_tolerance", "p_simplify_tolerance"),
+      &LineOfSight2D::set_simplify_tolerance
+  );
+  ClassDB::add_property(
+      "LineOfSight2D",
+      PropertyInfo(Variant::FLOAT, "simplify_tolerance", PROPERTY_HINT_RANGE, "0,64,0.01"),
+      "set_simplify_tolerance", "get_simplify_tolerance"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_grid"), &LineOfSight2D::get_grid);
+  ClassDB::bind_method(D_METHOD("set_grid", "p_grid"), &LineOfSight2D::set_grid);
+  ClassDB::add_property(
+      "LineOfSight2D",
+      PropertyInfo(Variant::OBJECT, "grid", PROPERTY_HINT_RESOURCE_TYPE, "LineOfSightGrid"),
+      "set_grid", "get_grid"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_grid_teams"), &LineOfSight2D::get_grid_teams);
+  ClassDB::bind_method(D_METHOD("set_grid_teams", "p_grid_teams"), &LineOfSight2D::set_grid_teams);
+  ClassDB::add_property(
+      "LineOfSight2D",
+      PropertyInfo(
+          Variant::INT, "grid_teams", PROPERTY_HINT_FLAGS,
+          "Team 1,Team 2,Team 3,Team 4,Team 5,Team 6,Team 7,Team 8"
+      ),
+      "set_grid_teams", "get_grid_teams"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_frames_recomputed"), &LineOfSight2D::get_frames_recomputed);
+  ClassDB::bind_method(D_METHOD("get_frames_skipped"), &LineOfSight2D::get_frames_skipped);
+
+  BIND_ENUM_CONSTANT(UPDATE_PROCESS);
+  BIND_ENUM_CONSTANT(UPDATE_SERVER);
+  BIND_ENUM_CONSTANT(UPDATE_SCHEDULED);
+  BIND_ENUM_CONSTANT(UPDATE_PHYSICS);
+
   ClassDB::bind_method(D_METHOD("get_mesh_creation_time"), &LineOfSight2D::get_mesh_creation_time);
+  ClassDB::bind_method(D_METHOD("get_rays_cast"), &LineOfSight2D::get_rays_cast);
+  ClassDB::bind_method(D_METHOD("get_edges_resolved"), &LineOfSight2D::get_edges_resolved);
+  ClassDB::bind_method(D_METHOD("get_vertices_emitted"), &LineOfSight2D::get_vertices_emitted);
+  ClassDB::bind_method(
+      D_METHOD("get_vertices_unsimplified"), &LineOfSight2D::get_vertices_unsimplified
+  );
+  ClassDB::bind_method(D_METHOD("get_update_time_usec"), &LineOfSight2D::get_update_time_usec);
+  ClassDB::bind_method(D_METHOD("get_stats"), &LineOfSight2D::get_stats);
+  ClassDB::bind_method(D_METHOD("get_view_points"), &LineOfSight2D::get_view_points);
+
+  ClassDB::bind_method(D_METHOD("is_point_visible", "p_point"), &LineOfSight2D::is_point_visible);
+  ClassDB::bind_method(D_METHOD("is_point_in_view", "p_point"), &LineOfSight2D::is_point_in_view);
+  ClassDB::bind_method(
+      D_METHOD("intersect_tile_ray", "p_from", "p_to"), &LineOfSight2D::intersect_tile_ray
+  );
+  ClassDB::bind_method(D_METHOD("get_visible_bodies"), &LineOfSight2D::get_visible_bodies);
+  ClassDB::bind_method(D_METHOD("add_target", "p_target"), &LineOfSight2D::add_target);
+  ClassDB::bind_method(D_METHOD("remove_target", "p_target"), &LineOfSight2D::remove_target);
+  ClassDB::bind_method(D_METHOD("get_targets"), &LineOfSight2D::get_targets);
+  ClassDB::bind_method(D_METHOD("get_visibility_mask"), &LineOfSight2D::get_visibility_mask);
 }
 
 LineOfSight2D::LineOfSight2D() {
   resolution = 1;
-  edge_resolve_iterations = 5;
   edge_distance_threshold = 10;
   distance_from_origin = 60;
   angle = 90;
   radius = 100;
+  update_mode = UPDATE_PROCESS;
+  incremental = false;
+  use_occluder_index = false;
+  ray_cache_tolerance = 4;
+  use_tile_map = false;
+  grid_teams = 1;
+  grid_layout = 0;
+  render_enabled = true;
+  render_mode = RENDER_MESH;
+  mode = MODE_RAYCAST;
+  occluder_root = NodePath();
+  tile_map = NodePath();
+  tile_map_layer = 0;
 
   mesh_creation_time = 0;
-  Callable mesh_creation_callable = Callable(this, StringName("get_mesh_creation_time"));
-  performance = Performance::get_singleton();
-  if (!performance->has_custom_monitor(StringName("draw_time"))) {
-    performance->add_custom_monitor(StringName("draw_time"), mesh_creation_callable);
-  }
+  update_time_usec = 0;
+  vertices_emitted = 0;
+  vertices_unsimplified = 0;
+  update_priority = 1;
+  lod_scale = 1;
+
+  sweep_pending = false;
+  group_id = 0;
+  occluders_dirty = true;
+  tile_map_id = 0;
+  tiles_dirty = true;
+
+  occluder_shape.instantiate();
+  occluder_query.instantiate();
+  occluder_query->set_shape(occluder_shape);
+  last_occluders_hash = 0;
+  parameters_dirty = true;
+  frames_recomputed = 0;
+  frames_skipped = 0;
+
+  target_query.instantiate();
+  update_query_filters();
+
+  array_mesh.instantiate();
+  mesh_radius = -1;
+
+  distance_image.instantiate();
+  distance_texture.instantiate();
+  distance_material.instantiate();
+  quad_radius = -1;
 }
 
 LineOfSight2D::~LineOfSight2D() {
   // mesh->queue_free();
   // mesh = nullptr;
-  performance = nullptr;
 }
 
 void LineOfSight2D::_enter_tree() {
-  mesh = new MeshInstance2D();
+  mesh = memnew(MeshInstance2D);
+  mesh->set_mesh(array_mesh);
+  mesh->set_visible(render_enabled);
   draw_line_of_sight();
   mesh->set_modulate(Color(1, 0, 0));
   add_child(mesh);
 
+  // The server also keeps the aggregate monitors, which every node reports to.
+  LineOfSightServer::get_singleton()->connect_tree(get_tree());
+  if (use_occluder_index) {
+    LineOfSightServer::get_singleton()->acquire_occluder_index_2d();
+  }
+  if (is_server_updated()) {
+    LineOfSightServer::get_singleton()->register_agent_2d(this);
+  }
+
   // Required to make the mesh render correctly (don't overturn the mesh when the parent rotates)
   mesh->set_as_top_level(true);
 }
 
 void LineOfSight2D::_exit_tree() {
+  if (use_occluder_index) {
+    LineOfSightServer::get_singleton()->release_occluder_index_2d();
+  }
+  if (is_server_updated()) {
+    LineOfSightServer::get_singleton()->unregister_agent_2d(this);
+  }
+  if (grid.is_valid()) {
+    grid->remove_contribution(get_instance_id());
+  }
+  if (tile_map_id != 0) {
+    // The tile map is connected again if the node comes back.
+    Object *tile_map_node = ObjectDB::get_instance(tile_map_id);
+    if (tile_map_node != nullptr) {
+      tile_map_node->disconnect("changed", Callable(this, "refresh_tiles"));
+    }
+    tile_map_id = 0;
+  }
+
+  // The material goes with the mesh instance, so the quad is set up again on the next commit.
+  quad_radius = -1;
+  reset_interpolation();
   remove_child(mesh);
   mesh->queue_free();
 }
 
 void LineOfSight2D::_process(double delta) {
-  Time *time = Time::get_singleton();
-  double start_time = time->get_unix_time_from_system();
+  if (!is_sweep_needed()) {
+    return;
+  }
+
+  if (is_server_updated() || group_id != 0) {
+    // The sweep has already been computed by the server or the group during the physics frame.
+    if (sweep_pending) {
+      commit_line_of_sight();
+    }
+    mesh->set_global_position(sweep_origin);
+    return;
+  }
+
+  if (uses_interpolation()) {
+    update_interpolated_mesh();
+    return;
+  }
+  if (update_mode == UPDATE_PHYSICS) {
+    // Without steps to blend, the vertices are relative to the origin of the last tick.
+    mesh->set_global_position(sweep_origin);
+    return;
+  }
+
   draw_line_of_sight();
-  double end_time = time->get_unix_time_from_system();
-  set_mesh_creation_time(end_time - start_time);
 
   // Because the mesh is detached from the parent, we need to update its position manually.
   mesh->set_global_position(get_global_position());
 }
 
-/// @brief Create a raycast from the center of the circle to the point at the given angle.
-/// @param p_angle The angle at which to cast the ray in degrees.
-/// @return A ViewCastInfo object containing the information about the raycast.
-LineOfSight2D::ViewCastInfo LineOfSight2D::view_cast(const double p_angle) {
-  double cos_angle = Math::cos(Math::deg_to_rad(p_angle));
-  double sin_angle = Math::sin(Math::deg_to_rad(p_angle));
-  Vector2 local_from =
-      Vector2(get_distance_from_origin() * cos_angle, get_distance_from_origin() * sin_angle);
-  Vector2 local_to = Vector2(get_radius() * cos_angle, get_radius() * sin_angle);
-  Vector2 from = local_from + get_global_position();
-  Vector2 to = local_to + get_global_position();
-  Ref<PhysicsRayQueryParameters2D> parameters = PhysicsRayQueryParameters2D::create(from, to);
-
-  Dictionary dict = get_world_2d()->get_direct_space_state()->intersect_ray(parameters);
-
-  // If the raycast hit something, draw a line from the center of the circle to the point.
-  if (dict.has("position")) {
-    Vector2 position = dict["position"];
-    return ViewCastInfo(true, from, position, position.distance_to(from), p_angle);
-  } else {
-    return ViewCastInfo(false, from, to, radius, p_angle);
-  }
-}
-
-/// @brief Find the edge of the object that is between the two given view cast points.
-/// @param p_min_view_cast The first view cast point.
-/// @param p_max_view_cast The second view cast point.
-/// @return An EdgeInfo object containing the information about the edge of the object.
-LineOfSight2D::EdgeInfo
-LineOfSight2D::find_edge(ViewCastInfo p_min_view_cast, ViewCastInfo p_max_view_cast) {
-  double min_angle = p_min_view_cast.angle;
-  double max_angle = p_max_view_cast.angle;
-  Vector2 min_point = Vector2(0, 0);
-  Vector2 max_point = Vector2(0, 0);
-
-  for (int i = 0; i < edge_resolve_iterations; i++) {
-    double angle = (min_angle + max_angle) / 2.0;
-    ViewCastInfo new_view_cast = view_cast(angle);
-
-    bool edge_distance_threshold_exceeded =
-        Math::abs(p_min_view_cast.distance - new_view_cast.distance) > edge_distance_threshold;
-
-    if (new_view_cast.hit == p_min_view_cast.hit && !edge_distance_threshold_exceeded) {
-      min_angle = angle;
-      min_point = new_view_cast.point;
-    } else {
-      max_angle = angle;
-      max_point = new_view_cast.point;
+void LineOfSight2D::_physics_process(double delta) {
+  if (!is_sweep_needed() || update_mode != UPDATE_PHYSICS || group_id != 0) {
+    return;
+  }
+
+  // Query the space state at the physics rate, when it matches the last simulated step.
+  if (prepare_line_of_sight()) {
+    compute_line_of_sight();
+    commit_line_of_sight();
+  } else if (uses_interpolation()) {
+    // The view didn't change, so the rendered frames stop moving it.
+    repeat_interpolation_tick();
+  }
+}
+
+/// @brief Compute the exact visibility of the cone against the gathered occluder segments.
+void LineOfSight2D::sweep_analytic() {
+  int step_count = MAX(1, (int)(angle * resolution * lod_scale));
+  double step_size = angle / step_count;
+
+  visibility_polygon.compute(
+      sweep_origin, sweep_rotation - (angle / 2.0), angle, step_size, distance_from_origin, radius,
+      polygon_rays
+  );
+
+  for (uint32_t i = 0; i < polygon_rays.size(); i++) {
+    view_points_from.push_back(polygon_rays[i].origin - sweep_origin);
+    view_points_to.push_back(polygon_rays[i].point - sweep_origin);
+  }
+}
+
+/// @brief Compute the tiles seen from the tile of the origin, and output them as quads.
+///
+/// The quads are written as pairs of view points, so the mesh stays a triangle strip: every run of
+/// tiles is a quad, linked to the next one by a pair of degenerate triangles.
+void LineOfSight2D::sweep_shadowcast() {
+  shadow_runs.clear();
+  if (!tile_occupancy.has_tiles()) {
+    return;
+  }
+
+  Transform2D cell_transform = tile_occupancy.get_cell_transform();
+  Vector2 tile_size = tile_occupancy.get_tile_size();
+  Vector2i origin_cell = tile_occupancy.get_cell_at(sweep_origin);
+  int cell_radius = (int)Math::ceil(radius / MIN(tile_size.x, tile_size.y));
+  shadow_caster.compute(tile_occupancy, origin_cell, cell_radius, shadow_cells);
+
+  // Keep the tiles whose center is in the cone, and the tile of the origin.
+  Vector2 facing = sweep.get_unit_vector(sweep_rotation);
+  double cos_half_angle = sweep.get_unit_vector(angle / 2.0).x;
+  bool full_circle = angle >= 360.0;
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < shadow_cells.size(); i++) {
+    const Vector2i &cell = shadow_cells[i];
+    Vector2 center = cell_transform.xform(Vector2(cell) + Vector2(0.5, 0.5));
+    Vector2 offset = center - sweep_origin;
+    double distance = offset.length();
+    bool in_cone = full_circle || facing.dot(offset) >= distance * cos_half_angle;
+    if (cell == origin_cell || (distance <= radius && in_cone)) {
+      shadow_cells[kept++] = cell;
     }
   }
+  shadow_cells.resize(kept);
+  ShadowCaster::merge_runs(shadow_cells, shadow_runs);
+
+  for (uint32_t i = 0; i < shadow_runs.size(); i++) {
+    const ShadowCaster::Run &run = shadow_runs[i];
+    Vector2 top_left = cell_transform.xform(Vector2(run.x_begin, run.y)) - sweep_origin;
+    Vector2 top_right = cell_transform.xform(Vector2(run.x_end, run.y)) - sweep_origin;
+    Vector2 bottom_left = cell_transform.xform(Vector2(run.x_begin, run.y + 1)) - sweep_origin;
+    Vector2 bottom_right = cell_transform.xform(Vector2(run.x_end, run.y + 1)) - sweep_origin;
+
+    if (i > 0) {
+      view_points_from.push_back(view_points_to[view_points_to.size() - 1]);
+      view_points_to.push_back(top_left);
+    }
+    view_points_from.push_back(top_left);
+    view_points_to.push_back(bottom_left);
+    view_points_from.push_back(top_right);
+    view_points_to.push_back(bottom_right);
+  }
+}
+
+/// @brief Rasterize the tiles of the last shadowcast sweep into the cells of a grid.
+void LineOfSight2D::rasterize_runs(const LineOfSightGrid *p_grid) {
+  grid_spans.clear();
+  // Every run has two pairs of view points holding the corners of its quad, after the pair linking
+  // it to the previous run.
+  for (uint32_t i = 0; i < shadow_runs.size(); i++) {
+    uint32_t first = i * 3;
+    grid_polygon.clear();
+    grid_polygon.push_back(sweep_origin + view_points_from[first]);
+    grid_polygon.push_back(sweep_origin + view_points_from[first + 1]);
+    grid_polygon.push_back(sweep_origin + view_points_to[first + 1]);
+    grid_polygon.push_back(sweep_origin + view_points_to[first]);
+    p_grid->rasterize(grid_polygon, grid_crossings, grid_spans);
+  }
+}
+
+/// @brief Hash the bodies within the radius of the LOS and their transforms.
+/// @param r_complete Whether every occluder was hashed, false past MAX_OCCLUDER_RESULTS bodies.
+/// @return A hash which changes when an occluder appears, disappears or moves.
+uint32_t LineOfSight2D::hash_occluders(bool &r_complete) {
+  occluder_shape->set_radius(radius);
+  occluder_query->set_transform(Transform2D(0, sweep_origin));
+
+  TypedArray<Dictionary> results =
+      space_state->intersect_shape(occluder_query, MAX_OCCLUDER_RESULTS);
+  r_complete = results.size() < MAX_OCCLUDER_RESULTS;
+  PhysicsServer2D *physics_server = PhysicsServer2D::get_singleton();
+
+  // Combine the bodies with a sum so the order of the results doesn't matter.
+  uint32_t hash = results.size();
+  for (int i = 0; i < results.size(); i++) {
+    Dictionary result = results[i];
+    RID rid = result["rid"];
+    int shape = result["shape"];
+    Transform2D transform =
+        physics_server->body_get_state(rid, PhysicsServer2D::BODY_STATE_TRANSFORM);
+
+    uint32_t body_hash = hash_murmur3_one_64(rid.get_id());
+    body_hash = hash_murmur3_one_32(shape, body_hash);
+    for (int j = 0; j < 3; j++) {
+      body_hash = hash_murmur3_one_real(transform.columns[j].x, body_hash);
+      body_hash = hash_murmur3_one_real(transform.columns[j].y, body_hash);
+    }
+    hash += hash_fmix32(body_hash);
+  }
+
+  return hash;
+}
+
+/// @brief Whether a point is within the radius and the angle of the LOS, ignoring the occluders.
+bool LineOfSight2D::is_in_cone(const Vector2 &p_point) const {
+  Vector2 offset = p_point - get_global_position();
+  double distance = offset.length();
+  if (distance < distance_from_origin || distance > radius) {
+    return false;
+  }
+
+  double offset_angle = sweep.get_angle(offset);
+  double delta = Math::wrapf(offset_angle - get_global_rotation_degrees(), -180.0, 180.0);
+  return Math::abs(delta) <= angle / 2.0;
+}
+
+/// @brief Cast a single ray from the start of the LOS to a point.
+/// @param p_point The global position of the point.
+/// @param p_body The body expected at the point, or an empty RID for a point in empty space.
+/// @return Whether nothing but the expected body stands between the LOS and the point.
+bool LineOfSight2D::cast_target_ray(const Vector2 &p_point, const RID &p_body) {
+  Vector2 origin = get_global_position();
+  Vector2 direction = (p_point - origin).normalized();
+  target_query->set_from(origin + direction * distance_from_origin);
+  target_query->set_to(p_point);
+
+  // Queries may run before the first sweep, so don't rely on the cached space state.
+  Dictionary dict = get_world_2d()->get_direct_space_state()->intersect_ray(target_query);
+  if (dict.is_empty()) {
+    return true;
+  }
+  return p_body.is_valid() && RID(dict["rid"]) == p_body;
+}
+
+/// @brief Whether a node is visible. Collision objects may be hit by the ray, other nodes not.
+bool LineOfSight2D::is_target_visible(Node2D *p_target) {
+  Vector2 position = p_target->get_global_position();
+  if (!is_in_cone(position)) {
+    return false;
+  }
+
+  CollisionObject2D *body = Object::cast_to<CollisionObject2D>(p_target);
+  return cast_target_ray(position, body != nullptr ? body->get_rid() : RID());
+}
+
+/// @brief Check whether a point can be seen, without building the mesh.
+/// @param p_point The global position of the point.
+/// @return Whether the point is in the LOS and no obstacle hides it.
+bool LineOfSight2D::is_point_visible(const Vector2 &p_point) {
+  ERR_FAIL_COND_V(!is_inside_tree(), false);
+  return is_in_cone(p_point) && cast_target_ray(p_point, RID());
+}
+
+/// @brief Check whether a point is in the view of the last sweep, without casting a ray.
+/// @param p_point The global position of the point.
+/// @return Whether the point is covered by the last sweep, false if the node doesn't sweep.
+bool LineOfSight2D::is_point_in_view(const Vector2 &p_point) const {
+  if (mode == MODE_SHADOWCAST) {
+    return tile_occupancy.has_tiles() &&
+           shadow_cells.find(tile_occupancy.get_cell_at(p_point)) != -1;
+  }
+  return is_in_view(p_point);
+}
+
+/// @brief Cast a single ray over the tiles of the tile map, like the rays of the tile map sweeps.
+/// @param p_from The start of the ray in global coordinates.
+/// @param p_to The end of the ray in global coordinates.
+/// @return The "position" where the ray enters the first used cell, empty if it hits none.
+Dictionary LineOfSight2D::intersect_tile_ray(const Vector2 &p_from, const Vector2 &p_to) {
+  Dictionary result;
+  ERR_FAIL_COND_V(!is_inside_tree(), result);
+
+  update_tile_map();
+  real_t fraction = 0;
+  if (tile_occupancy.has_tiles() && tile_occupancy.intersect_ray(p_from, p_to, fraction)) {
+    result[StringName("position")] = p_from + (p_to - p_from) * fraction;
+  }
+  return result;
+}
+
+/// @brief Find the bodies whose origin can be seen, without building the mesh.
+/// @return The bodies within the radius, in the LOS and not hidden by another obstacle.
+TypedArray<Node2D> LineOfSight2D::get_visible_bodies() {
+  TypedArray<Node2D> bodies;
+  ERR_FAIL_COND_V(!is_inside_tree(), bodies);
+
+  Vector2 origin = get_global_position();
+  occluder_shape->set_radius(radius);
+  occluder_query->set_transform(Transform2D(0, origin));
+  TypedArray<Dictionary> results = get_world_2d()->get_direct_space_state()->intersect_shape(
+      occluder_query, MAX_OCCLUDER_RESULTS
+  );
+
+  for (int i = 0; i < results.size(); i++) {
+    Dictionary result = results[i];
+    Object *collider = result["collider"];
+    CollisionObject2D *body = Object::cast_to<CollisionObject2D>(collider);
+    // Bodies with several shapes are reported once per shape.
+    if (body == nullptr || body->is_ancestor_of(this) || bodies.has(body)) {
+      continue;
+    }
+    if (is_target_visible(body)) {
+      bodies.push_back(body);
+    }
+  }
+
+  return bodies;
+}
+
+/// @brief Register a node whose visibility is reported by get_visibility_mask().
+/// @param p_target The node, which gets the next bit of the mask.
+void LineOfSight2D::add_target(Node2D *p_target) {
+  ERR_FAIL_NULL(p_target);
+  ERR_FAIL_COND_MSG(targets.size() >= 64, "The visibility mask can't hold more than 64 targets.");
+
+  uint64_t id = p_target->get_instance_id();
+  if (targets.find(id) == -1) {
+    targets.push_back(id);
+  }
+}
+
+/// @brief Unregister a node. The bits of the targets registered after it are shifted down.
+void LineOfSight2D::remove_target(Node2D *p_target) {
+  ERR_FAIL_NULL(p_target);
+  targets.erase(p_target->get_instance_id());
+}
+
+TypedArray<Node2D> LineOfSight2D::get_targets() const {
+  TypedArray<Node2D> nodes;
+  for (uint32_t i = 0; i < targets.size(); i++) {
+    nodes.push_back(Object::cast_to<Node2D>(ObjectDB::get_instance(targets[i])));
+  }
+  return nodes;
+}
 
-  return EdgeInfo(min_point, max_point);
+/// @brief Check the visibility of every registered target with one ray each.
+/// @return A mask whose bit i is set when the target i is visible. Freed targets are never visible.
+int64_t LineOfSight2D::get_visibility_mask() {
+  ERR_FAIL_COND_V(!is_inside_tree(), 0);
+
+  int64_t mask = 0;
+  for (uint32_t i = 0; i < targets.size(); i++) {
+    Node2D *target = Object::cast_to<Node2D>(ObjectDB::get_instance(targets[i]));
+    if (target != nullptr && target->is_inside_tree() && is_target_visible(target)) {
+      mask |= int64_t(1) << i;
+    }
+  }
+  return mask;
 }
 
 /// @brief Draw the line of sight by casting rays and drawing lines between the points.
 void LineOfSight2D::draw_line_of_sight() {
-  List<Vector2> view_points_from = List<Vector2>();
-  List<Vector2> view_points_to = List<Vector2>();
-  ViewCastInfo old_view_cast_info = ViewCastInfo();
+  if (!prepare_line_of_sight()) {
+    return;
+  }
+  compute_line_of_sight();
+  commit_line_of_sight();
+}
 
-  int step_count = angle * resolution;
-  double step_size = angle / step_count;
-  double rotation_deg = get_global_rotation_degrees();
+/// @brief Read everything the sweep needs from the scene tree. Must run on the main thread.
+/// @return Whether the sweep must be computed, false if the last one is still valid.
+bool LineOfSight2D::prepare_line_of_sight() {
+  // Without a mesh or a grid to fill, the line of sight is only used through the queries.
+  if (!is_sweep_needed()) {
+    return false;
+  }
 
-  for (int i = 0; i <= step_count; i++) {
-    double current_angle = rotation_deg - (angle / 2.0) + (step_size * i);
-    ViewCastInfo view_cast_info = view_cast(current_angle);
+  // The cells must be rasterized again when the grid changes, even if the view doesn't.
+  if (grid.is_valid() && grid->get_layout() != grid_layout) {
+    grid_layout = grid->get_layout();
+    parameters_dirty = true;
+  }
 
-    // If we already have a previous view cast, check if the current view cast is different.
-    if (i > 0) {
-      bool edge_distance_threshold_exceeded =
-          Math::abs(old_view_cast_info.distance - view_cast_info.distance) >
-          edge_distance_threshold;
-
-      bool diff_hit = old_view_cast_info.hit != view_cast_info.hit;
-      bool both_hit = old_view_cast_info.hit && view_cast_info.hit;
-      if (diff_hit || (both_hit && edge_distance_threshold_exceeded)) {
-        EdgeInfo edge = find_edge(old_view_cast_info, view_cast_info);
-        if (edge.point_A != Vector2(0, 0)) {
-          view_points_from.push_back(view_cast_info.origin - get_global_position());
-          view_points_to.push_back(edge.point_A - get_global_position());
-        }
-        if (edge.point_B != Vector2(0, 0)) {
-          view_points_from.push_back(view_cast_info.origin - get_global_position());
-          view_points_to.push_back(edge.point_B - get_global_position());
-        }
-      }
+  // The space state and the transform are the same for every ray, so fetch them once per sweep.
+  space_state = get_world_2d()->get_direct_space_state();
+  occluder_index = nullptr;
+  if (use_occluder_index) {
+    occluder_index = LineOfSightServer::get_singleton()->get_occluder_index_2d();
+    gather_index_exclude();
+  }
+  sweep_origin = get_global_position();
+  sweep_rotation = get_global_rotation_degrees();
+
+  // Other nodes of the scene may not be in the tree yet before this node is ready.
+  if (mode == MODE_ANALYTIC && occluders_dirty && is_node_ready()) {
+    refresh_occluders();
+  }
+  bool uses_tiles = mode == MODE_SHADOWCAST || (mode == MODE_RAYCAST && use_tile_map);
+  if (uses_tiles && is_node_ready()) {
+    update_tile_map();
+  }
+  tiles = nullptr;
+  if (mode == MODE_RAYCAST && use_tile_map && tile_occupancy.has_tiles()) {
+    tiles = &tile_occupancy;
+  }
+
+  // The cached rays are only valid while no occluder moves. When some occluders weren't hashed,
+  // any of them may have moved.
+  bool occluders_complete = true;
+  uint32_t occluders_hash = incremental || use_ray_cache ? hash_occluders(occluders_complete) : 0;
+  check_ray_cache(occluders_hash, parameters_dirty || !occluders_complete);
+
+  if (incremental) {
+    Transform2D transform = get_global_transform();
+    bool changed = parameters_dirty || !occluders_complete || transform != last_transform ||
+                   occluders_hash != last_occluders_hash;
+    last_transform = transform;
+    last_occluders_hash = occluders_hash;
+    if (!changed) {
+      frames_skipped++;
+      LineOfSightServer::get_singleton()->add_to_counter(
+          LineOfSightServer::COUNTER_NODES_SKIPPED, 1
+      );
+      return false;
     }
+  }
+
+  parameters_dirty = false;
+  frames_recomputed++;
+  return true;
+}
+
+/// @brief Compute the view points of the line of sight. Safe to call from a worker thread.
+void LineOfSight2D::compute_line_of_sight() {
+  // Ticks are monotonic, unlike the system time.
+  uint64_t start_time = Time::get_singleton()->get_ticks_usec();
+
+  int step_count = MAX(1, (int)(angle * resolution * lod_scale));
+  begin_sweep(step_count);
+
+  if (mode == MODE_ANALYTIC) {
+    sweep_analytic();
+  } else if (mode == MODE_SHADOWCAST) {
+    sweep_shadowcast();
+  } else if (shared_sweep != nullptr) {
+    sweep_shared(angle);
+  } else {
+    sweep_raycast(angle, step_count);
+  }
+
+  if (grid.is_valid() && mode == MODE_SHADOWCAST) {
+    rasterize_runs(grid.ptr());
+  } else if (grid.is_valid()) {
+    rasterize_view(grid.ptr());
+  }
+  if (render_enabled && (uses_distance_texture() || uses_interpolation())) {
+    build_distance_view(angle, step_count);
+  } else if (render_enabled && uses_indexed_mesh()) {
+    build_indexed_view();
+  }
+
+  sweep_pending = true;
+  update_time_usec = Time::get_singleton()->get_ticks_usec() - start_time;
 
-    view_points_from.push_back(view_cast_info.origin - get_global_position());
-    view_points_to.push_back(view_cast_info.point - get_global_position());
+  // Report once per sweep, so the shared counters are barely touched.
+  LineOfSightServer *server = LineOfSightServer::get_singleton();
+  server->add_to_counter(LineOfSightServer::COUNTER_TIME_USEC, update_time_usec);
+  server->add_to_counter(LineOfSightServer::COUNTER_RAYS, rays_cast);
+  server->add_to_counter(LineOfSightServer::COUNTER_EDGES, edges_resolved);
+  server->add_to_counter(LineOfSightServer::COUNTER_BISECTION_RAYS, bisection_rays);
+  server->add_to_counter(LineOfSightServer::COUNTER_RAY_CACHE_HITS, ray_cache_hits);
+  server->add_to_counter(LineOfSightServer::COUNTER_RAY_CACHE_MISSES, ray_cache_misses);
+  server->add_to_counter(LineOfSightServer::COUNTER_NODES_UPDATED, 1);
+}
+
+/// @brief Build the mesh from the computed view points. Must run on the main thread.
+void LineOfSight2D::commit_line_of_sight() {
+  uint64_t start_time = Time::get_singleton()->get_ticks_usec();
+  if (render_enabled) {
+    update_mesh();
+  }
+  if (grid.is_valid()) {
+    grid->set_contribution(get_instance_id(), grid_teams, grid_spans);
+  }
+  sweep_pending = false;
+
+  // The sweep itself was timed by compute_line_of_sight(), maybe on another thread.
+  uint64_t commit_time_usec = Time::get_singleton()->get_ticks_usec() - start_time;
+  update_time_usec += commit_time_usec;
+  set_mesh_creation_time(update_time_usec / 1000000.0);
+
+  LineOfSightServer *server = LineOfSightServer::get_singleton();
+  server->add_to_counter(LineOfSightServer::COUNTER_TIME_USEC, commit_time_usec);
+  server->add_to_counter(LineOfSightServer::COUNTER_VERTICES, vertices_emitted);
+  server->add_to_counter(LineOfSightServer::COUNTER_VERTICES_UNSIMPLIFIED, vertices_unsimplified);
+}
+
+/// @brief Write the computed view points into the vertices of the mesh.
+void LineOfSight2D::update_mesh() {
+  if (uses_interpolation()) {
+    // The rendered frames draw the view between this tick and the one before.
+    push_interpolation_tick(angle);
+    return;
+  }
+  if (uses_distance_texture()) {
+    update_distance_texture(view_distances);
+    return;
+  }
+  clear_distance_quad();
+
+  if (uses_indexed_mesh()) {
+    update_indexed_mesh();
+    return;
+  }
+  update_strip(view_points_from, view_points_to);
+}
+
+/// @brief Draw the view between the last two physics ticks, on a rendered frame.
+void LineOfSight2D::update_interpolated_mesh() {
+  Vector2 origin;
+  double fraction = Engine::get_singleton()->get_physics_interpolation_fraction();
+  if (!interpolate_view(fraction, origin)) {
+    return;
+  }
+  mesh->set_global_position(origin);
+  if (uses_distance_texture()) {
+    update_distance_texture(interpolated_distances);
+    return;
+  }
+  clear_distance_quad();
+  update_strip(interpolated_from, interpolated_to);
+}
+
+/// @brief Replace the quad of the distance texture by the mesh of the view.
+void LineOfSight2D::clear_distance_quad() {
+  if (quad_radius >= 0) {
+    quad_radius = -1;
+    mesh->set_material(Ref<Material>());
+    array_mesh->clear_surfaces();
+  }
+}
+
+/// @brief Write view points into the vertices of the triangle strip.
+/// @param p_from The start of each view point, relative to the position of the mesh.
+/// @param p_to The end of each view point, relative to the position of the mesh.
+void LineOfSight2D::update_strip(
+    const LocalVector<Vector2> &p_from, const LocalVector<Vector2> &p_to
+) {
+  int point_count = p_to.size();
+  int vertex_count = point_count * 2;
+  vertices_emitted = vertex_count;
+  vertices_unsimplified = vertex_count;
+  if (vertex_count == 0) {
+    array_mesh->clear_surfaces();
+    return;
+  }
 
-    old_view_cast_info = view_cast_info;
+  // The surface keeps its size while the vertices fit in it, so it can be updated in place.
+  bool rebuild = array_mesh->get_surface_count() == 0 || vertex_count > vertices.size() ||
+                 vertex_count < vertices.size() / 4;
+#ifdef REAL_T_IS_DOUBLE
+  // The vertex buffer stores floats, so it can't be written directly from doubles.
+  rebuild = true;
+#endif
+  if (rebuild) {
+    vertices.resize(vertex_count + vertex_count / 4);
   }
 
-  int vertex_count = view_points_to.size() + 1;
-  SurfaceTool *st = new SurfaceTool();
-  st->begin(Mesh::PRIMITIVE_TRIANGLE_STRIP);
+  Vector3 *w = vertices.ptrw();
+  for (int i = 0; i < point_count; i++) {
+    // Add two vertices for each view point.
+    w[i * 2] = Vector3(p_from[i].x, p_from[i].y, 0);
+    w[i * 2 + 1] = Vector3(p_to[i].x, p_to[i].y, 0);
+  }
+  // Repeat the last vertex in the unused capacity, these triangles are degenerate.
+  for (int i = vertex_count; i < vertices.size(); i++) {
+    w[i] = w[vertex_count - 1];
+  }
 
-  for (int i = 0; i < vertex_count - 1; i++) {
-    // Add two vertices to the SurfaceTool for each view point.
-    st->add_vertex(Vector3(view_points_from[i].x, view_points_from[i].y, 0));
-    st->add_vertex(Vector3(view_points_to[i].x, view_points_to[i].y, 0));
+  if (rebuild) {
+    Array arrays;
+    arrays.resize(Mesh::ARRAY_MAX);
+    arrays[Mesh::ARRAY_VERTEX] = vertices;
+    array_mesh->clear_surfaces();
+    array_mesh->add_surface_from_arrays(
+        Mesh::PRIMITIVE_TRIANGLE_STRIP, arrays, TypedArray<Array>(), Dictionary(),
+        Mesh::ARRAY_FLAG_USE_DYNAMIC_UPDATE
+    );
+  } else {
+    RenderingServer::get_singleton()->mesh_surface_update_vertex_region(
+        array_mesh->get_rid(), 0, 0, vertices.to_byte_array()
+    );
   }
 
-  Ref<ArrayMesh> m = st->commit();
-  mesh->set_mesh(m);
+  // Updating the vertices doesn't update the bounds of the mesh, so cover the whole radius.
+  if (mesh_radius != radius) {
+    mesh_radius = radius;
+    Vector3 extents = Vector3(radius, radius, radius);
+    array_mesh->set_custom_aabb(AABB(-extents, extents * 2));
+  }
 }
 
-void LineOfSight2D::set_resolution(double value) { resolution = value; }
+/// @brief Write the indexed mesh built by the sweep into a new surface.
+void LineOfSight2D::update_indexed_mesh() {
+  int vertex_count = mesh_vertices.size();
+  vertices_emitted = vertex_count;
+  vertices_unsimplified = mesh_vertices_unsimplified;
+  // The triangle strip no longer matches the surface, so it must rebuild it.
+  vertices.clear();
+  if (vertex_count == 0) {
+    array_mesh->clear_surfaces();
+    return;
+  }
+
+  PackedVector3Array indexed_vertices;
+  indexed_vertices.resize(vertex_count);
+  Vector3 *w = indexed_vertices.ptrw();
+  for (int i = 0; i < vertex_count; i++) {
+    w[i] = Vector3(mesh_vertices[i].x, mesh_vertices[i].y, 0);
+  }
+  PackedInt32Array indices;
+  indices.resize(mesh_indices.size());
+  memcpy(indices.ptrw(), mesh_indices.ptr(), mesh_indices.size() * sizeof(int32_t));
+
+  // The triangles change with every sweep, so the surface is replaced instead of updated in place.
+  Array arrays;
+  arrays.resize(Mesh::ARRAY_MAX);
+  arrays[Mesh::ARRAY_VERTEX] = indexed_vertices;
+  arrays[Mesh::ARRAY_INDEX] = indices;
+  array_mesh->clear_surfaces();
+  array_mesh->add_surface_from_arrays(Mesh::PRIMITIVE_TRIANGLES, arrays);
+}
+
+/// @brief Whether the mesh is indexed, which only applies to the views swept around the origin.
+bool LineOfSight2D::uses_indexed_mesh() const { return indexed_mesh && mode != MODE_SHADOWCAST; }
+
+/// @brief Write the distances sampled by the sweep into the texture, and draw it on a quad covering
+/// the radius. The shader discards the pixels out of the view, so no geometry depends on it.
+/// @param p_distances The distance of the view along every step, from distance_start_angle.
+void LineOfSight2D::update_distance_texture(const LocalVector<float> &p_distances) {
+  int width = p_distances.size();
+  vertices_emitted = width > 0 ? 4 : 0;
+  vertices_unsimplified = vertices_emitted;
+  // The triangle strip no longer matches the surface, so it must rebuild it.
+  vertices.clear();
+  if (width == 0) {
+    array_mesh->clear_surfaces();
+    quad_radius = -1;
+    return;
+  }
+
+  // The distances span the whole radius, so they are kept as 32-bit floats.
+  PackedByteArray bytes;
+  bytes.resize(width * sizeof(float));
+  memcpy(bytes.ptrw(), p_distances.ptr(), width * sizeof(float));
+  bool resized = distance_texture->get_width() != width;
+  distance_image->set_data(width, 1, false, Image::FORMAT_RF, bytes);
+  if (resized) {
+    distance_texture->set_image(distance_image);
+  } else {
+    distance_texture->update(distance_image);
+  }
+
+  if (quad_radius != radius) {
+    quad_radius = radius;
+    PackedVector3Array corners;
+    corners.push_back(Vector3(-radius, -radius, 0));
+    corners.push_back(Vector3(radius, -radius, 0));
+    corners.push_back(Vector3(-radius, radius, 0));
+    corners.push_back(Vector3(radius, radius, 0));
+    Array arrays;
+    arrays.resize(Mesh::ARRAY_MAX);
+    arrays[Mesh::ARRAY_VERTEX] = corners;
+    array_mesh->clear_surfaces();
+    array_mesh->add_surface_from_arrays(Mesh::PRIMITIVE_TRIANGLE_STRIP, arrays);
+
+    if (distance_material->get_shader().is_null()) {
+      distance_material->set_shader(LineOfSightServer::get_singleton()->get_distance_shader_2d());
+      distance_material->set_shader_parameter("distances", distance_texture);
+    }
+    mesh->set_material(distance_material);
+  }
+
+  distance_material->set_shader_parameter("start_angle", distance_start_angle);
+  distance_material->set_shader_parameter("sweep_angle", Math::deg_to_rad(angle));
+  distance_material->set_shader_parameter("min_distance", distance_from_origin);
+}
+
+/// @brief Whether the rendered frames draw the view between the last two physics ticks, which only
+/// applies to the views swept around the origin.
+bool LineOfSight2D::uses_interpolation() const {
+  return update_mode == UPDATE_PHYSICS && group_id == 0 && render_enabled &&
+         mode != MODE_SHADOWCAST;
+}
+
+/// @brief Whether the view is drawn from a distance texture, which only applies to the views swept
+/// around the origin.
+bool LineOfSight2D::uses_distance_texture() const {
+  return render_mode == RENDER_DISTANCE_TEXTURE && mode != MODE_SHADOWCAST;
+}
+
+/// @brief Whether the sweep queries the physics server (as opposed to pure computations).
+bool LineOfSight2D::uses_physics_queries() const {
+  return mode == MODE_RAYCAST && !use_occluder_index && !use_tile_map;
+}
+
+/// @brief Gather the occluder segments of the analytic mode from the collision shapes of the scene.
+void LineOfSight2D::refresh_occluders() {
+  visibility_polygon.clear();
+  occluders_dirty = false;
+  parameters_dirty = true;
+
+  if (!is_inside_tree()) {
+    occluders_dirty = true;
+    return;
+  }
+
+  Node *root = nullptr;
+  if (occluder_root.is_empty()) {
+    root = get_tree()->get_current_scene();
+  } else {
+    root = get_node_or_null(occluder_root);
+  }
+  if (root == nullptr) {
+    root = get_tree()->get_root();
+  }
+
+  gather_occluders(root);
+}
+
+/// @brief Add the collision shapes found under the given node to the occluders.
+/// @param p_node The node to search recursively.
+void LineOfSight2D::gather_occluders(Node *p_node) {
+  // The shapes of the body carrying this node would hide everything from it.
+  CollisionObject2D *body = Object::cast_to<CollisionObject2D>(p_node->get_parent());
+  bool is_occluder = body != nullptr && !body->is_ancestor_of(this);
+
+  CollisionShape2D *collision_shape = Object::cast_to<CollisionShape2D>(p_node);
+  if (is_occluder && collision_shape != nullptr && !collision_shape->is_disabled()) {
+    visibility_polygon.add_shape(
+        collision_shape->get_shape(), collision_shape->get_global_transform()
+    );
+  }
+
+  CollisionPolygon2D *collision_polygon = Object::cast_to<CollisionPolygon2D>(p_node);
+  if (is_occluder && collision_polygon != nullptr && !collision_polygon->is_disabled()) {
+    bool closed = collision_polygon->get_build_mode() == CollisionPolygon2D::BUILD_SOLIDS;
+    visibility_polygon.add_polyline(
+        collision_polygon->get_polygon(), collision_polygon->get_global_transform(), closed
+    );
+  }
+
+  for (int i = 0; i < p_node->get_child_count(); i++) {
+    gather_occluders(p_node->get_child(i));
+  }
+}
+
+/// @brief Connect the tile map of the shadowcast mode and read its tiles if they changed.
+void LineOfSight2D::update_tile_map() {
+  TileMap *tile_map_node = Object::cast_to<TileMap>(get_node_or_null(tile_map));
+  uint64_t id = tile_map_node != nullptr ? tile_map_node->get_instance_id() : 0;
+  if (id != tile_map_id) {
+    Object *previous = ObjectDB::get_instance(tile_map_id);
+    if (previous != nullptr) {
+      previous->disconnect("changed", Callable(this, "refresh_tiles"));
+    }
+    if (tile_map_node != nullptr) {
+      tile_map_node->connect("changed", Callable(this, "refresh_tiles"));
+    }
+    tile_map_id = id;
+    tiles_dirty = true;
+  }
+
+  if (tile_map_node == nullptr) {
+    tile_occupancy.clear();
+    tile_occupancy.set_transform(Transform2D(), Vector2());
+    return;
+  }
+
+  if (tiles_dirty) {
+    tile_occupancy.build(tile_map_node, tile_map_layer);
+    tiles_dirty = false;
+    parameters_dirty = true;
+  }
+
+  Ref<TileSet> tile_set = tile_map_node->get_tileset();
+  Vector2 tile_size = tile_set.is_valid() ? Vector2(tile_set->get_tile_size()) : Vector2();
+  Transform2D cell_transform = tile_occupancy.get_cell_transform();
+  tile_occupancy.set_transform(tile_map_node->get_global_transform(), tile_size);
+  if (tile_occupancy.get_cell_transform() != cell_transform) {
+    parameters_dirty = true;
+  }
+}
+
+/// @brief Read all the tiles again before the next sweep. Tile set changes are noticed
+/// automatically, edited cells must be refreshed with this method or update_tiles().
+void LineOfSight2D::refresh_tiles() { tiles_dirty = true; }
+
+/// @brief Read some edited cells of the tile map again, instead of all of them.
+/// @param p_cells The cells which changed, in map coordinates.
+void LineOfSight2D::update_tiles(const TypedArray<Vector2i> &p_cells) {
+  TileMap *tile_map_node = Object::cast_to<TileMap>(ObjectDB::get_instance(tile_map_id));
+  // Without a connected tile map, all the tiles are read by the next sweep anyway.
+  if (tiles_dirty || tile_map_node == nullptr) {
+    return;
+  }
+  tile_occupancy.update_cells(tile_map_node, tile_map_layer, p_cells);
+  parameters_dirty = true;
+}
+
+void LineOfSight2D::set_resolution(double value) {
+  resolution = value;
+  parameters_dirty = true;
+}
 
 double LineOfSight2D::get_resolution() const { return resolution; }
 
 void LineOfSight2D::set_edge_resolve_iterations(const int p_edge_resolve_iterations) {
   edge_resolve_iterations = p_edge_resolve_iterations;
+  parameters_dirty = true;
 }
 
 int LineOfSight2D::get_edge_resolve_iterations() const { return edge_resolve_iterations; }
 
-void LineOfSight2D::set_edge_distance_threshold(double value) { edge_distance_threshold = value; }
+void LineOfSight2D::set_edge_distance_threshold(double value) {
+  edge_distance_threshold = value;
+  parameters_dirty = true;
+}
 
 double LineOfSight2D::get_edge_distance_threshold() const { return edge_distance_threshold; }
 
-void LineOfSight2D::set_distance_from_origin(double value) { distance_from_origin = value; }
+void LineOfSight2D::set_distance_from_origin(double value) {
+  distance_from_origin = value;
+  parameters_dirty = true;
+}
 
 double LineOfSight2D::get_distance_from_origin() const { return distance_from_origin; }
 
-void LineOfSight2D::set_angle(double value) { angle = value; }
+void LineOfSight2D::set_angle(double value) {
+  angle = value;
+  parameters_dirty = true;
+}
 
 double LineOfSight2D::get_angle() const { return angle; }
 
-void LineOfSight2D::set_radius(double value) { radius = value; }
+void LineOfSight2D::set_radius(double value) {
+  radius = value;
+  parameters_dirty = true;
+}
 
 double LineOfSight2D::get_radius() const { return radius; }
 
+void LineOfSight2D::set_update_mode(const UpdateMode p_update_mode) {
+  if (update_mode == p_update_mode) {
+    return;
+  }
+
+  LineOfSightServer *server = LineOfSightServer::get_singleton();
+  if (is_inside_tree() && is_server_updated()) {
+    server->unregister_agent_2d(this);
+  }
+  update_mode = p_update_mode;
+  if (is_inside_tree() && is_server_updated()) {
+    server->register_agent_2d(this);
+  }
+  reset_interpolation();
+}
+
+LineOfSight2D::UpdateMode LineOfSight2D::get_update_mode() const { return update_mode; }
+
+/// @brief Whether the view is used by a mesh or a grid, so the node must sweep.
+bool LineOfSight2D::is_sweep_needed() const { return render_enabled || grid.is_valid(); }
+
+/// @brief Whether the node is computed by the LineOfSightServer rather than in _process().
+bool LineOfSight2D::is_server_updated() const {
+  return group_id == 0 && (update_mode == UPDATE_SERVER || update_mode == UPDATE_SCHEDULED);
+}
+
+/// @brief Let a LineOfSightGroup compute the sweeps of the node instead of its update mode.
+/// @param p_group_id The instance id of the group, 0 to go back to the update mode.
+void LineOfSight2D::set_group_id(const uint64_t p_group_id) {
+  LineOfSightServer *server = LineOfSightServer::get_singleton();
+  if (is_inside_tree() && is_server_updated()) {
+    server->unregister_agent_2d(this);
+  }
+  group_id = p_group_id;
+  if (is_inside_tree() && is_server_updated()) {
+    server->register_agent_2d(this);
+  }
+  reset_interpolation();
+}
+
+uint64_t LineOfSight2D::get_group_id() const { return group_id; }
+
+void LineOfSight2D::set_update_priority(const double p_update_priority) {
+  update_priority = MAX(0.0, p_update_priority);
+}
+
+double LineOfSight2D::get_update_priority() const { return update_priority; }
+
+/// @brief Scale the resolution down, used by the scheduler for the far nodes. The scheduler sets it
+/// again every frame, so only the server can set it, and scripts can only read it.
+void LineOfSight2D::set_lod_scale(const double p_lod_scale) {
+  if (lod_scale != p_lod_scale) {
+    lod_scale = p_lod_scale;
+    parameters_dirty = true;
+  }
+}
+
+double LineOfSight2D::get_lod_scale() const { return lod_scale; }
+
+void LineOfSight2D::set_incremental(const bool p_incremental) {
+  incremental = p_incremental;
+  parameters_dirty = true;
+}
+
+bool LineOfSight2D::get_incremental() const { return incremental; }
+
+void LineOfSight2D::set_collision_mask(const uint32_t p_collision_mask) {
+  collision_mask = p_collision_mask;
+  update_query_filters();
+  parameters_dirty = true;
+}
+
+uint32_t LineOfSight2D::get_collision_mask() const { return collision_mask; }
+
+void LineOfSight2D::set_exclude(const TypedArray<RID> &p_exclude) {
+  exclude = p_exclude;
+  update_query_filters();
+  parameters_dirty = true;
+}
+
+TypedArray<RID> LineOfSight2D::get_exclude() const { return exclude; }
+
+void LineOfSight2D::set_use_occluder_index(const bool p_use_occluder_index) {
+  if (use_occluder_index == p_use_occluder_index) {
+    return;
+  }
+
+  use_occluder_index = p_use_occluder_index;
+  parameters_dirty = true;
+  if (!is_inside_tree()) {
+    return;
+  }
+  if (use_occluder_index) {
+    LineOfSightServer::get_singleton()->acquire_occluder_index_2d();
+  } else {
+    LineOfSightServer::get_singleton()->release_occluder_index_2d();
+  }
+}
+
+bool LineOfSight2D::get_use_occluder_index() const { return use_occluder_index; }
+
+void LineOfSight2D::set_use_tile_map(const bool p_use_tile_map) {
+  use_tile_map = p_use_tile_map;
+  parameters_dirty = true;
+}
+
+bool LineOfSight2D::get_use_tile_map() const { return use_tile_map; }
+
+/// @brief Apply the collision mask and the excluded bodies to the physics queries.
+void LineOfSight2D::update_query_filters() {
+  ray_query->set_collision_mask(collision_mask);
+  ray_query->set_exclude(exclude);
+  target_query->set_collision_mask(collision_mask);
+  target_query->set_exclude(exclude);
+  occluder_query->set_collision_mask(collision_mask);
+  occluder_query->set_exclude(exclude);
+}
+
+/// @brief List the bodies the occluder index must ignore: the excluded ones, and the bodies
+/// carrying this node, whose own shapes would block every ray.
+void LineOfSight2D::gather_index_exclude() {
+  index_exclude.clear();
+  PhysicsServer2D *physics_server = PhysicsServer2D::get_singleton();
+  for (int i = 0; i < exclude.size(); i++) {
+    index_exclude.push_back(physics_server->body_get_object_instance_id(exclude[i]));
+  }
+  for (Node *node = get_parent(); node != nullptr; node = node->get_parent()) {
+    if (Object::cast_to<CollisionObject2D>(node) != nullptr) {
+      index_exclude.push_back(node->get_instance_id());
+    }
+  }
+}
+
+int64_t LineOfSight2D::get_frames_recomputed() const { return frames_recomputed; }
+
+int64_t LineOfSight2D::get_frames_skipped() const { return frames_skipped; }
+
+void LineOfSight2D::set_adaptive_subdivisions(const int p_adaptive_subdivisions) {
+  adaptive_subdivisions = CLAMP(p_adaptive_subdivisions, 0, 8);
+  parameters_dirty = true;
+}
+
+int LineOfSight2D::get_adaptive_subdivisions() const { return adaptive_subdivisions; }
+
+void LineOfSight2D::set_use_ray_cache(const bool p_use_ray_cache) {
+  use_ray_cache = p_use_ray_cache;
+  parameters_dirty = true;
+}
+
+bool LineOfSight2D::get_use_ray_cache() const { return use_ray_cache; }
+
+void LineOfSight2D::set_ray_cache_tolerance(const double p_ray_cache_tolerance) {
+  ray_cache_tolerance = MAX(0.0, p_ray_cache_tolerance);
+  parameters_dirty = true;
+}
+
+double LineOfSight2D::get_ray_cache_tolerance() const { return ray_cache_tolerance; }
+
+/// @brief Set whether the sweeps take their sines and cosines from FixedTrig, so that they give the
+/// same view on every platform.
+void LineOfSight2D::set_deterministic(const bool p_deterministic) {
+  sweep.set_deterministic(p_deterministic);
+  parameters_dirty = true;
+}
+
+bool LineOfSight2D::get_deterministic() const { return sweep.is_deterministic(); }
+
+void LineOfSight2D::set_render_enabled(const bool p_render_enabled) {
+  render_enabled = p_render_enabled;
+  parameters_dirty = true;
+  if (!render_enabled) {
+    array_mesh->clear_surfaces();
+    quad_radius = -1;
+    sweep_pending = false;
+    reset_interpolation();
+  }
+  if (is_inside_tree()) {
+    mesh->set_visible(render_enabled);
+  }
+}
+
+bool LineOfSight2D::get_render_enabled() const { return render_enabled; }
+
+void LineOfSight2D::set_render_mode(const RenderMode p_render_mode) {
+  render_mode = p_render_mode;
+  parameters_dirty = true;
+}
+
+LineOfSight2D::RenderMode LineOfSight2D::get_render_mode() const { return render_mode; }
+
+/// @brief Get the texture holding the distance of the view along every step of the sweep, updated
+/// by every commit in the distance texture render mode.
+Ref<Texture2D> LineOfSight2D::get_distance_texture() const { return distance_texture; }
+
+void LineOfSight2D::set_indexed_mesh(const bool p_indexed_mesh) {
+  indexed_mesh = p_indexed_mesh;
+  parameters_dirty = true;
+}
+
+bool LineOfSight2D::get_indexed_mesh() const { return indexed_mesh; }
+
+void LineOfSight2D::set_simplify_tolerance(const double p_simplify_tolerance) {
+  simplify_tolerance = MAX(0.0, p_simplify_tolerance);
+  parameters_dirty = true;
+}
+
+double LineOfSight2D::get_simplify_tolerance() const { return simplify_tolerance; }
+
+void LineOfSight2D::set_grid(const Ref<LineOfSightGrid> &p_grid) {
+  if (grid.is_valid()) {
+    grid->remove_contribution(get_instance_id());
+  }
+  grid = p_grid;
+  grid_layout = 0;
+  parameters_dirty = true;
+}
+
+Ref<LineOfSightGrid> LineOfSight2D::get_grid() const { return grid; }
+
+void LineOfSight2D::set_grid_teams(const int p_grid_teams) {
+  grid_teams = p_grid_teams;
+  parameters_dirty = true;
+}
+
+int LineOfSight2D::get_grid_teams() const { return grid_teams; }
+
+void LineOfSight2D::set_mode(const Mode p_mode) {
+  mode = p_mode;
+  occluders_dirty = true;
+  parameters_dirty = true;
+  reset_interpolation();
+}
+
+LineOfSight2D::Mode LineOfSight2D::get_mode() const { return mode; }
+
+void LineOfSight2D::set_occluder_root(const NodePath &p_occluder_root) {
+  occluder_root = p_occluder_root;
+  occluders_dirty = true;
+}
+
+NodePath LineOfSight2D::get_occluder_root() const { return occluder_root; }
+
+void LineOfSight2D::set_tile_map(const NodePath &p_tile_map) {
+  tile_map = p_tile_map;
+  tiles_dirty = true;
+  parameters_dirty = true;
+}
+
+NodePath LineOfSight2D::get_tile_map() const { return tile_map; }
+
+void LineOfSight2D::set_tile_map_layer(const int p_tile_map_layer) {
+  tile_map_layer = p_tile_map_layer;
+  tiles_dirty = true;
+  parameters_dirty = true;
+}
+
+int LineOfSight2D::get_tile_map_layer() const { return tile_map_layer; }
+
 void LineOfSight2D::set_mesh_creation_time(double value) { mesh_creation_time = value; }
 
 double LineOfSight2D::get_mesh_creation_time() const { return mesh_creation_time; }
+
+int LineOfSight2D::get_rays_cast() const { return rays_cast; }
+
+int LineOfSight2D::get_edges_resolved() const { return edges_resolved; }
+
+int LineOfSight2D::get_vertices_emitted() const { return vertices_emitted; }
+
+int LineOfSight2D::get_vertices_unsimplified() const { return vertices_unsimplified; }
+
+int64_t LineOfSight2D::get_update_time_usec() const { return update_time_usec; }
+
+/// @brief Get the counters of the last sweep, and the number of sweeps computed and skipped.
+Dictionary LineOfSight2D::get_stats() const {
+  Dictionary stats;
+  stats["time_usec"] = update_time_usec;
+  stats["rays"] = rays_cast;
+  stats["edges"] = edges_resolved;
+  stats["bisection_rays"] = bisection_rays;
+  stats["ray_cache_hits"] = ray_cache_hits;
+  stats["ray_cache_misses"] = ray_cache_misses;
+  stats["vertices"] = vertices_emitted;
+  stats["vertices_unsimplified"] = vertices_unsimplified;
+  stats["frames_recomputed"] = frames_recomputed;
+  stats["frames_skipped"] = frames_skipped;
+  return stats;
+}
+
+/// @brief Get the ends of the rays of the last sweep relative to its origin, by increasing angles.
+PackedVector2Array LineOfSight2D::get_view_points() const {
+  PackedVector2Array points;
+  points.resize(view_points_to.size());
+  for (uint32_t i = 0; i < view_points_to.size(); i++) {
+    points[i] = view_points_to[i];
+  }
+  return points;
+}
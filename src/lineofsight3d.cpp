@@ -1,8 +1,16 @@
 #include "lineofsight3d.h"
 
+#include "lineofsightserver.h"
+
+#include <godot_cpp/classes/engine.hpp>
+#include <godot_cpp/classes/physics_server3d.hpp>
+#include <godot_cpp/classes/rendering_server.hpp>
 #include <godot_cpp/classes/time.hpp>
+#include <godot_cpp/classes/worker_thread_pool.hpp>
 #include <godot_cpp/core/class_db.hpp>
 
+#include <cstring>
+
 using namespace godot;
 
 void LineOfSight3D::_bind_methods() {
@@ -67,191 +75,1378 @@ void LineOfSight3D::_bind_methods() {
       "set_radius", "get_radius"
   );
 
+  ClassDB::bind_method(D_METHOD("get_mode"), &LineOfSight3D::get_mode);
+  ClassDB::bind_method(D_METHOD("set_mode", "p_mode"), &LineOfSight3D::set_mode);
+  ClassDB::add_property(
+      "LineOfSight3D", PropertyInfo(Variant::INT, "mode", PROPERTY_HINT_ENUM, "Planar,Volumetric"),
+      "set_mode", "get_mode"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_vertical_angle"), &LineOfSight3D::get_vertical_angle);
+  ClassDB::bind_method(
+      D_METHOD("set_vertical_angle", "p_vertical_angle"), &LineOfSight3D::set_vertical_angle
+  );
+  ClassDB::add_property(
+      "LineOfSight3D",
+      PropertyInfo(Variant::FLOAT, "vertical_angle", PROPERTY_HINT_RANGE, "0,180,0.1"),
+      "set_vertical_angle", "get_vertical_angle"
+  );
+
+  ClassDB::bind_method(
+      D_METHOD("get_vertical_resolution"), &LineOfSight3D::get_vertical_resolution
+  );
+  ClassDB::bind_method(
+      D_METHOD("set_vertical_resolution", "p_vertical_resolution"),
+      &LineOfSight3D::set_vertical_resolution
+  );
+  ClassDB::add_property(
+      "LineOfSight3D",
+      PropertyInfo(Variant::FLOAT, "vertical_resolution", PROPERTY_HINT_RANGE, "0,100,0.01"),
+      "set_vertical_resolution", "get_vertical_resolution"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_max_rays_per_frame"), &LineOfSight3D::get_max_rays_per_frame);
+  ClassDB::bind_method(
+      D_METHOD("set_max_rays_per_frame", "p_max_rays_per_frame"),
+      &LineOfSight3D::set_max_rays_per_frame
+  );
+  ClassDB::add_property(
+      "LineOfSight3D",
+      PropertyInfo(Variant::INT, "max_rays_per_frame", PROPERTY_HINT_RANGE, "0,100000,1"),
+      "set_max_rays_per_frame", "get_max_rays_per_frame"
+  );
+
+  BIND_ENUM_CONSTANT(MODE_PLANAR);
+  BIND_ENUM_CONSTANT(MODE_VOLUMETRIC);
+
+  ClassDB::bind_method(D_METHOD("_cast_row", "p_index"), &LineOfSight3D::_cast_row);
+
+  ClassDB::bind_method(D_METHOD("get_update_mode"), &LineOfSight3D::get_update_mode);
+  ClassDB::bind_method(
+      D_METHOD("set_update_mode", "p_update_mode"), &LineOfSight3D::set_update_mode
+  );
+  ClassDB::add_property(
+      "LineOfSight3D",
+      PropertyInfo(
+          Variant::INT, "update_mode", PROPERTY_HINT_ENUM, "Process,Server,Scheduled,Physics"
+      ),
+      "set_update_mode", "get_update_mode"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_update_priority"), &LineOfSight3D::get_update_priority);
+  ClassDB::bind_method(
+      D_METHOD("set_update_priority", "p_update_priority"), &LineOfSight3D::set_update_priority
+  );
+  ClassDB::add_property(
+      "LineOfSight3D",
+      PropertyInfo(Variant::FLOAT, "update_priority", PROPERTY_HINT_RANGE, "0,100,0.01"),
+      "set_update_priority", "get_update_priority"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_lod_scale"), &LineOfSight3D::get_lod_scale);
+
+  ClassDB::bind_method(D_METHOD("get_incremental"), &LineOfSight3D::get_incremental);
+  ClassDB::bind_method(
+      D_METHOD("set_incremental", "p_incremental"), &LineOfSight3D::set_incremental
+  );
+  ClassDB::add_property(
+      "LineOfSight3D", PropertyInfo(Variant::BOOL, "incremental"), "set_incremental",
+      "get_incremental"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_collision_mask"), &LineOfSight3D::get_collision_mask);
+  ClassDB::bind_method(
+      D_METHOD("set_collision_mask", "p_collision_mask"), &LineOfSight3D::set_collision_mask
+  );
+  ClassDB::add_property(
+      "LineOfSight3D",
+      PropertyInfo(Variant::INT, "collision_mask", PROPERTY_HINT_LAYERS_3D_PHYSICS),
+      "set_collision_mask", "get_collision_mask"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_exclude"), &LineOfSight3D::get_exclude);
+  ClassDB::bind_method(D_METHOD("set_exclude", "p_exclude"), &LineOfSight3D::set_exclude);
+  ClassDB::add_property(
+      "LineOfSight3D", PropertyInfo(Variant::ARRAY, "exclude", PROPERTY_HINT_ARRAY_TYPE, "RID"),
+      "set_exclude", "get_exclude"
+  );
+
+  ClassDB::bind_method(
+      D_METHOD("get_use_occluder_index"), &LineOfSight3D::get_use_occluder_index
+  );
+  ClassDB::bind_method(
+      D_METHOD("set_use_occluder_index", "p_use_occluder_index"),
+      &LineOfSight3D::set_use_occluder_index
+  );
+  ClassDB::add_property(
+      "LineOfSight3D", PropertyInfo(Variant::BOOL, "use_occluder_index"),
+      "set_use_occluder_index", "get_use_occluder_index"
+  );
+
+  ClassDB::bind_method(
+      D_METHOD("get_adaptive_subdivisions"), &LineOfSight3D::get_adaptive_subdivisions
+  );
+  ClassDB::bind_method(
+      D_METHOD("set_adaptive_subdivisions", "p_adaptive_subdivisions"),
+      &LineOfSight3D::set_adaptive_subdivisions
+  );
+  ClassDB::add_property(
+      "LineOfSight3D",
+      PropertyInfo(Variant::INT, "adaptive_subdivisions", PROPERTY_HINT_RANGE, "0,8,1"),
+      "set_adaptive_subdivisions", "get_adaptive_subdivisions"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_use_ray_cache"), &LineOfSight3D::get_use_ray_cache);
+  ClassDB::bind_method(
+      D_METHOD("set_use_ray_cache", "p_use_ray_cache"), &LineOfSight3D::set_use_ray_cache
+  );
+  ClassDB::add_property(
+      "LineOfSight3D", PropertyInfo(Variant::BOOL, "use_ray_cache"), "set_use_ray_cache",
+      "get_use_ray_cache"
+  );
+
+  ClassDB::bind_method(
+      D_METHOD("get_ray_cache_tolerance"), &LineOfSight3D::get_ray_cache_tolerance
+  );
+  ClassDB::bind_method(
+      D_METHOD("set_ray_cache_tolerance", "p_ray_cache_tolerance"),
+      &LineOfSight3D::set_ray_cache_tolerance
+  );
+  ClassDB::add_property(
+      "LineOfSight3D",
+      PropertyInfo(Variant::FLOAT, "ray_cache_tolerance", PROPERTY_HINT_RANGE, "0,10,0.001"),
+      "set_ray_cache_tolerance", "get_ray_cache_tolerance"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_deterministic"), &LineOfSight3D::get_deterministic);
+  ClassDB::bind_method(
+      D_METHOD("set_deterministic", "p_deterministic"), &LineOfSight3D::set_deterministic
+  );
+  ClassDB::add_property(
+      "LineOfSight3D", PropertyInfo(Variant::BOOL, "deterministic"), "set_deterministic",
+      "get_deterministic"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_render_enabled"), &LineOfSight3D::get_render_enabled);
+  ClassDB::bind_method(
+      D_METHOD("set_render_enabled", "p_render_enabled"), &LineOfSight3D::set_render_enabled
+  );
+  ClassDB::add_property(
+      "LineOfSight3D", PropertyInfo(Variant::BOOL, "render_enabled"), "set_render_enabled",
+      "get_render_enabled"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_render_mode"), &LineOfSight3D::get_render_mode);
+  ClassDB::bind_method(
+      D_METHOD("set_render_mode", "p_render_mode"), &LineOfSight3D::set_render_mode
+  );
+  ClassDB::add_property(
+      "LineOfSight3D",
+      PropertyInfo(Variant::INT, "render_mode", PROPERTY_HINT_ENUM, "Mesh,Distance Texture"),
+      "set_render_mode", "get_render_mode"
+  );
+
+  BIND_ENUM_CONSTANT(RENDER_MESH);
+  BIND_ENUM_CONSTANT(RENDER_DISTANCE_TEXTURE);
+
+  ClassDB::bind_method(D_METHOD("get_distance_texture"), &LineOfSight3D::get_distance_texture);
+
+  ClassDB::bind_method(D_METHOD("get_indexed_mesh"), &LineOfSight3D::get_indexed_mesh);
+  ClassDB::bind_method(
+      D_METHOD("set_indexed_mesh", "p_indexed_mesh"), &LineOfSight3D::set_indexed_mesh
+  );
+  ClassDB::add_property(
+      "LineOfSight3D", PropertyInfo(Variant::BOOL, "indexed_mesh"), "set_indexed_mesh",
+      "get_indexed_mesh"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_simplify_tolerance"), &LineOfSight3D::get_simplify_tolerance);
+  ClassDB::bind_method(
+      D_METHOD("set_simplify_tolerance", "p_simplify_tolerance"),
+      &LineOfSight3D::set_simplify_tolerance
+  );
+  ClassDB::add_property(
+      "LineOfSight3D",
+      PropertyInfo(Variant::FLOAT, "simplify_tolerance", PROPERTY_HINT_RANGE, "0,10,0.001"),
+      "set_simplify_tolerance", "get_simplify_tolerance"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_grid"), &LineOfSight3D::get_grid);
+  ClassDB::bind_method(D_METHOD("set_grid", "p_grid"), &LineOfSight3D::set_grid);
+  ClassDB::add_property(
+      "LineOfSight3D",
+      PropertyInfo(Variant::OBJECT, "grid", PROPERTY_HINT_RESOURCE_TYPE, "LineOfSightGrid"),
+      "set_grid", "get_grid"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_grid_teams"), &LineOfSight3D::get_grid_teams);
+  ClassDB::bind_method(D_METHOD("set_grid_teams", "p_grid_teams"), &LineOfSight3D::set_grid_teams);
+  ClassDB::add_property(
+      "LineOfSight3D",
+      PropertyInfo(
+          Variant::INT, "grid_teams", PROPERTY_HINT_FLAGS,
+          "Team 1,Team 2,Team 3,Team 4,Team 5,Team 6,Team 7,Team 8"
+      ),
+      "set_grid_teams", "get_grid_teams"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_frames_recomputed"), &LineOfSight3D::get_frames_recomputed);
+  ClassDB::bind_method(D_METHOD("get_frames_skipped"), &LineOfSight3D::get_frames_skipped);
+
+  BIND_ENUM_CONSTANT(UPDATE_PROCESS);
+  BIND_ENUM_CONSTANT(UPDATE_SERVER);
+  BIND_ENUM_CONSTANT(UPDATE_SCHEDULED);
+  BIND_ENUM_CONSTANT(UPDATE_PHYSICS);
+
   ClassDB::bind_method(D_METHOD("get_mesh_creation_time"), &LineOfSight3D::get_mesh_creation_time);
+  ClassDB::bind_method(D_METHOD("get_rays_cast"), &LineOfSight3D::get_rays_cast);
+  ClassDB::bind_method(D_METHOD("get_edges_resolved"), &LineOfSight3D::get_edges_resolved);
+  ClassDB::bind_method(D_METHOD("get_vertices_emitted"), &LineOfSight3D::get_vertices_emitted);
+  ClassDB::bind_method(
+      D_METHOD("get_vertices_unsimplified"), &LineOfSight3D::get_vertices_unsimplified
+  );
+  ClassDB::bind_method(D_METHOD("get_update_time_usec"), &LineOfSight3D::get_update_time_usec);
+  ClassDB::bind_method(D_METHOD("get_stats"), &LineOfSight3D::get_stats);
+
+  ClassDB::bind_method(D_METHOD("is_point_visible", "p_point"), &LineOfSight3D::is_point_visible);
+  ClassDB::bind_method(D_METHOD("get_visible_bodies"), &LineOfSight3D::get_visible_bodies);
+  ClassDB::bind_method(D_METHOD("add_target", "p_target"), &LineOfSight3D::add_target);
+  ClassDB::bind_method(D_METHOD("remove_target", "p_target"), &LineOfSight3D::remove_target);
+  ClassDB::bind_method(D_METHOD("get_targets"), &LineOfSight3D::get_targets);
+  ClassDB::bind_method(D_METHOD("get_visibility_mask"), &LineOfSight3D::get_visibility_mask);
 }
 
 LineOfSight3D::LineOfSight3D() {
   resolution = 1;
-  edge_resolve_iterations = 0.5;
   edge_distance_threshold = 0.1;
   distance_from_origin = 1;
   angle = 90;
   radius = 10;
+  update_mode = UPDATE_PROCESS;
+  incremental = false;
+  use_occluder_index = false;
+  ray_cache_tolerance = 0.1;
+  grid_teams = 1;
+  grid_layout = 0;
+  render_enabled = true;
+  render_mode = RENDER_MESH;
+  mode = MODE_PLANAR;
+  vertical_angle = 60;
+  vertical_resolution = 0.2;
+  max_rays_per_frame = 0;
 
   mesh_creation_time = 0;
-  Callable mesh_creation_callable = Callable(this, StringName("get_mesh_creation_time"));
-  performance = Performance::get_singleton();
-  if (!performance->has_custom_monitor(StringName("draw_time"))) {
-    performance->add_custom_monitor(StringName("draw_time"), mesh_creation_callable);
-  }
+  update_time_usec = 0;
+  vertices_emitted = 0;
+  vertices_unsimplified = 0;
+  update_priority = 1;
+  lod_scale = 1;
+
+  sweep_pending = false;
+
+  occluder_shape.instantiate();
+  occluder_query.instantiate();
+  occluder_query->set_shape(occluder_shape);
+  last_occluders_hash = 0;
+  parameters_dirty = true;
+  frames_recomputed = 0;
+  frames_skipped = 0;
+
+  target_query.instantiate();
+  update_query_filters();
+
+  grid_columns = 0;
+  grid_rows = 0;
+  first_row = 0;
+  next_row = 0;
+  stale_rows = 0;
+  grid_dirty = true;
+  mesh_primitive = Mesh::PRIMITIVE_TRIANGLE_STRIP;
+
+  array_mesh.instantiate();
+  mesh_radius = -1;
+
+  distance_image.instantiate();
+  distance_texture.instantiate();
+  distance_material.instantiate();
+  quad_radius = -1;
 }
 
 LineOfSight3D::~LineOfSight3D() {
   // mesh->queue_free();
   // mesh = nullptr;
-  performance = nullptr;
 }
 
 void LineOfSight3D::_enter_tree() {
-  mesh = new MeshInstance3D();
+  mesh = memnew(MeshInstance3D);
+  mesh->set_mesh(array_mesh);
+  mesh->set_visible(render_enabled);
   draw_line_of_sight();
   add_child(mesh);
 
+  // The server also keeps the aggregate monitors, which every node reports to.
+  LineOfSightServer::get_singleton()->connect_tree(get_tree());
+  if (use_occluder_index) {
+    LineOfSightServer::get_singleton()->acquire_occluder_index_3d();
+  }
+  if (is_server_updated()) {
+    LineOfSightServer::get_singleton()->register_agent_3d(this);
+  }
+
   // Required to make the mesh render correctly (don't overturn the mesh when the parent rotates)
   // mesh->set_as_top_level(true);
 }
 
 void LineOfSight3D::_exit_tree() {
+  if (use_occluder_index) {
+    LineOfSightServer::get_singleton()->release_occluder_index_3d();
+  }
+  if (is_server_updated()) {
+    LineOfSightServer::get_singleton()->unregister_agent_3d(this);
+  }
+  if (grid.is_valid()) {
+    grid->remove_contribution(get_instance_id());
+  }
+
+  // The material goes with the mesh instance, so the quad is set up again on the next commit.
+  quad_radius = -1;
+  reset_interpolation();
   remove_child(mesh);
   mesh->queue_free();
 }
 
 void LineOfSight3D::_process(double delta) {
-  Time *time = Time::get_singleton();
-  double start_time = time->get_unix_time_from_system();
+  if (!is_sweep_needed()) {
+    return;
+  }
+
+  if (is_server_updated()) {
+    // The sweep has already been computed by the server during the physics frame.
+    if (sweep_pending) {
+      commit_line_of_sight();
+    }
+    mesh->set_global_position(sweep_origin);
+    return;
+  }
+
+  if (uses_interpolation()) {
+    update_interpolated_mesh();
+    return;
+  }
+  if (update_mode == UPDATE_PHYSICS) {
+    // Without steps to blend, the vertices are relative to the origin of the last tick.
+    mesh->set_global_position(sweep_origin);
+    return;
+  }
+
   draw_line_of_sight();
-  double end_time = time->get_unix_time_from_system();
-  set_mesh_creation_time(end_time - start_time);
 
   // Because the mesh is detached from the parent, we need to update its position manually.
   mesh->set_global_position(get_global_position());
 }
 
-/// @brief Create a raycast from the center of the circle to the point at the given angle.
-/// @param p_angle The angle at which to cast the ray in degrees.
-/// @return A ViewCastInfo object containing the information about the raycast.
-LineOfSight3D::ViewCastInfo LineOfSight3D::view_cast(const double p_angle) {
-  double cos_angle = Math::cos(Math::deg_to_rad(p_angle));
-  double sin_angle = Math::sin(Math::deg_to_rad(p_angle));
-  Vector3 local_from =
-      Vector3(get_distance_from_origin() * cos_angle, 0, get_distance_from_origin() * sin_angle);
-  Vector3 local_to = Vector3(get_radius() * cos_angle, 0, get_radius() * sin_angle);
-  Vector3 from = local_from + get_global_position();
-  Vector3 to = local_to + get_global_position();
-  Ref<PhysicsRayQueryParameters3D> parameters = PhysicsRayQueryParameters3D::create(from, to);
-
-  Dictionary dict = get_world_3d()->get_direct_space_state()->intersect_ray(parameters);
-
-  // If the raycast hit something, draw a line from the center of the circle to the point.
-  if (dict.has("position")) {
-    Vector3 position = dict["position"];
-    return ViewCastInfo(true, from, position, position.distance_to(from), p_angle);
+void LineOfSight3D::_physics_process(double delta) {
+  if (!is_sweep_needed() || update_mode != UPDATE_PHYSICS) {
+    return;
+  }
+
+  // Query the space state at the physics rate, when it matches the last simulated step.
+  if (prepare_line_of_sight()) {
+    compute_line_of_sight();
+    commit_line_of_sight();
+  } else if (uses_interpolation()) {
+    // The view didn't change, so the rendered frames stop moving it.
+    repeat_interpolation_tick();
+  }
+}
+
+/// @brief Sweep a grid of rays covering both the horizontal and the vertical angles.
+///
+/// Each ray is cast once and shared by the quads of the two rows around it. When the grid holds
+/// more rays than max_rays_per_frame, whole rows are cast in turn over the next sweeps and the
+/// other rows keep their last distances.
+void LineOfSight3D::sweep_volume() {
+  int columns = MAX(2, (int)(angle * resolution * lod_scale) + 1);
+  int rows = MAX(2, (int)(vertical_angle * vertical_resolution * lod_scale) + 1);
+  if (grid_dirty || columns != grid_columns || rows != grid_rows) {
+    resize_grid(columns, rows);
+  }
+
+  int row_count = rows;
+  if (max_rays_per_frame > 0) {
+    row_count = CLAMP(max_rays_per_frame / columns, 1, rows);
+  }
+  first_row = next_row;
+
+  // Nodes updated by the server are already spread over the worker threads.
+  bool parallel = !is_server_updated() &&
+                  (!uses_physics_queries() ||
+                   LineOfSightServer::get_singleton()->get_parallel_physics_queries());
+  if (parallel) {
+    WorkerThreadPool *pool = WorkerThreadPool::get_singleton();
+    int64_t group_id = pool->add_group_task(
+        Callable(this, StringName("_cast_row")), row_count, -1, true, String("LineOfSight3D")
+    );
+    pool->wait_for_group_task_completion(group_id);
   } else {
-    return ViewCastInfo(false, from, to, radius, p_angle);
+    for (int i = 0; i < row_count; i++) {
+      _cast_row(i);
+    }
   }
+
+  next_row = (first_row + row_count) % rows;
+  stale_rows = MAX(0, stale_rows - row_count);
+  rays_cast += row_count * columns;
+
+  build_volume();
 }
 
-/// @brief Find the edge of the object that is between the two given view cast points.
-/// @param p_min_view_cast The first view cast point.
-/// @param p_max_view_cast The second view cast point.
-/// @return An EdgeInfo object containing the information about the edge of the object.
-LineOfSight3D::EdgeInfo
-LineOfSight3D::find_edge(ViewCastInfo p_min_view_cast, ViewCastInfo p_max_view_cast) {
-  double min_angle = p_min_view_cast.angle;
-  double max_angle = p_max_view_cast.angle;
-  Vector3 min_point = Vector3(0, 0, 0);
-  Vector3 max_point = Vector3(0, 0, 0);
+/// @brief Compute the directions of a new grid of rays, which starts as if nothing was hit.
+/// @param p_columns The number of rays in a row.
+/// @param p_rows The number of rows.
+void LineOfSight3D::resize_grid(const int p_columns, const int p_rows) {
+  grid_columns = p_columns;
+  grid_rows = p_rows;
+  first_row = 0;
+  next_row = 0;
+  stale_rows = p_rows;
+  grid_dirty = false;
+
+  grid_directions.resize(p_columns * p_rows);
+  grid_distances.resize(p_columns * p_rows);
+  int query_count = row_queries.size();
+  row_queries.resize(p_rows);
+  for (int i = query_count; i < p_rows; i++) {
+    row_queries[i].instantiate();
+  }
+  update_query_filters();
 
-  for (int i = 0; i < edge_resolve_iterations; i++) {
-    double angle = (min_angle + max_angle) / 2.0;
-    ViewCastInfo new_view_cast = view_cast(angle);
+  for (int row = 0; row < p_rows; row++) {
+    // The cosine and the sine of the pitch, then of the yaw.
+    Vector2 pitch = sweep.get_unit_vector(vertical_angle * ((double)row / (p_rows - 1) - 0.5));
+    for (int column = 0; column < p_columns; column++) {
+      Vector2 yaw = sweep.get_unit_vector(angle * ((double)column / (p_columns - 1) - 0.5));
+      // Rotate the forward axis (-Z) of the node by the yaw, then by the pitch.
+      int index = row * p_columns + column;
+      grid_directions[index] = Vector3(-yaw.y * pitch.x, pitch.y, -yaw.x * pitch.x);
+      grid_distances[index] = radius;
+    }
+  }
+}
 
-    bool edge_distance_threshold_exceeded =
-        Math::abs(p_min_view_cast.distance - new_view_cast.distance) > edge_distance_threshold;
+/// @brief Cast the rays of one row of the volume. Called from the worker threads.
+/// @param p_index The index of the row among the rows cast by this sweep.
+void LineOfSight3D::_cast_row(const int p_index) {
+  int row = (first_row + p_index) % grid_rows;
+  // Every row has its own query so the rows can be cast concurrently.
+  const Ref<PhysicsRayQueryParameters3D> &query = row_queries[row];
 
-    if (new_view_cast.hit == p_min_view_cast.hit && !edge_distance_threshold_exceeded) {
-      min_angle = angle;
-      min_point = new_view_cast.point;
+  for (int column = 0; column < grid_columns; column++) {
+    int index = row * grid_columns + column;
+    Vector3 direction = sweep_basis.xform(grid_directions[index]);
+    Vector3 from = sweep_origin + direction * distance_from_origin;
+    Vector3 to = sweep_origin + direction * radius;
+
+    Vector3 position;
+    bool hit;
+    if (occluder_index != nullptr) {
+      hit = occluder_index->intersect_ray(from, to, collision_mask, index_exclude, position);
     } else {
-      max_angle = angle;
-      max_point = new_view_cast.point;
+      query->set_from(from);
+      query->set_to(to);
+      Dictionary dict = space_state->intersect_ray(query);
+      hit = !dict.is_empty();
+      if (hit) {
+        position = dict[position_key];
+      }
+    }
+    grid_distances[index] = hit ? position.distance_to(sweep_origin) : radius;
+  }
+}
+
+/// @brief Build the triangles of the volume from the distances of the grid.
+///
+/// The far surface is made of the points reached by the rays, and the four sides join it to the
+/// points at distance_from_origin. The points are in the local frame of the node.
+void LineOfSight3D::build_volume() {
+  volume_vertices.clear();
+  volume_vertices.reserve(6 * ((grid_columns + 1) * (grid_rows + 1) - 1));
+
+  for (int row = 0; row + 1 < grid_rows; row++) {
+    for (int column = 0; column + 1 < grid_columns; column++) {
+      int index = row * grid_columns + column;
+      int above = index + grid_columns;
+      add_volume_quad(
+          grid_directions[index] * grid_distances[index],
+          grid_directions[index + 1] * grid_distances[index + 1],
+          grid_directions[above + 1] * grid_distances[above + 1],
+          grid_directions[above] * grid_distances[above]
+      );
+    }
+  }
+
+  int top = (grid_rows - 1) * grid_columns;
+  for (int column = 0; column + 1 < grid_columns; column++) {
+    int bottom_index = column;
+    int top_index = top + column;
+    add_volume_quad(
+        grid_directions[bottom_index] * distance_from_origin,
+        grid_directions[bottom_index + 1] * distance_from_origin,
+        grid_directions[bottom_index + 1] * grid_distances[bottom_index + 1],
+        grid_directions[bottom_index] * grid_distances[bottom_index]
+    );
+    add_volume_quad(
+        grid_directions[top_index + 1] * distance_from_origin,
+        grid_directions[top_index] * distance_from_origin,
+        grid_directions[top_index] * grid_distances[top_index],
+        grid_directions[top_index + 1] * grid_distances[top_index + 1]
+    );
+  }
+
+  int right = grid_columns - 1;
+  for (int row = 0; row + 1 < grid_rows; row++) {
+    int left_index = row * grid_columns;
+    int right_index = left_index + right;
+    add_volume_quad(
+        grid_directions[left_index + grid_columns] * distance_from_origin,
+        grid_directions[left_index] * distance_from_origin,
+        grid_directions[left_index] * grid_distances[left_index],
+        grid_directions[left_index + grid_columns] * grid_distances[left_index + grid_columns]
+    );
+    add_volume_quad(
+        grid_directions[right_index] * distance_from_origin,
+        grid_directions[right_index + grid_columns] * distance_from_origin,
+        grid_directions[right_index + grid_columns] * grid_distances[right_index + grid_columns],
+        grid_directions[right_index] * grid_distances[right_index]
+    );
+  }
+}
+
+/// @brief Add the two triangles of a quad given in order around its edges.
+void LineOfSight3D::add_volume_quad(
+    const Vector3 &p_a, const Vector3 &p_b, const Vector3 &p_c, const Vector3 &p_d
+) {
+  volume_vertices.push_back(p_a);
+  volume_vertices.push_back(p_b);
+  volume_vertices.push_back(p_c);
+  volume_vertices.push_back(p_a);
+  volume_vertices.push_back(p_c);
+  volume_vertices.push_back(p_d);
+}
+
+/// @brief Hash the bodies within the radius of the LOS and their transforms.
+/// @param r_complete Whether every occluder was hashed, false past MAX_OCCLUDER_RESULTS bodies.
+/// @return A hash which changes when an occluder appears, disappears or moves.
+uint32_t LineOfSight3D::hash_occluders(bool &r_complete) {
+  occluder_shape->set_radius(radius);
+  occluder_query->set_transform(Transform3D(Basis(), sweep_origin));
+
+  TypedArray<Dictionary> results =
+      space_state->intersect_shape(occluder_query, MAX_OCCLUDER_RESULTS);
+  r_complete = results.size() < MAX_OCCLUDER_RESULTS;
+  PhysicsServer3D *physics_server = PhysicsServer3D::get_singleton();
+
+  // Combine the bodies with a sum so the order of the results doesn't matter.
+  uint32_t hash = results.size();
+  for (int i = 0; i < results.size(); i++) {
+    Dictionary result = results[i];
+    RID rid = result["rid"];
+    int shape = result["shape"];
+    Transform3D transform =
+        physics_server->body_get_state(rid, PhysicsServer3D::BODY_STATE_TRANSFORM);
+
+    uint32_t body_hash = hash_murmur3_one_64(rid.get_id());
+    body_hash = hash_murmur3_one_32(shape, body_hash);
+    for (int j = 0; j < 3; j++) {
+      body_hash = hash_murmur3_one_real(transform.basis.rows[j].x, body_hash);
+      body_hash = hash_murmur3_one_real(transform.basis.rows[j].y, body_hash);
+      body_hash = hash_murmur3_one_real(transform.basis.rows[j].z, body_hash);
+      body_hash = hash_murmur3_one_real(transform.origin[j], body_hash);
+    }
+    hash += hash_fmix32(body_hash);
+  }
+
+  return hash;
+}
+
+/// @brief Whether a point is within the radius and the angle of the LOS, ignoring the occluders.
+bool LineOfSight3D::is_in_cone(const Vector3 &p_point) const {
+  Vector3 offset = p_point - get_global_position();
+  double distance = offset.length();
+  if (distance < distance_from_origin || distance > radius) {
+    return false;
+  }
+
+  if (mode == MODE_VOLUMETRIC) {
+    // Measure the yaw and the pitch around the forward axis (-Z) of the node, like the grid.
+    Vector3 local = get_global_transform().basis.orthonormalized().xform_inv(offset);
+    double yaw = sweep.get_angle(Vector2(-local.z, -local.x));
+    double pitch = sweep.get_angle(Vector2(Vector2(local.x, local.z).length(), local.y));
+    return Math::abs(yaw) <= angle / 2.0 && Math::abs(pitch) <= vertical_angle / 2.0;
+  }
+
+  double offset_angle = sweep.get_angle(Vector2(offset.x, offset.z));
+  double delta = Math::wrapf(offset_angle - get_global_rotation_degrees().z, -180.0, 180.0);
+  return Math::abs(delta) <= angle / 2.0;
+}
+
+/// @brief Cast a single ray from the start of the LOS to a point.
+/// @param p_point The global position of the point.
+/// @param p_body The body expected at the point, or an empty RID for a point in empty space.
+/// @return Whether nothing but the expected body stands between the LOS and the point.
+bool LineOfSight3D::cast_target_ray(const Vector3 &p_point, const RID &p_body) {
+  Vector3 origin = get_global_position();
+  Vector3 direction = (p_point - origin).normalized();
+  target_query->set_from(origin + direction * distance_from_origin);
+  target_query->set_to(p_point);
+
+  // Queries may run before the first sweep, so don't rely on the cached space state.
+  Dictionary dict = get_world_3d()->get_direct_space_state()->intersect_ray(target_query);
+  if (dict.is_empty()) {
+    return true;
+  }
+  return p_body.is_valid() && RID(dict["rid"]) == p_body;
+}
+
+/// @brief Whether a node is visible. Collision objects may be hit by the ray, other nodes not.
+bool LineOfSight3D::is_target_visible(Node3D *p_target) {
+  Vector3 position = p_target->get_global_position();
+  if (!is_in_cone(position)) {
+    return false;
+  }
+
+  CollisionObject3D *body = Object::cast_to<CollisionObject3D>(p_target);
+  return cast_target_ray(position, body != nullptr ? body->get_rid() : RID());
+}
+
+/// @brief Check whether a point can be seen, without building the mesh.
+/// @param p_point The global position of the point.
+/// @return Whether the point is in the LOS and no obstacle hides it.
+bool LineOfSight3D::is_point_visible(const Vector3 &p_point) {
+  ERR_FAIL_COND_V(!is_inside_tree(), false);
+  return is_in_cone(p_point) && cast_target_ray(p_point, RID());
+}
+
+/// @brief Find the bodies whose origin can be seen, without building the mesh.
+/// @return The bodies within the radius, in the LOS and not hidden by another obstacle.
+TypedArray<Node3D> LineOfSight3D::get_visible_bodies() {
+  TypedArray<Node3D> bodies;
+  ERR_FAIL_COND_V(!is_inside_tree(), bodies);
+
+  Vector3 origin = get_global_position();
+  occluder_shape->set_radius(radius);
+  occluder_query->set_transform(Transform3D(Basis(), origin));
+  TypedArray<Dictionary> results = get_world_3d()->get_direct_space_state()->intersect_shape(
+      occluder_query, MAX_OCCLUDER_RESULTS
+  );
+
+  for (int i = 0; i < results.size(); i++) {
+    Dictionary result = results[i];
+    Object *collider = result["collider"];
+    CollisionObject3D *body = Object::cast_to<CollisionObject3D>(collider);
+    // Bodies with several shapes are reported once per shape.
+    if (body == nullptr || body->is_ancestor_of(this) || bodies.has(body)) {
+      continue;
+    }
+    if (is_target_visible(body)) {
+      bodies.push_back(body);
     }
   }
 
-  return EdgeInfo(min_point, max_point);
+  return bodies;
+}
+
+/// @brief Register a node whose visibility is reported by get_visibility_mask().
+/// @param p_target The node, which gets the next bit of the mask.
+void LineOfSight3D::add_target(Node3D *p_target) {
+  ERR_FAIL_NULL(p_target);
+  ERR_FAIL_COND_MSG(targets.size() >= 64, "The visibility mask can't hold more than 64 targets.");
+
+  uint64_t id = p_target->get_instance_id();
+  if (targets.find(id) == -1) {
+    targets.push_back(id);
+  }
+}
+
+/// @brief Unregister a node. The bits of the targets registered after it are shifted down.
+void LineOfSight3D::remove_target(Node3D *p_target) {
+  ERR_FAIL_NULL(p_target);
+  targets.erase(p_target->get_instance_id());
+}
+
+TypedArray<Node3D> LineOfSight3D::get_targets() const {
+  TypedArray<Node3D> nodes;
+  for (uint32_t i = 0; i < targets.size(); i++) {
+    nodes.push_back(Object::cast_to<Node3D>(ObjectDB::get_instance(targets[i])));
+  }
+  return nodes;
+}
+
+/// @brief Check the visibility of every registered target with one ray each.
+/// @return A mask whose bit i is set when the target i is visible. Freed targets are never visible.
+int64_t LineOfSight3D::get_visibility_mask() {
+  ERR_FAIL_COND_V(!is_inside_tree(), 0);
+
+  int64_t mask = 0;
+  for (uint32_t i = 0; i < targets.size(); i++) {
+    Node3D *target = Object::cast_to<Node3D>(ObjectDB::get_instance(targets[i]));
+    if (target != nullptr && target->is_inside_tree() && is_target_visible(target)) {
+      mask |= int64_t(1) << i;
+    }
+  }
+  return mask;
 }
 
 /// @brief Draw the line of sight by casting rays and drawing lines between the points.
 void LineOfSight3D::draw_line_of_sight() {
-  List<Vector3> view_points_from = List<Vector3>();
-  List<Vector3> view_points_to = List<Vector3>();
-  ViewCastInfo old_view_cast_info = ViewCastInfo();
-
-  int step_count = angle * resolution;
-  double step_size = angle / step_count;
-  double rotation_deg = get_global_rotation_degrees().z;
-
-  for (int i = 0; i <= step_count; i++) {
-    double current_angle = rotation_deg - (angle / 2.0) + (step_size * i);
-    ViewCastInfo view_cast_info = view_cast(current_angle);
-
-    // If we already have a previous view cast, check if the current view cast is different.
-    if (i > 0) {
-      bool edge_distance_threshold_exceeded =
-          Math::abs(old_view_cast_info.distance - view_cast_info.distance) >
-          edge_distance_threshold;
-
-      bool diff_hit = old_view_cast_info.hit != view_cast_info.hit;
-      bool both_hit = old_view_cast_info.hit && view_cast_info.hit;
-      if (diff_hit || (both_hit && edge_distance_threshold_exceeded)) {
-        EdgeInfo edge = find_edge(old_view_cast_info, view_cast_info);
-        if (edge.point_A != Vector3(0, 0, 0)) {
-          view_points_from.push_back(view_cast_info.origin - get_global_position());
-          view_points_to.push_back(edge.point_A - get_global_position());
-        }
-        if (edge.point_B != Vector3(0, 0, 0)) {
-          view_points_from.push_back(view_cast_info.origin - get_global_position());
-          view_points_to.push_back(edge.point_B - get_global_position());
-        }
-      }
+  if (!prepare_line_of_sight()) {
+    return;
+  }
+  compute_line_of_sight();
+  commit_line_of_sight();
+}
+
+/// @brief Read everything the sweep needs from the scene tree. Must run on the main thread.
+/// @return Whether the sweep must be computed, false if the last one is still valid.
+bool LineOfSight3D::prepare_line_of_sight() {
+  // Without a mesh or a grid to fill, the line of sight is only used through the queries.
+  if (!is_sweep_needed()) {
+    return false;
+  }
+
+  // The cells must be rasterized again when the grid changes, even if the view doesn't.
+  if (grid.is_valid() && grid->get_layout() != grid_layout) {
+    grid_layout = grid->get_layout();
+    parameters_dirty = true;
+  }
+
+  // The space state and the transform are the same for every ray, so fetch them once per sweep.
+  space_state = get_world_3d()->get_direct_space_state();
+  occluder_index = nullptr;
+  if (use_occluder_index) {
+    occluder_index = LineOfSightServer::get_singleton()->get_occluder_index_3d();
+    gather_index_exclude();
+  }
+  sweep_origin = get_global_position();
+  sweep_rotation = get_global_rotation_degrees().z;
+  sweep_basis = get_global_transform().basis.orthonormalized();
+
+  // The cached rays are only valid while no occluder moves. When some occluders weren't hashed,
+  // any of them may have moved.
+  bool occluders_complete = true;
+  uint32_t occluders_hash = incremental || use_ray_cache ? hash_occluders(occluders_complete) : 0;
+  check_ray_cache(occluders_hash, parameters_dirty || !occluders_complete);
+
+  if (incremental) {
+    Transform3D transform = get_global_transform();
+    bool changed = parameters_dirty || !occluders_complete || transform != last_transform ||
+                   occluders_hash != last_occluders_hash;
+    last_transform = transform;
+    last_occluders_hash = occluders_hash;
+    // A volume swept over several frames keeps going until every row saw the change.
+    if (changed && mode == MODE_VOLUMETRIC) {
+      stale_rows = grid_rows;
+    }
+    if (!changed && stale_rows == 0) {
+      frames_skipped++;
+      LineOfSightServer::get_singleton()->add_to_counter(
+          LineOfSightServer::COUNTER_NODES_SKIPPED, 1
+      );
+      return false;
+    }
+  }
+
+  parameters_dirty = false;
+  frames_recomputed++;
+  return true;
+}
+
+/// @brief Compute the view points of the line of sight. Safe to call from a worker thread.
+void LineOfSight3D::compute_line_of_sight() {
+  // Ticks are monotonic, unlike the system time.
+  uint64_t start_time = Time::get_singleton()->get_ticks_usec();
+
+  int step_count = MAX(1, (int)(angle * resolution * lod_scale));
+  begin_sweep(step_count);
+
+  if (mode == MODE_VOLUMETRIC) {
+    sweep_volume();
+  } else {
+    sweep_raycast(angle, step_count);
+  }
+
+  if (grid.is_valid()) {
+    rasterize_view(grid.ptr());
+  }
+  if (render_enabled && (uses_distance_texture() || uses_interpolation())) {
+    build_distance_view(angle, step_count);
+  } else if (render_enabled && uses_indexed_mesh()) {
+    build_indexed_view();
+  }
+
+  sweep_pending = true;
+  update_time_usec = Time::get_singleton()->get_ticks_usec() - start_time;
+
+  // Report once per sweep, so the shared counters are barely touched.
+  LineOfSightServer *server = LineOfSightServer::get_singleton();
+  server->add_to_counter(LineOfSightServer::COUNTER_TIME_USEC, update_time_usec);
+  server->add_to_counter(LineOfSightServer::COUNTER_RAYS, rays_cast);
+  server->add_to_counter(LineOfSightServer::COUNTER_EDGES, edges_resolved);
+  server->add_to_counter(LineOfSightServer::COUNTER_BISECTION_RAYS, bisection_rays);
+  server->add_to_counter(LineOfSightServer::COUNTER_RAY_CACHE_HITS, ray_cache_hits);
+  server->add_to_counter(LineOfSightServer::COUNTER_RAY_CACHE_MISSES, ray_cache_misses);
+  server->add_to_counter(LineOfSightServer::COUNTER_NODES_UPDATED, 1);
+}
+
+/// @brief Build the mesh from the computed view points. Must run on the main thread.
+void LineOfSight3D::commit_line_of_sight() {
+  uint64_t start_time = Time::get_singleton()->get_ticks_usec();
+  if (render_enabled) {
+    update_mesh();
+  }
+  if (grid.is_valid()) {
+    grid->set_contribution(get_instance_id(), grid_teams, grid_spans);
+  }
+  sweep_pending = false;
+
+  // The sweep itself was timed by compute_line_of_sight(), maybe on another thread.
+  uint64_t commit_time_usec = Time::get_singleton()->get_ticks_usec() - start_time;
+  update_time_usec += commit_time_usec;
+  set_mesh_creation_time(update_time_usec / 1000000.0);
+
+  LineOfSightServer *server = LineOfSightServer::get_singleton();
+  server->add_to_counter(LineOfSightServer::COUNTER_TIME_USEC, commit_time_usec);
+  server->add_to_counter(LineOfSightServer::COUNTER_VERTICES, vertices_emitted);
+  server->add_to_counter(LineOfSightServer::COUNTER_VERTICES_UNSIMPLIFIED, vertices_unsimplified);
+}
+
+/// @brief Write the computed view points into the vertices of the mesh.
+void LineOfSight3D::update_mesh() {
+  if (uses_interpolation()) {
+    // The rendered frames draw the view between this tick and the one before.
+    push_interpolation_tick(angle);
+    return;
+  }
+  if (uses_distance_texture()) {
+    update_distance_texture(view_distances);
+    return;
+  }
+  clear_distance_quad();
+
+  if (uses_indexed_mesh()) {
+    update_indexed_mesh();
+    return;
+  }
+  update_surface(view_points_from, view_points_to);
+}
+
+/// @brief Draw the view between the last two physics ticks, on a rendered frame.
+void LineOfSight3D::update_interpolated_mesh() {
+  Vector3 origin;
+  double fraction = Engine::get_singleton()->get_physics_interpolation_fraction();
+  if (!interpolate_view(fraction, origin)) {
+    return;
+  }
+  mesh->set_global_position(origin);
+  if (uses_distance_texture()) {
+    update_distance_texture(interpolated_distances);
+    return;
+  }
+  clear_distance_quad();
+  update_surface(interpolated_from, interpolated_to);
+}
+
+/// @brief Replace the quad of the distance texture by the mesh of the view.
+void LineOfSight3D::clear_distance_quad() {
+  if (quad_radius >= 0) {
+    quad_radius = -1;
+    mesh->set_material_override(Ref<Material>());
+    array_mesh->clear_surfaces();
+  }
+}
+
+/// @brief Write the triangles of the volume, or view points as a triangle strip, into the vertices.
+/// @param p_from The start of each planar view point, relative to the position of the mesh.
+/// @param p_to The end of each planar view point, relative to the position of the mesh.
+void LineOfSight3D::update_surface(
+    const LocalVector<Vector3> &p_from, const LocalVector<Vector3> &p_to
+) {
+  bool volumetric = mode == MODE_VOLUMETRIC;
+  Mesh::PrimitiveType primitive =
+      volumetric ? Mesh::PRIMITIVE_TRIANGLES : Mesh::PRIMITIVE_TRIANGLE_STRIP;
+  int point_count = p_to.size();
+  int vertex_count = volumetric ? (int)volume_vertices.size() : point_count * 2;
+  vertices_emitted = vertex_count;
+  vertices_unsimplified = vertex_count;
+  if (vertex_count == 0) {
+    array_mesh->clear_surfaces();
+    return;
+  }
+
+  // The surface keeps its size while the vertices fit in it, so it can be updated in place.
+  bool rebuild = array_mesh->get_surface_count() == 0 || vertex_count > vertices.size() ||
+                 vertex_count < vertices.size() / 4 || primitive != mesh_primitive;
+#ifdef REAL_T_IS_DOUBLE
+  // The vertex buffer stores floats, so it can't be written directly from doubles.
+  rebuild = true;
+#endif
+  if (rebuild) {
+    vertices.resize(vertex_count + vertex_count / 4);
+  }
+
+  Vector3 *w = vertices.ptrw();
+  if (volumetric) {
+    for (int i = 0; i < vertex_count; i++) {
+      w[i] = volume_vertices[i];
+    }
+  } else {
+    for (int i = 0; i < point_count; i++) {
+      // Add two vertices for each view point.
+      w[i * 2] = p_from[i];
+      w[i * 2 + 1] = p_to[i];
     }
+  }
+  // Repeat the last vertex in the unused capacity, these triangles are degenerate.
+  for (int i = vertex_count; i < vertices.size(); i++) {
+    w[i] = w[vertex_count - 1];
+  }
 
-    view_points_from.push_back(view_cast_info.origin - get_global_position());
-    view_points_to.push_back(view_cast_info.point - get_global_position());
+  if (rebuild) {
+    Array arrays;
+    arrays.resize(Mesh::ARRAY_MAX);
+    arrays[Mesh::ARRAY_VERTEX] = vertices;
+    array_mesh->clear_surfaces();
+    array_mesh->add_surface_from_arrays(
+        primitive, arrays, TypedArray<Array>(), Dictionary(), Mesh::ARRAY_FLAG_USE_DYNAMIC_UPDATE
+    );
+    mesh_primitive = primitive;
+  } else {
+    RenderingServer::get_singleton()->mesh_surface_update_vertex_region(
+        array_mesh->get_rid(), 0, 0, vertices.to_byte_array()
+    );
+  }
 
-    old_view_cast_info = view_cast_info;
+  // Updating the vertices doesn't update the bounds of the mesh, so cover the whole radius.
+  if (mesh_radius != radius) {
+    mesh_radius = radius;
+    Vector3 extents = Vector3(radius, radius, radius);
+    array_mesh->set_custom_aabb(AABB(-extents, extents * 2));
   }
+}
 
-  int vertex_count = view_points_to.size() + 1;
-  SurfaceTool *st = new SurfaceTool();
-  st->begin(Mesh::PRIMITIVE_TRIANGLE_STRIP);
+/// @brief Write the indexed mesh built by the sweep into a new surface.
+void LineOfSight3D::update_indexed_mesh() {
+  int vertex_count = mesh_vertices.size();
+  vertices_emitted = vertex_count;
+  vertices_unsimplified = mesh_vertices_unsimplified;
+  // The triangle strip no longer matches the surface, so it must rebuild it.
+  vertices.clear();
+  if (vertex_count == 0) {
+    array_mesh->clear_surfaces();
+    return;
+  }
 
-  for (int i = 0; i < vertex_count - 1; i++) {
-    // Add two vertices to the SurfaceTool for each view point.
-    st->add_vertex(view_points_from[i]);
-    st->add_vertex(view_points_to[i]);
+  PackedVector3Array indexed_vertices;
+  indexed_vertices.resize(vertex_count);
+  Vector3 *w = indexed_vertices.ptrw();
+  for (int i = 0; i < vertex_count; i++) {
+    w[i] = mesh_vertices[i];
   }
+  PackedInt32Array indices;
+  indices.resize(mesh_indices.size());
+  memcpy(indices.ptrw(), mesh_indices.ptr(), mesh_indices.size() * sizeof(int32_t));
 
-  Ref<ArrayMesh> m = st->commit();
-  mesh->set_mesh(m);
+  // The triangles change with every sweep, so the surface is replaced instead of updated in place.
+  Array arrays;
+  arrays.resize(Mesh::ARRAY_MAX);
+  arrays[Mesh::ARRAY_VERTEX] = indexed_vertices;
+  arrays[Mesh::ARRAY_INDEX] = indices;
+  array_mesh->clear_surfaces();
+  array_mesh->add_surface_from_arrays(Mesh::PRIMITIVE_TRIANGLES, arrays);
 }
 
-void LineOfSight3D::set_resolution(double value) { resolution = value; }
+/// @brief Whether the mesh is indexed, which only applies to the views swept around the origin.
+bool LineOfSight3D::uses_indexed_mesh() const { return indexed_mesh && mode == MODE_PLANAR; }
+
+/// @brief Write the distances sampled by the sweep into the texture, and draw it on a quad covering
+/// the radius in the XZ plane. The shader discards the pixels out of the view.
+/// @param p_distances The distance of the view along every step, from distance_start_angle.
+void LineOfSight3D::update_distance_texture(const LocalVector<float> &p_distances) {
+  int width = p_distances.size();
+  vertices_emitted = width > 0 ? 4 : 0;
+  vertices_unsimplified = vertices_emitted;
+  // The triangle strip no longer matches the surface, so it must rebuild it.
+  vertices.clear();
+  if (width == 0) {
+    array_mesh->clear_surfaces();
+    quad_radius = -1;
+    return;
+  }
+
+  // The distances span the whole radius, so they are kept as 32-bit floats.
+  PackedByteArray bytes;
+  bytes.resize(width * sizeof(float));
+  memcpy(bytes.ptrw(), p_distances.ptr(), width * sizeof(float));
+  bool resized = distance_texture->get_width() != width;
+  distance_image->set_data(width, 1, false, Image::FORMAT_RF, bytes);
+  if (resized) {
+    distance_texture->set_image(distance_image);
+  } else {
+    distance_texture->update(distance_image);
+  }
+
+  if (quad_radius != radius) {
+    quad_radius = radius;
+    PackedVector3Array corners;
+    corners.push_back(Vector3(-radius, 0, -radius));
+    corners.push_back(Vector3(radius, 0, -radius));
+    corners.push_back(Vector3(-radius, 0, radius));
+    corners.push_back(Vector3(radius, 0, radius));
+    Array arrays;
+    arrays.resize(Mesh::ARRAY_MAX);
+    arrays[Mesh::ARRAY_VERTEX] = corners;
+    array_mesh->clear_surfaces();
+    array_mesh->add_surface_from_arrays(Mesh::PRIMITIVE_TRIANGLE_STRIP, arrays);
+    mesh_primitive = Mesh::PRIMITIVE_TRIANGLE_STRIP;
+
+    if (distance_material->get_shader().is_null()) {
+      distance_material->set_shader(LineOfSightServer::get_singleton()->get_distance_shader_3d());
+      distance_material->set_shader_parameter("distances", distance_texture);
+    }
+    mesh->set_material_override(distance_material);
+  }
+
+  distance_material->set_shader_parameter("start_angle", distance_start_angle);
+  distance_material->set_shader_parameter("sweep_angle", Math::deg_to_rad(angle));
+  distance_material->set_shader_parameter("min_distance", distance_from_origin);
+}
+
+/// @brief Whether the rendered frames draw the view between the last two physics ticks, which only
+/// applies to the planar mode.
+bool LineOfSight3D::uses_interpolation() const {
+  return update_mode == UPDATE_PHYSICS && render_enabled && mode == MODE_PLANAR;
+}
+
+/// @brief Whether the view is drawn from a distance texture, which only applies to the planar mode.
+bool LineOfSight3D::uses_distance_texture() const {
+  return render_mode == RENDER_DISTANCE_TEXTURE && mode == MODE_PLANAR;
+}
+
+/// @brief Whether the sweep queries the physics server (as opposed to pure computations).
+bool LineOfSight3D::uses_physics_queries() const { return !use_occluder_index; }
+
+void LineOfSight3D::set_resolution(double value) {
+  resolution = value;
+  parameters_dirty = true;
+  grid_dirty = true;
+}
 
 double LineOfSight3D::get_resolution() const { return resolution; }
 
 void LineOfSight3D::set_edge_resolve_iterations(const int p_edge_resolve_iterations) {
   edge_resolve_iterations = p_edge_resolve_iterations;
+  parameters_dirty = true;
 }
 
 int LineOfSight3D::get_edge_resolve_iterations() const { return edge_resolve_iterations; }
 
-void LineOfSight3D::set_edge_distance_threshold(double value) { edge_distance_threshold = value; }
+void LineOfSight3D::set_edge_distance_threshold(double value) {
+  edge_distance_threshold = value;
+  parameters_dirty = true;
+}
 
 double LineOfSight3D::get_edge_distance_threshold() const { return edge_distance_threshold; }
 
-void LineOfSight3D::set_distance_from_origin(double value) { distance_from_origin = value; }
+void LineOfSight3D::set_distance_from_origin(double value) {
+  distance_from_origin = value;
+  parameters_dirty = true;
+}
 
 double LineOfSight3D::get_distance_from_origin() const { return distance_from_origin; }
 
-void LineOfSight3D::set_angle(double value) { angle = value; }
+void LineOfSight3D::set_angle(double value) {
+  angle = value;
+  parameters_dirty = true;
+  grid_dirty = true;
+}
 
 double LineOfSight3D::get_angle() const { return angle; }
 
-void LineOfSight3D::set_radius(double value) { radius = value; }
+void LineOfSight3D::set_radius(double value) {
+  radius = value;
+  parameters_dirty = true;
+  grid_dirty = true;
+}
 
 double LineOfSight3D::get_radius() const { return radius; }
 
+void LineOfSight3D::set_update_mode(const UpdateMode p_update_mode) {
+  if (update_mode == p_update_mode) {
+    return;
+  }
+
+  LineOfSightServer *server = LineOfSightServer::get_singleton();
+  if (is_inside_tree() && is_server_updated()) {
+    server->unregister_agent_3d(this);
+  }
+  update_mode = p_update_mode;
+  if (is_inside_tree() && is_server_updated()) {
+    server->register_agent_3d(this);
+  }
+  reset_interpolation();
+}
+
+LineOfSight3D::UpdateMode LineOfSight3D::get_update_mode() const { return update_mode; }
+
+/// @brief Whether the view is used by a mesh or a grid, so the node must sweep.
+bool LineOfSight3D::is_sweep_needed() const { return render_enabled || grid.is_valid(); }
+
+/// @brief Whether the node is computed by the LineOfSightServer rather than in _process().
+bool LineOfSight3D::is_server_updated() const {
+  return update_mode == UPDATE_SERVER || update_mode == UPDATE_SCHEDULED;
+}
+
+void LineOfSight3D::set_update_priority(const double p_update_priority) {
+  update_priority = MAX(0.0, p_update_priority);
+}
+
+double LineOfSight3D::get_update_priority() const { return update_priority; }
+
+/// @brief Scale the resolution down, used by the scheduler for the far nodes. The scheduler sets it
+/// again every frame, so only the server can set it, and scripts can only read it.
+void LineOfSight3D::set_lod_scale(const double p_lod_scale) {
+  if (lod_scale != p_lod_scale) {
+    lod_scale = p_lod_scale;
+    parameters_dirty = true;
+  }
+}
+
+double LineOfSight3D::get_lod_scale() const { return lod_scale; }
+
+void LineOfSight3D::set_incremental(const bool p_incremental) {
+  incremental = p_incremental;
+  parameters_dirty = true;
+}
+
+bool LineOfSight3D::get_incremental() const { return incremental; }
+
+void LineOfSight3D::set_collision_mask(const uint32_t p_collision_mask) {
+  collision_mask = p_collision_mask;
+  update_query_filters();
+  parameters_dirty = true;
+}
+
+uint32_t LineOfSight3D::get_collision_mask() const { return collision_mask; }
+
+void LineOfSight3D::set_exclude(const TypedArray<RID> &p_exclude) {
+  exclude = p_exclude;
+  update_query_filters();
+  parameters_dirty = true;
+}
+
+TypedArray<RID> LineOfSight3D::get_exclude() const { return exclude; }
+
+void LineOfSight3D::set_use_occluder_index(const bool p_use_occluder_index) {
+  if (use_occluder_index == p_use_occluder_index) {
+    return;
+  }
+
+  use_occluder_index = p_use_occluder_index;
+  parameters_dirty = true;
+  if (!is_inside_tree()) {
+    return;
+  }
+  if (use_occluder_index) {
+    LineOfSightServer::get_singleton()->acquire_occluder_index_3d();
+  } else {
+    LineOfSightServer::get_singleton()->release_occluder_index_3d();
+  }
+}
+
+bool LineOfSight3D::get_use_occluder_index() const { return use_occluder_index; }
+
+/// @brief Apply the collision mask and the excluded bodies to the physics queries.
+void LineOfSight3D::update_query_filters() {
+  ray_query->set_collision_mask(collision_mask);
+  ray_query->set_exclude(exclude);
+  target_query->set_collision_mask(collision_mask);
+  target_query->set_exclude(exclude);
+  occluder_query->set_collision_mask(collision_mask);
+  occluder_query->set_exclude(exclude);
+  for (uint32_t i = 0; i < row_queries.size(); i++) {
+    row_queries[i]->set_collision_mask(collision_mask);
+    row_queries[i]->set_exclude(exclude);
+  }
+}
+
+/// @brief List the bodies the occluder index must ignore: the excluded ones, and the bodies
+/// carrying this node, whose own shapes would block every ray.
+void LineOfSight3D::gather_index_exclude() {
+  index_exclude.clear();
+  PhysicsServer3D *physics_server = PhysicsServer3D::get_singleton();
+  for (int i = 0; i < exclude.size(); i++) {
+    index_exclude.push_back(physics_server->body_get_object_instance_id(exclude[i]));
+  }
+  for (Node *node = get_parent(); node != nullptr; node = node->get_parent()) {
+    if (Object::cast_to<CollisionObject3D>(node) != nullptr) {
+      index_exclude.push_back(node->get_instance_id());
+    }
+  }
+}
+
+int64_t LineOfSight3D::get_frames_recomputed() const { return frames_recomputed; }
+
+int64_t LineOfSight3D::get_frames_skipped() const { return frames_skipped; }
+
+void LineOfSight3D::set_adaptive_subdivisions(const int p_adaptive_subdivisions) {
+  adaptive_subdivisions = CLAMP(p_adaptive_subdivisions, 0, 8);
+  parameters_dirty = true;
+}
+
+int LineOfSight3D::get_adaptive_subdivisions() const { return adaptive_subdivisions; }
+
+void LineOfSight3D::set_use_ray_cache(const bool p_use_ray_cache) {
+  use_ray_cache = p_use_ray_cache;
+  parameters_dirty = true;
+}
+
+bool LineOfSight3D::get_use_ray_cache() const { return use_ray_cache; }
+
+void LineOfSight3D::set_ray_cache_tolerance(const double p_ray_cache_tolerance) {
+  ray_cache_tolerance = MAX(0.0, p_ray_cache_tolerance);
+  parameters_dirty = true;
+}
+
+double LineOfSight3D::get_ray_cache_tolerance() const { return ray_cache_tolerance; }
+
+/// @brief Set whether the sweeps take their sines and cosines from FixedTrig, so that they give the
+/// same view on every platform.
+void LineOfSight3D::set_deterministic(const bool p_deterministic) {
+  sweep.set_deterministic(p_deterministic);
+  parameters_dirty = true;
+  grid_dirty = true;
+}
+
+bool LineOfSight3D::get_deterministic() const { return sweep.is_deterministic(); }
+
+void LineOfSight3D::set_render_enabled(const bool p_render_enabled) {
+  render_enabled = p_render_enabled;
+  parameters_dirty = true;
+  if (!render_enabled) {
+    array_mesh->clear_surfaces();
+    quad_radius = -1;
+    sweep_pending = false;
+    reset_interpolation();
+  }
+  if (is_inside_tree()) {
+    mesh->set_visible(render_enabled);
+  }
+}
+
+bool LineOfSight3D::get_render_enabled() const { return render_enabled; }
+
+void LineOfSight3D::set_render_mode(const RenderMode p_render_mode) {
+  render_mode = p_render_mode;
+  parameters_dirty = true;
+}
+
+LineOfSight3D::RenderMode LineOfSight3D::get_render_mode() const { return render_mode; }
+
+/// @brief Get the texture holding the distance of the view along every step of the sweep, updated
+/// by every commit in the distance texture render mode.
+Ref<Texture2D> LineOfSight3D::get_distance_texture() const { return distance_texture; }
+
+void LineOfSight3D::set_indexed_mesh(const bool p_indexed_mesh) {
+  indexed_mesh = p_indexed_mesh;
+  parameters_dirty = true;
+}
+
+bool LineOfSight3D::get_indexed_mesh() const { return indexed_mesh; }
+
+void LineOfSight3D::set_simplify_tolerance(const double p_simplify_tolerance) {
+  simplify_tolerance = MAX(0.0, p_simplify_tolerance);
+  parameters_dirty = true;
+}
+
+double LineOfSight3D::get_simplify_tolerance() const { return simplify_tolerance; }
+
+void LineOfSight3D::set_grid(const Ref<LineOfSightGrid> &p_grid) {
+  if (grid.is_valid()) {
+    grid->remove_contribution(get_instance_id());
+  }
+  grid = p_grid;
+  grid_layout = 0;
+  parameters_dirty = true;
+}
+
+Ref<LineOfSightGrid> LineOfSight3D::get_grid() const { return grid; }
+
+void LineOfSight3D::set_grid_teams(const int p_grid_teams) {
+  grid_teams = p_grid_teams;
+  parameters_dirty = true;
+}
+
+int LineOfSight3D::get_grid_teams() const { return grid_teams; }
+
+void LineOfSight3D::set_mode(const Mode p_mode) {
+  mode = p_mode;
+  parameters_dirty = true;
+  grid_dirty = true;
+  stale_rows = 0;
+  reset_interpolation();
+}
+
+LineOfSight3D::Mode LineOfSight3D::get_mode() const { return mode; }
+
+void LineOfSight3D::set_vertical_angle(const double p_vertical_angle) {
+  vertical_angle = p_vertical_angle;
+  parameters_dirty = true;
+  grid_dirty = true;
+}
+
+double LineOfSight3D::get_vertical_angle() const { return vertical_angle; }
+
+void LineOfSight3D::set_vertical_resolution(const double p_vertical_resolution) {
+  vertical_resolution = p_vertical_resolution;
+  parameters_dirty = true;
+  grid_dirty = true;
+}
+
+double LineOfSight3D::get_vertical_resolution() const { return vertical_resolution; }
+
+void LineOfSight3D::set_max_rays_per_frame(const int p_max_rays_per_frame) {
+  max_rays_per_frame = MAX(0, p_max_rays_per_frame);
+  parameters_dirty = true;
+}
+
+int LineOfSight3D::get_max_rays_per_frame() const { return max_rays_per_frame; }
+
 void LineOfSight3D::set_mesh_creation_time(double value) { mesh_creation_time = value; }
 
 double LineOfSight3D::get_mesh_creation_time() const { return mesh_creation_time; }
+
+int LineOfSight3D::get_rays_cast() const { return rays_cast; }
+
+int LineOfSight3D::get_edges_resolved() const { return edges_resolved; }
+
+int LineOfSight3D::get_vertices_emitted() const { return vertices_emitted; }
+
+int LineOfSight3D::get_vertices_unsimplified() const { return vertices_unsimplified; }
+
+int64_t LineOfSight3D::get_update_time_usec() const { return update_time_usec; }
+
+/// @brief Get the counters of the last sweep, and the number of sweeps computed and skipped.
+Dictionary LineOfSight3D::get_stats() const {
+  Dictionary stats;
+  stats["time_usec"] = update_time_usec;
+  stats["rays"] = rays_cast;
+  stats["edges"] = edges_resolved;
+  stats["bisection_rays"] = bisection_rays;
+  stats["ray_cache_hits"] = ray_cache_hits;
+  stats["ray_cache_misses"] = ray_cache_misses;
+  stats["vertices"] = vertices_emitted;
+  stats["vertices_unsimplified"] = vertices_unsimplified;
+  stats["frames_recomputed"] = frames_recomputed;
+  stats["frames_skipped"] = frames_skipped;
+  return stats;
+}
@@ -1,72 +1,122 @@
 #ifndef LINEOFSIGHT_3D_H
 #define LINEOFSIGHT_3D_H
 
+#include "lineofsightcore.h"
+#include "occluderindex3d.h"
+
+#include <godot_cpp/classes/array_mesh.hpp>
+#include <godot_cpp/classes/image.hpp>
+#include <godot_cpp/classes/image_texture.hpp>
+#include <godot_cpp/classes/sphere_shape3d.hpp>
 #include <godot_cpp/classes/mesh_instance3d.hpp>
-#include <godot_cpp/classes/performance.hpp>
 #include <godot_cpp/classes/physics_direct_space_state3d.hpp>
 #include <godot_cpp/classes/physics_ray_query_parameters3d.hpp>
-#include <godot_cpp/classes/surface_tool.hpp>
+#include <godot_cpp/classes/physics_shape_query_parameters3d.hpp>
+#include <godot_cpp/classes/shader_material.hpp>
 #include <godot_cpp/classes/world3d.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
 
 #include <godot_cpp/classes/node3d.hpp>
 
 using namespace godot;
 
-class LineOfSight3D : public Node3D {
+/// @brief The types of the 3D line of sight, for LineOfSightCore.
+struct LineOfSight3DTraits {
+  typedef Vector3 Vector;
+  typedef PhysicsDirectSpaceState3D SpaceState;
+  typedef PhysicsRayQueryParameters3D RayQuery;
+  typedef OccluderIndex3D OccluderIndex;
+
+  // The sweep turns in the XZ plane.
+  static _FORCE_INLINE_ Vector3 to_vector(const Vector2 &p_direction) {
+    return Vector3(p_direction.x, 0, p_direction.y);
+  }
+  static _FORCE_INLINE_ Vector2 to_plane(const Vector3 &p_vector) {
+    return Vector2(p_vector.x, p_vector.z);
+  }
+};
+
+class LineOfSight3D : public Node3D, public LineOfSightCore<LineOfSight3DTraits> {
   GDCLASS(LineOfSight3D, Node3D)
 
 public:
-  struct ViewCastInfo {
-    bool hit;         // Whether the ray hit an obstacle.
-    Vector3 origin;   // The origin of the ray.
-    Vector3 point;    // The point at which the ray hit the obstacle.
-    double distance;  // The distance from the origin to the point.
-    double angle;     // The angle at which the ray was cast in degrees.
-
-    ViewCastInfo() {
-      hit = false;
-      origin = Vector3();
-      point = Vector3();
-      distance = 0;
-      angle = 0;
-    }
-
-    ViewCastInfo(bool p_hit, Vector3 p_origin, Vector3 p_point, double p_distance, double p_angle) {
-      hit = p_hit;
-      origin = p_origin;
-      point = p_point;
-      distance = p_distance;
-      angle = p_angle;
-    }
+  enum Mode {
+    MODE_PLANAR,      // Sweep a flat cone at the height of the node.
+    MODE_VOLUMETRIC,  // Sweep a grid of rays covering a vertical angle too.
   };
 
-  struct EdgeInfo {
-    Vector3 point_A;
-    Vector3 point_B;
-
-    EdgeInfo() {
-      point_A = Vector3();
-      point_B = Vector3();
-    }
+  enum UpdateMode {
+    UPDATE_PROCESS,    // Compute the line of sight in _process().
+    UPDATE_SERVER,     // Let the LineOfSightServer compute it in parallel with the other nodes.
+    UPDATE_SCHEDULED,  // Let the LineOfSightServer compute it when it fits in the frame budget.
+    UPDATE_PHYSICS,    // Compute it in _physics_process() and interpolate the mesh in _process().
+  };
 
-    EdgeInfo(Vector3 p_point_A, Vector3 p_point_B) {
-      point_A = p_point_A;
-      point_B = p_point_B;
-    }
+  enum RenderMode {
+    RENDER_MESH,              // Build a mesh of the view.
+    RENDER_DISTANCE_TEXTURE,  // Write the distances of the view into a texture drawn by a shader.
   };
 
 private:
-  double resolution;               // The number of steps to take when casting rays.
-  int edge_resolve_iterations;     // The number of iterations to take when resolving edges.
-  double edge_distance_threshold;  // The distance threshold for resolving edges.
-  double distance_from_origin;     // The distance from the origin of the start of the LOS.
-  double angle;                    // The angle of the LOS.
-  double radius;                   // The radius of the LOS (how far).
+  double resolution;           // The number of steps to take when casting rays.
+  double angle;                // The angle of the LOS.
+  UpdateMode update_mode;      // Where the line of sight is computed.
+  bool incremental;            // Whether to skip the sweep when nothing changed.
+  TypedArray<RID> exclude;     // The bodies which don't occlude the LOS.
+  bool use_occluder_index;     // Whether to cast the rays against the server's occluder index.
+  Ref<LineOfSightGrid> grid;   // The grid marked with the cells seen by the LOS.
+  int grid_teams;              // The team bits set in the cells of the grid.
+  uint32_t grid_layout;        // The layout of the grid when its cells were last rasterized.
+  bool render_enabled;         // Whether to build the mesh, false to only run queries.
+  RenderMode render_mode;      // How the view is drawn.
+  Mode mode;                   // How the cone is swept.
+  double vertical_angle;       // The vertical angle of the LOS in the volumetric mode.
+  double vertical_resolution;  // The number of rows per degree in the volumetric mode.
+  int max_rays_per_frame;      // The rays cast per volumetric sweep, 0 for no limit.
 
   double mesh_creation_time;  // The time it takes to create the mesh.
-  Performance *performance;   // The performance monitor.
+  uint64_t update_time_usec;  // The time taken by the last sweep and its mesh in microseconds.
+  int vertices_emitted;       // The number of vertices of the last mesh.
+  int vertices_unsimplified;  // The number of vertices of the last mesh before simplifying it.
+
+  double update_priority;  // The weight of the node in the scheduled updates.
+  double lod_scale;        // The factor applied to the resolution by the scheduler.
 
   MeshInstance3D *mesh;
+  Ref<ArrayMesh> array_mesh;    // The mesh updated in place by every commit.
+  PackedVector3Array vertices;  // The vertices of the mesh, padded up to their capacity.
+  double mesh_radius;           // The radius covered by the custom AABB of the mesh.
+
+  Ref<Image> distance_image;              // The image holding the distances of the view.
+  Ref<ImageTexture> distance_texture;     // The texture read by the distance shader.
+  Ref<ShaderMaterial> distance_material;  // The material drawing the quad from the texture.
+  double quad_radius;                     // The radius covered by the quad, -1 without it.
+
+  bool sweep_pending;  // Whether a sweep waits to be committed.
+
+  Ref<SphereShape3D> occluder_shape;                  // The shape covering the LOS.
+  Ref<PhysicsShapeQueryParameters3D> occluder_query;  // The query finding nearby occluders.
+  Transform3D last_transform;                         // The global transform of the last sweep.
+  uint32_t last_occluders_hash;                       // The occluders of the last sweep.
+  bool parameters_dirty;                              // Whether a parameter changed since then.
+  int64_t frames_recomputed;                          // The number of sweeps computed.
+  int64_t frames_skipped;                             // The number of sweeps skipped.
+
+  Ref<PhysicsRayQueryParameters3D> target_query;  // The ray query of the visibility queries.
+  LocalVector<uint64_t> targets;                  // The instance ids of the registered targets.
+
+  Basis sweep_basis;                                          // The orientation of the sweep.
+  LocalVector<Vector3> grid_directions;                       // The local direction of each ray.
+  LocalVector<real_t> grid_distances;                         // The distance reached by each ray.
+  LocalVector<Ref<PhysicsRayQueryParameters3D>> row_queries;  // The ray query of each row.
+  int grid_columns;                                           // The number of rays in a row.
+  int grid_rows;                                              // The number of rows of rays.
+  int first_row;                                              // The first row cast by this sweep.
+  int next_row;                                               // The first row of the next sweep.
+  int stale_rows;                                             // The rows cast before a change.
+  bool grid_dirty;                                            // Whether the directions changed.
+  LocalVector<Vector3> volume_vertices;                       // The triangles of the volume.
+  Mesh::PrimitiveType mesh_primitive;                         // The primitive of the surface.
 
 public:
   void set_resolution(const double p_resolution);
@@ -87,12 +137,124 @@ public:
   void set_radius(const double p_radius);
   double get_radius() const;
 
+  void set_update_mode(const UpdateMode p_update_mode);
+  UpdateMode get_update_mode() const;
+
+  void set_update_priority(const double p_update_priority);
+  double get_update_priority() const;
+
+  double get_lod_scale() const;
+
+  void set_incremental(const bool p_incremental);
+  bool get_incremental() const;
+
+  void set_collision_mask(const uint32_t p_collision_mask);
+  uint32_t get_collision_mask() const;
+
+  void set_exclude(const TypedArray<RID> &p_exclude);
+  TypedArray<RID> get_exclude() const;
+
+  void set_use_occluder_index(const bool p_use_occluder_index);
+  bool get_use_occluder_index() const;
+
+  int64_t get_frames_recomputed() const;
+  int64_t get_frames_skipped() const;
+
+  void set_adaptive_subdivisions(const int p_adaptive_subdivisions);
+  int get_adaptive_subdivisions() const;
+
+  void set_use_ray_cache(const bool p_use_ray_cache);
+  bool get_use_ray_cache() const;
+
+  void set_ray_cache_tolerance(const double p_ray_cache_tolerance);
+  double get_ray_cache_tolerance() const;
+
+  void set_deterministic(const bool p_deterministic);
+  bool get_deterministic() const;
+
+  void set_mode(const Mode p_mode);
+  Mode get_mode() const;
+
+  void set_vertical_angle(const double p_vertical_angle);
+  double get_vertical_angle() const;
+
+  void set_vertical_resolution(const double p_vertical_resolution);
+  double get_vertical_resolution() const;
+
+  void set_max_rays_per_frame(const int p_max_rays_per_frame);
+  int get_max_rays_per_frame() const;
+
+  void set_render_enabled(const bool p_render_enabled);
+  bool get_render_enabled() const;
+
+  void set_render_mode(const RenderMode p_render_mode);
+  RenderMode get_render_mode() const;
+
+  Ref<Texture2D> get_distance_texture() const;
+
+  void set_indexed_mesh(const bool p_indexed_mesh);
+  bool get_indexed_mesh() const;
+
+  void set_simplify_tolerance(const double p_simplify_tolerance);
+  double get_simplify_tolerance() const;
+
+  void set_grid(const Ref<LineOfSightGrid> &p_grid);
+  Ref<LineOfSightGrid> get_grid() const;
+
+  void set_grid_teams(const int p_grid_teams);
+  int get_grid_teams() const;
+
   void set_mesh_creation_time(const double p_mesh_creation_time);
   double get_mesh_creation_time() const;
 
+  int get_rays_cast() const;
+  int get_edges_resolved() const;
+  int get_vertices_emitted() const;
+  int get_vertices_unsimplified() const;
+  int64_t get_update_time_usec() const;
+  Dictionary get_stats() const;
+
+  bool is_point_visible(const Vector3 &p_point);
+  TypedArray<Node3D> get_visible_bodies();
+
+  void add_target(Node3D *p_target);
+  void remove_target(Node3D *p_target);
+  TypedArray<Node3D> get_targets() const;
+  int64_t get_visibility_mask();
+
 private:
-  ViewCastInfo view_cast(const double p_angle);
-  EdgeInfo find_edge(ViewCastInfo p_min_view_cast, ViewCastInfo p_max_view_cast);
+  // The server sets the level of detail of the scheduled nodes.
+  friend class LineOfSightServer;
+
+  void set_lod_scale(const double p_lod_scale);
+
+  uint32_t hash_occluders(bool &r_complete);
+
+  bool is_in_cone(const Vector3 &p_point) const;
+  bool is_target_visible(Node3D *p_target);
+  bool cast_target_ray(const Vector3 &p_point, const RID &p_body);
+
+  bool is_server_updated() const;
+  bool is_sweep_needed() const;
+
+  void update_query_filters();
+  void gather_index_exclude();
+
+  void update_mesh();
+  void update_interpolated_mesh();
+  void clear_distance_quad();
+  void update_surface(const LocalVector<Vector3> &p_from, const LocalVector<Vector3> &p_to);
+  void update_indexed_mesh();
+  bool uses_indexed_mesh() const;
+  void update_distance_texture(const LocalVector<float> &p_distances);
+  bool uses_distance_texture() const;
+  bool uses_interpolation() const;
+  void sweep_volume();
+  void resize_grid(const int p_columns, const int p_rows);
+  void build_volume();
+  void add_volume_quad(
+      const Vector3 &p_a, const Vector3 &p_b, const Vector3 &p_c, const Vector3 &p_d
+  );
 
 protected:
   static void _bind_methods();
@@ -104,8 +266,19 @@ public:
   void _enter_tree() override;
   void _exit_tree() override;
   void _process(double delta) override;
+  void _physics_process(double delta) override;
 
   void draw_line_of_sight();
+  bool prepare_line_of_sight();
+  void compute_line_of_sight();
+  void commit_line_of_sight();
+  bool uses_physics_queries() const;
+
+  void _cast_row(const int p_index);
 };
 
+VARIANT_ENUM_CAST(LineOfSight3D::Mode);
+VARIANT_ENUM_CAST(LineOfSight3D::UpdateMode);
+VARIANT_ENUM_CAST(LineOfSight3D::RenderMode);
+
 #endif
@@ -0,0 +1,968 @@
+#ifndef LINEOFSIGHT_CORE_H
+#define LINEOFSIGHT_CORE_H
+
+#include "lineofsightgrid.h"
+#include "sweepgenerator.h"
+#include "tileoccupancy.h"
+
+#include <godot_cpp/core/math.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/string_name.hpp>
+#include <godot_cpp/variant/typed_array.hpp>
+
+using namespace godot;
+
+/// @brief The raycast sweep shared by LineOfSight2D and LineOfSight3D.
+///
+/// The nodes inherit it next to their Godot base class and keep the bindings, the meshes and the
+/// modes of their own dimension. Traits give the types of the dimension at compile time:
+/// - Vector: the vector type of the rays (Vector2 or Vector3).
+/// - SpaceState and RayQuery: the physics space state and ray query types.
+/// - OccluderIndex: the occluder index type of the LineOfSightServer.
+/// - to_vector(): maps a direction in the plane of the sweep to a Vector.
+/// - to_plane(): maps a Vector to the plane of the sweep, where the grid and the tiles lie.
+/// Everything is resolved statically, so the hot loops are compiled once per dimension.
+template <class Traits>
+class LineOfSightCore {
+public:
+  typedef typename Traits::Vector Vector;
+  typedef typename Traits::SpaceState SpaceState;
+  typedef typename Traits::RayQuery RayQuery;
+  typedef typename Traits::OccluderIndex OccluderIndex;
+
+  struct ViewCastInfo {
+    bool hit;              // Whether the ray hit an obstacle.
+    Vector origin;         // The origin of the ray.
+    Vector point;          // The point at which the ray hit the obstacle.
+    double distance;       // The distance from the origin to the point.
+    Vector2 direction;     // The direction of the ray in the plane of the sweep.
+    uint64_t collider_id;  // The instance id of the obstacle, 0 if unknown.
+    Vector normal;         // The normal of the obstacle at the point, if known.
+    int age;               // The number of sweeps the ray was predicted by since it was cast.
+
+    ViewCastInfo() {
+      hit = false;
+      origin = Vector();
+      point = Vector();
+      distance = 0;
+      direction = Vector2();
+      collider_id = 0;
+      normal = Vector();
+      age = 0;
+    }
+
+    ViewCastInfo(
+        bool p_hit, Vector p_origin, Vector p_point, double p_distance, Vector2 p_direction,
+        uint64_t p_collider_id = 0, Vector p_normal = Vector()
+    ) {
+      hit = p_hit;
+      origin = p_origin;
+      point = p_point;
+      distance = p_distance;
+      direction = p_direction;
+      collider_id = p_collider_id;
+      normal = p_normal;
+      age = 0;
+    }
+  };
+
+  struct EdgeInfo {
+    Vector point_A;
+    Vector point_B;
+
+    EdgeInfo() {
+      point_A = Vector();
+      point_B = Vector();
+    }
+
+    EdgeInfo(Vector p_point_A, Vector p_point_B) {
+      point_A = p_point_A;
+      point_B = p_point_B;
+    }
+  };
+
+  // The distance view of a physics tick, kept to draw the view between two ticks.
+  struct InterpolationTick {
+    LocalVector<float> distances;  // The distance of the view along every step of the sweep.
+    Vector origin;                 // The global position of the sweep.
+    double rotation;               // The global rotation of the sweep in degrees.
+    double angle;                  // The angle of the cone in degrees.
+
+    InterpolationTick() {
+      rotation = 0;
+      angle = 0;
+    }
+  };
+
+  /// @brief Clip the view from a sweep shared with other views instead of casting rays, until
+  /// it is unset. It must cover the cone of this view and stay alive while this view is computed.
+  void set_shared_sweep(const LineOfSightCore *p_shared_sweep) { shared_sweep = p_shared_sweep; }
+
+protected:
+  // The number of sweeps a cached ray can be predicted by before it is cast again.
+  static const int RAY_CACHE_MAX_AGE = 8;
+  // The bodies a shape query around the node reports at most. Past it, the occluders can't all be
+  // hashed, so a node surrounded by more of them is swept every frame.
+  static const int MAX_OCCLUDER_RESULTS = 256;
+
+  int edge_resolve_iterations;     // The number of iterations to take when resolving edges.
+  double edge_distance_threshold;  // The distance threshold for resolving edges.
+  double distance_from_origin;     // The distance from the origin of the start of the LOS.
+  double radius;                   // The radius of the LOS (how far).
+  uint32_t collision_mask;         // The collision layers which occlude the LOS.
+  int adaptive_subdivisions;       // The number of halvings from the coarse to the regular step.
+
+  int rays_cast;       // The number of rays cast by the last sweep.
+  int edges_resolved;  // The number of edges resolved by the last sweep.
+  int bisection_rays;  // The number of rays cast while resolving the edges.
+
+  bool use_ray_cache;                   // Whether to predict the rays from the last sweep.
+  double ray_cache_tolerance;           // How far the origin and the cached hits may move apart.
+  LocalVector<ViewCastInfo> ray_cache;  // The rays of the last sweep, by increasing angles.
+  Vector ray_cache_origin;              // The origin of the cached rays.
+  uint32_t ray_cache_hash;              // The occluders when the cached rays were cast.
+  uint32_t ray_cache_cursor;            // The cached ray before the current one.
+  int ray_cache_hits;                   // The rays of the last sweep predicted by the cache.
+  int ray_cache_misses;                 // The rays of the last sweep the cache couldn't predict.
+
+  Ref<RayQuery> ray_query;               // The ray query reused by every ray of the sweep.
+  SpaceState *space_state;               // The space state queried by the current sweep.
+  const OccluderIndex *occluder_index;   // The index queried by the current sweep, if any.
+  LocalVector<uint64_t> index_exclude;   // The instance ids of the bodies it ignores.
+  const TileOccupancy *tiles;            // The tiles queried by the current sweep, if any.
+  Vector sweep_origin;                   // The global position of the current sweep.
+  double sweep_rotation;                 // The global rotation of the current sweep.
+  LocalVector<ViewCastInfo> view_casts;  // The rays cast by the current sweep.
+  const LineOfSightCore *shared_sweep;   // The sweep the view is clipped from, if any.
+  SweepGenerator sweep;                  // The directions of the rays of the sweep.
+  StringName position_key;               // The key of the hit position in ray results.
+  StringName collider_id_key;            // The key of the collider instance id in ray results.
+  StringName normal_key;                 // The key of the hit normal in ray results.
+
+  LocalVector<Vector> view_points_from;  // The start of each view point, relative to the origin.
+  LocalVector<Vector> view_points_to;    // The end of each view point, relative to the origin.
+  LocalVector<double> view_offsets;      // The angle of each view point from the first step.
+
+  bool indexed_mesh;                     // Whether to build an indexed mesh of the view.
+  double simplify_tolerance;             // How far the simplified outline may be from the view.
+  LocalVector<Vector> mesh_vertices;     // The vertices of the indexed mesh, from the origin.
+  LocalVector<int32_t> mesh_indices;     // The triangles of the indexed mesh.
+  int mesh_vertices_unsimplified;        // The vertices of the indexed mesh before simplifying.
+  LocalVector<uint32_t> outer_kept;      // The view points kept on the outline.
+  LocalVector<uint32_t> inner_kept;      // The view points kept at the start of the rays.
+  LocalVector<uint8_t> simplify_keep;    // Whether each point is kept, while simplifying.
+  LocalVector<uint32_t> simplify_stack;  // The ranges of points left to simplify.
+
+  LocalVector<float> view_distances;  // The distance of the view along every step of the sweep.
+  double distance_start_angle;        // The angle of the first step in the plane of the sweep.
+
+  InterpolationTick interpolation_ticks[2];   // The distance views of the last two physics ticks.
+  int interpolation_last;                     // The index of the last tick.
+  int interpolation_tick_count;               // The ticks kept since the last reset, up to 2.
+  LocalVector<float> interpolated_distances;  // The distances blended for the rendered frame.
+  LocalVector<Vector> interpolated_from;      // The start of the blended view points.
+  LocalVector<Vector> interpolated_to;        // The end of the blended view points.
+
+  LocalVector<Vector2> grid_polygon;                      // The view in the plane of the grid.
+  LocalVector<LineOfSightGrid::Crossing> grid_crossings;  // The buffer of the rasterizer.
+  LocalVector<LineOfSightGrid::Span> grid_spans;          // The cells seen by the last sweep.
+
+  /// @brief Clear the view points and the counters of the last sweep.
+  /// @param p_step_count The number of steps of the sweep, to reserve the view points.
+  void begin_sweep(const int p_step_count) {
+    // Clearing keeps the capacity, so the buffers only grow during the first sweeps.
+    view_points_from.clear();
+    view_points_to.clear();
+    view_points_from.reserve(p_step_count + 1);
+    view_points_to.reserve(p_step_count + 1);
+    rays_cast = 0;
+    edges_resolved = 0;
+    bisection_rays = 0;
+    ray_cache_cursor = 0;
+    ray_cache_hits = 0;
+    ray_cache_misses = 0;
+  }
+
+  /// @brief Create a raycast from the center of the circle to the point in the given direction.
+  /// @param p_direction The global direction of the ray in the plane of the sweep, of length 1.
+  /// @return A ViewCastInfo object containing the information about the raycast.
+  ViewCastInfo view_cast(const Vector2 &p_direction) {
+    Vector direction = Traits::to_vector(p_direction);
+    Vector from = sweep_origin + direction * distance_from_origin;
+    Vector to = sweep_origin + direction * radius;
+    rays_cast++;
+
+    if (tiles != nullptr) {
+      real_t fraction = 0;
+      if (tiles->intersect_ray(Traits::to_plane(from), Traits::to_plane(to), fraction)) {
+        Vector position = from + (to - from) * fraction;
+        return ViewCastInfo(true, from, position, position.distance_to(from), p_direction);
+      }
+      return ViewCastInfo(false, from, to, radius, p_direction);
+    }
+
+    if (occluder_index != nullptr) {
+      Vector position;
+      if (occluder_index->intersect_ray(from, to, collision_mask, index_exclude, position)) {
+        return ViewCastInfo(true, from, position, position.distance_to(from), p_direction);
+      }
+      return ViewCastInfo(false, from, to, radius, p_direction);
+    }
+
+    ray_query->set_from(from);
+    ray_query->set_to(to);
+    Dictionary dict = space_state->intersect_ray(ray_query);
+
+    // An empty result means the ray did not hit anything.
+    if (!dict.is_empty()) {
+      Vector position = dict[position_key];
+      if (use_ray_cache) {
+        // The cache predicts the rays hitting the same side of the same collider.
+        return ViewCastInfo(
+            true, from, position, position.distance_to(from), p_direction,
+            (uint64_t)dict[collider_id_key], (Vector)dict[normal_key]
+        );
+      }
+      return ViewCastInfo(true, from, position, position.distance_to(from), p_direction);
+    } else {
+      return ViewCastInfo(false, from, to, radius, p_direction);
+    }
+  }
+
+  /// @brief Cast every ray of the sweep in one pass, reusing the same ray query.
+  void view_cast_batch() {
+    int count = sweep.get_step_count() + 1;
+    view_casts.resize(count);
+    for (int i = 0; i < count; i++) {
+      view_casts[i] = view_cast_step(i);
+    }
+  }
+
+  /// @brief Cast the ray of a step of the sweep. Around a full circle, the last step reuses the
+  /// first ray, which must already be cast, so the view closes exactly and the edge across the
+  /// seam is resolved like any other.
+  ViewCastInfo view_cast_step(const int p_step) {
+    if (p_step > 0 && p_step == sweep.get_step_count() && sweep.is_full_circle()) {
+      return view_casts[0];
+    }
+    Vector2 direction = sweep.get_direction(p_step);
+    ViewCastInfo predicted_view_cast;
+    if (!ray_cache.is_empty()) {
+      if (predict_view_cast(direction, predicted_view_cast)) {
+        ray_cache_hits++;
+        return predicted_view_cast;
+      }
+      ray_cache_misses++;
+    }
+    return view_cast(direction);
+  }
+
+  /// @brief Drop the cached rays if the occluders or the parameters changed since they were cast,
+  /// or if the origin moved too far. Must run on the main thread, before the sweep.
+  /// @param p_occluders_hash The hash of the occluders around the origin.
+  /// @param p_parameters_changed Whether a parameter of the sweep changed.
+  void check_ray_cache(const uint32_t p_occluders_hash, const bool p_parameters_changed) {
+    bool moved = sweep_origin.distance_to(ray_cache_origin) > ray_cache_tolerance;
+    if (!use_ray_cache || p_parameters_changed || p_occluders_hash != ray_cache_hash || moved) {
+      ray_cache.clear();
+    }
+    ray_cache_hash = p_occluders_hash;
+  }
+
+  /// @brief Keep the rays of the sweep, to predict the rays of the next one.
+  void store_ray_cache() {
+    // The cache can't tell the colliders apart without the physics results.
+    if (!use_ray_cache || tiles != nullptr || occluder_index != nullptr) {
+      ray_cache.clear();
+      return;
+    }
+    ray_cache = view_casts;
+    ray_cache_origin = sweep_origin;
+  }
+
+  /// @brief Predict a ray from the two cached rays around it, without a physics query. This only
+  /// holds if they hit the same flat side of a collider, or if they both missed and the origin
+  /// didn't move, since no occluder moved since then. The prediction isn't tested against the
+  /// shape of the collider: an occluder between the two cached rays is only found once the ray is
+  /// cast again, after RAY_CACHE_MAX_AGE sweeps at most.
+  /// @param r_view_cast The predicted ray.
+  /// @return Whether the ray is predicted, false if it must be cast.
+  bool predict_view_cast(const Vector2 &p_direction, ViewCastInfo &r_view_cast) {
+    // The rays of a sweep go by increasing angles, so the cursor only moves forward.
+    Vector2 origin = Traits::to_plane(sweep_origin);
+    while (ray_cache_cursor + 2 < ray_cache.size()) {
+      Vector2 next = Traits::to_plane(ray_cache[ray_cache_cursor + 1].point) - origin;
+      if (next.cross(p_direction) <= 0) {
+        break;
+      }
+      ray_cache_cursor++;
+    }
+    const ViewCastInfo &min_view_cast = ray_cache[ray_cache_cursor];
+    const ViewCastInfo &max_view_cast = ray_cache[MIN(ray_cache_cursor + 1, ray_cache.size() - 1)];
+
+    // Predictions of predictions may miss occluders revealed by the moves since the rays were cast.
+    int age = MAX(min_view_cast.age, max_view_cast.age) + 1;
+    if (age > RAY_CACHE_MAX_AGE) {
+      return false;
+    }
+
+    Vector direction = Traits::to_vector(p_direction);
+    Vector from = sweep_origin + direction * distance_from_origin;
+    Vector to = sweep_origin + direction * radius;
+
+    if (!min_view_cast.hit && !max_view_cast.hit) {
+      bool between = min_view_cast.direction.cross(p_direction) >= 0 &&
+                     p_direction.cross(max_view_cast.direction) >= 0;
+      if (sweep_origin != ray_cache_origin || !between) {
+        return false;
+      }
+      r_view_cast = ViewCastInfo(false, from, to, radius, p_direction);
+    } else {
+      bool same_side = min_view_cast.hit && max_view_cast.hit && min_view_cast.collider_id != 0 &&
+                       min_view_cast.collider_id == max_view_cast.collider_id &&
+                       min_view_cast.normal.is_equal_approx(max_view_cast.normal);
+      // Parallel sides of one collider, like steps, share a normal: hits at different distances
+      // may be on two of them.
+      if (!same_side ||
+          Math::abs(min_view_cast.distance - max_view_cast.distance) > ray_cache_tolerance) {
+        return false;
+      }
+
+      // Intersect the ray with the side, between the points of the cached rays.
+      Vector2 ray = Traits::to_plane(to - from);
+      Vector2 side = Traits::to_plane(max_view_cast.point - min_view_cast.point);
+      Vector2 offset = Traits::to_plane(min_view_cast.point - from);
+      double denominator = ray.cross(side);
+      if (Traits::to_plane(min_view_cast.normal).dot(ray) >= 0 ||
+          Math::abs(denominator) < CMP_EPSILON) {
+        return false;
+      }
+      double fraction = offset.cross(side) / denominator;
+      double side_fraction = offset.cross(ray) / denominator;
+      if (fraction < 0 || fraction > 1 || side_fraction < 0 || side_fraction > 1) {
+        return false;
+      }
+
+      Vector position = from + (to - from) * fraction;
+      r_view_cast = ViewCastInfo(
+          true, from, position, position.distance_to(from), p_direction, min_view_cast.collider_id,
+          min_view_cast.normal
+      );
+    }
+
+    r_view_cast.age = age;
+    return true;
+  }
+
+  /// @brief Find the edge of the object that is between the two given view cast points.
+  /// @param p_min_view_cast The first view cast point.
+  /// @param p_max_view_cast The second view cast point.
+  /// @return An EdgeInfo object containing the information about the edge of the object.
+  EdgeInfo find_edge(const ViewCastInfo &p_min_view_cast, const ViewCastInfo &p_max_view_cast) {
+    edges_resolved++;
+    Vector2 min_direction = p_min_view_cast.direction;
+    Vector2 max_direction = p_max_view_cast.direction;
+    Vector min_point = Vector();
+    Vector max_point = Vector();
+
+    for (int i = 0; i < edge_resolve_iterations; i++) {
+      Vector2 direction = SweepGenerator::get_bisector(min_direction, max_direction);
+      ViewCastInfo new_view_cast = view_cast(direction);
+      bisection_rays++;
+
+      bool edge_distance_threshold_exceeded =
+          Math::abs(p_min_view_cast.distance - new_view_cast.distance) > edge_distance_threshold;
+
+      if (new_view_cast.hit == p_min_view_cast.hit && !edge_distance_threshold_exceeded) {
+        min_direction = direction;
+        min_point = new_view_cast.point;
+      } else {
+        max_direction = direction;
+        max_point = new_view_cast.point;
+      }
+    }
+
+    return EdgeInfo(min_point, max_point);
+  }
+
+  /// @brief Find the edge between two rays at the corner of a tile, instead of bisecting it.
+  /// @return Whether the corner is found, false to fall back to find_edge().
+  bool find_tile_edge(
+      const ViewCastInfo &p_min_view_cast, const ViewCastInfo &p_max_view_cast, EdgeInfo &r_edge
+  ) {
+    // The corner is on the wall hit by the nearest ray, and the other ray sees past it.
+    bool min_is_near =
+        p_min_view_cast.hit &&
+        (!p_max_view_cast.hit || p_min_view_cast.distance < p_max_view_cast.distance);
+    const ViewCastInfo &near_view_cast = min_is_near ? p_min_view_cast : p_max_view_cast;
+    const ViewCastInfo &far_view_cast = min_is_near ? p_max_view_cast : p_min_view_cast;
+    int turn = min_is_near ? 1 : -1;
+
+    Vector2 origin = Traits::to_plane(sweep_origin);
+    Vector2 corner;
+    bool found = tiles->find_corner(
+        origin, Traits::to_plane(near_view_cast.point), Traits::to_plane(far_view_cast.point), turn,
+        corner
+    );
+    Vector2 offset = corner - origin;
+    double corner_distance = offset.length();
+    if (!found || corner_distance <= distance_from_origin) {
+      return false;
+    }
+
+    // Cast a ray just past the corner, which also tells whether something hides the corner.
+    Vector2 direction = offset / corner_distance;
+    Vector2 side = Vector2(-direction.y, direction.x) * turn;
+    ViewCastInfo past_view_cast = view_cast((direction + side * 1e-4).normalized());
+    bisection_rays++;
+    if (past_view_cast.distance < corner_distance - distance_from_origin - 0.01) {
+      return false;
+    }
+
+    edges_resolved++;
+    Vector corner_point = sweep_origin + Traits::to_vector(offset);
+    if (min_is_near) {
+      r_edge = EdgeInfo(corner_point, past_view_cast.point);
+    } else {
+      r_edge = EdgeInfo(past_view_cast.point, corner_point);
+    }
+    return true;
+  }
+
+  /// @brief Whether the obstacle changes between two rays, so an edge lies between them.
+  bool is_edge_between(
+      const ViewCastInfo &p_min_view_cast, const ViewCastInfo &p_max_view_cast
+  ) const {
+    bool edge_distance_threshold_exceeded =
+        Math::abs(p_min_view_cast.distance - p_max_view_cast.distance) > edge_distance_threshold;
+
+    bool diff_hit = p_min_view_cast.hit != p_max_view_cast.hit;
+    bool both_hit = p_min_view_cast.hit && p_max_view_cast.hit;
+    return diff_hit || (both_hit && edge_distance_threshold_exceeded);
+  }
+
+  /// @brief Resolve the edge between two rays and add its view points.
+  void add_edge(const ViewCastInfo &p_min_view_cast, const ViewCastInfo &p_max_view_cast) {
+    EdgeInfo edge;
+    if (tiles == nullptr || !find_tile_edge(p_min_view_cast, p_max_view_cast, edge)) {
+      edge = find_edge(p_min_view_cast, p_max_view_cast);
+    }
+    if (edge.point_A != Vector()) {
+      view_points_from.push_back(p_max_view_cast.origin - sweep_origin);
+      view_points_to.push_back(edge.point_A - sweep_origin);
+    }
+    if (edge.point_B != Vector()) {
+      view_points_from.push_back(p_max_view_cast.origin - sweep_origin);
+      view_points_to.push_back(edge.point_B - sweep_origin);
+    }
+  }
+
+  /// @brief Sample the cone with raycasts, resolving the edges between them.
+  /// @param p_angle The angle of the cone in degrees.
+  /// @param p_step_count The number of steps between the first and the last ray.
+  void sweep_raycast(const double p_angle, const int p_step_count) {
+    sweep.set_cone(p_angle, p_step_count);
+    sweep.set_rotation(sweep_rotation);
+
+    if (adaptive_subdivisions > 0) {
+      sweep_adaptive();
+      store_ray_cache();
+      return;
+    }
+
+    view_cast_batch();
+    store_ray_cache();
+
+    for (int i = 0; i <= p_step_count; i++) {
+      const ViewCastInfo &view_cast_info = view_casts[i];
+
+      // If we already have a previous view cast, check if the current view cast is different.
+      if (i > 0 && is_edge_between(view_casts[i - 1], view_cast_info)) {
+        add_edge(view_casts[i - 1], view_cast_info);
+      }
+
+      view_points_from.push_back(view_cast_info.origin - sweep_origin);
+      view_points_to.push_back(view_cast_info.point - sweep_origin);
+    }
+  }
+
+  /// @brief Sample the cone with a coarse sweep, then refine the intervals where the view changes.
+  void sweep_adaptive() {
+    int step_count = sweep.get_step_count();
+    int stride = 1 << adaptive_subdivisions;
+    int coarse_count = (step_count + stride - 1) / stride;
+
+    view_casts.resize(coarse_count + 1);
+    for (int i = 0; i <= coarse_count; i++) {
+      view_casts[i] = view_cast_step(MIN(i * stride, step_count));
+    }
+
+    view_points_from.push_back(view_casts[0].origin - sweep_origin);
+    view_points_to.push_back(view_casts[0].point - sweep_origin);
+    for (int i = 0; i < coarse_count; i++) {
+      refine_interval(
+          view_casts[i], view_casts[i + 1], i * stride, MIN((i + 1) * stride, step_count)
+      );
+    }
+  }
+
+  /// @brief Add the view points up to the second of two rays, halving the interval while it
+  /// holds an edge. Rays are only cast at the angles of the regular sweep.
+  /// @param p_min_index The index of the first ray in the regular sweep.
+  /// @param p_max_index The index of the second ray in the regular sweep.
+  void refine_interval(
+      const ViewCastInfo &p_min_view_cast, const ViewCastInfo &p_max_view_cast,
+      const int p_min_index, const int p_max_index
+  ) {
+    bool edge = is_edge_between(p_min_view_cast, p_max_view_cast);
+    if (edge && p_max_index - p_min_index > 1) {
+      int middle_index = (p_min_index + p_max_index) / 2;
+      ViewCastInfo middle_view_cast = view_cast(sweep.get_direction(middle_index));
+      refine_interval(p_min_view_cast, middle_view_cast, p_min_index, middle_index);
+      refine_interval(middle_view_cast, p_max_view_cast, middle_index, p_max_index);
+      return;
+    }
+
+    if (edge) {
+      add_edge(p_min_view_cast, p_max_view_cast);
+    } else if (!p_min_view_cast.hit && !p_max_view_cast.hit) {
+      // Nothing is hit on either side, so the outer arc is drawn without casting the rays.
+      for (int i = p_min_index + 1; i < p_max_index; i++) {
+        Vector direction = Traits::to_vector(sweep.get_direction(i));
+        view_points_from.push_back(direction * distance_from_origin);
+        view_points_to.push_back(direction * radius);
+      }
+    }
+
+    view_points_from.push_back(p_max_view_cast.origin - sweep_origin);
+    view_points_to.push_back(p_max_view_cast.point - sweep_origin);
+  }
+
+  /// @brief Measure the angle of every view point from the first step of the sweep, so that the
+  /// views of other sweeps can be clipped from it.
+  void build_view_offsets() {
+    view_offsets.resize(view_points_to.size());
+    Vector2 start = sweep.get_direction(0);
+    double previous = 0;
+    for (uint32_t i = 0; i < view_points_to.size(); i++) {
+      double offset =
+          Math::deg_to_rad(sweep.get_angle_to(start, Traits::to_plane(view_points_to[i])));
+      // The points go by increasing angles: a point just before the start is rounded back to it,
+      // and the points of a full circle past half a turn are turned once.
+      if (offset < previous - Math_PI) {
+        offset += Math_TAU;
+      }
+      offset = MAX(offset, previous);
+      view_offsets[i] = offset;
+      previous = offset;
+    }
+  }
+
+  /// @brief Get the angle of a view point from the first step, counting the turns of a full circle
+  /// whose points repeat every p_period points.
+  double get_unrolled_offset(const uint32_t p_index, const uint32_t p_period) const {
+    return view_offsets[p_index % p_period] + Math_TAU * (p_index / p_period);
+  }
+
+  /// @brief Add a view point in the plane of the sweep, kept between the start and the end of the
+  /// rays of this view.
+  void add_clipped_view_point(const Vector2 &p_point) {
+    double length = p_point.length();
+    Vector2 direction = length > 0 ? p_point / length : Vector2();
+    double distance = CLAMP(length, distance_from_origin, radius);
+    view_points_from.push_back(Traits::to_vector(direction * distance_from_origin));
+    view_points_to.push_back(Traits::to_vector(direction * distance));
+  }
+
+  /// @brief Clip the view of the shared sweep to the cone of this sweep, instead of casting rays.
+  /// The points of the shared view inside the cone are kept, and the view is seen from its origin.
+  /// @param p_angle The angle of the cone in degrees.
+  void sweep_shared(const double p_angle) {
+    const LineOfSightCore &shared = *shared_sweep;
+    sweep_origin = shared.sweep_origin;
+    const LocalVector<Vector> &points = shared.view_points_to;
+    uint32_t count = points.size();
+    if (count < 2) {
+      return;
+    }
+
+    sweep.set_cone(p_angle, 1);
+    sweep.set_rotation(sweep_rotation);
+    Vector2 first_direction = sweep.get_direction(0);
+    Vector2 last_direction = sweep.get_direction(1);
+
+    // The cone in angles from the first step of the shared sweep. A cone starting with it may be
+    // rounded to just before it.
+    Vector2 shared_start = shared.sweep.get_direction(0);
+    double first = Math::fposmod(
+        Math::deg_to_rad(shared.sweep.get_angle_to(shared_start, first_direction)), Math_TAU
+    );
+    if (first > shared.view_offsets[count - 1]) {
+      first = 0;
+    }
+    double last = first + Math::deg_to_rad(p_angle);
+
+    // Around a full circle the last point closes the view on the first one and the cone may wrap
+    // past it, so the points are walked as if they repeated after it.
+    uint32_t period = shared.sweep.is_full_circle() ? count - 1 : count;
+    uint32_t unrolled_count = period < count ? period * 2 + 1 : count;
+
+    uint32_t i = 0;
+    while (i + 2 < unrolled_count && shared.get_unrolled_offset(i + 1, period) <= first) {
+      i++;
+    }
+    Vector2 a = Traits::to_plane(points[i % period]);
+    Vector2 b = Traits::to_plane(points[(i + 1) % period]);
+    add_clipped_view_point(first_direction * get_outline_distance(a, b, first_direction));
+
+    while (i + 2 < unrolled_count && shared.get_unrolled_offset(i + 1, period) < last) {
+      i++;
+      add_clipped_view_point(Traits::to_plane(points[i % period]));
+    }
+    a = Traits::to_plane(points[i % period]);
+    b = Traits::to_plane(points[(i + 1) % period]);
+    add_clipped_view_point(last_direction * get_outline_distance(a, b, last_direction));
+  }
+
+  /// @brief Set up a sweep shared by several views standing close together, from the first of
+  /// them, once they are all prepared.
+  void begin_shared_sweep(const LineOfSightCore &p_leader) {
+    space_state = p_leader.space_state;
+    occluder_index = p_leader.occluder_index;
+    tiles = nullptr;
+    sweep_origin = p_leader.sweep_origin;
+    collision_mask = p_leader.collision_mask;
+    edge_resolve_iterations = p_leader.edge_resolve_iterations;
+    edge_distance_threshold = p_leader.edge_distance_threshold;
+    adaptive_subdivisions = p_leader.adaptive_subdivisions;
+    distance_from_origin = p_leader.distance_from_origin;
+    radius = p_leader.radius;
+    sweep.set_deterministic(p_leader.sweep.is_deterministic());
+    ray_query->set_collision_mask(collision_mask);
+    ray_query->set_exclude(TypedArray<RID>());
+    index_exclude.clear();
+  }
+
+  /// @brief Cover a view with the shared sweep: it reaches as far as every view, and ignores the
+  /// bodies ignored by any of them, such as the bodies carrying them.
+  void add_to_shared_sweep(const LineOfSightCore &p_view) {
+    edge_resolve_iterations = MAX(edge_resolve_iterations, p_view.edge_resolve_iterations);
+    edge_distance_threshold = MIN(edge_distance_threshold, p_view.edge_distance_threshold);
+    adaptive_subdivisions = MIN(adaptive_subdivisions, p_view.adaptive_subdivisions);
+    distance_from_origin = MIN(distance_from_origin, p_view.distance_from_origin);
+    radius = MAX(radius, p_view.radius);
+
+    TypedArray<RID> exclude = ray_query->get_exclude();
+    exclude.append_array(p_view.ray_query->get_exclude());
+    ray_query->set_exclude(exclude);
+    for (uint32_t i = 0; i < p_view.index_exclude.size(); i++) {
+      index_exclude.push_back(p_view.index_exclude[i]);
+    }
+  }
+
+  /// @brief Whether a point is in the view of the last sweep, without casting a ray. The view must
+  /// have been swept around its origin.
+  /// @param p_point The point in the plane of the sweep, in global coordinates.
+  bool is_in_view(const Vector2 &p_point) const {
+    Vector2 point = p_point - Traits::to_plane(sweep_origin);
+    if (point.length() < distance_from_origin) {
+      return false;
+    }
+
+    for (uint32_t i = 0; i + 1 < view_points_to.size(); i++) {
+      // The points are less than half a turn apart, so the wedge between them is convex.
+      Vector2 a = Traits::to_plane(view_points_to[i]);
+      Vector2 b = Traits::to_plane(view_points_to[i + 1]);
+      if (a.cross(point) < 0 || point.cross(b) < 0) {
+        continue;
+      }
+      // The point is seen if it is on the same side of the outline as the origin.
+      Vector2 side = b - a;
+      if (side.cross(point - a) * side.cross(-a) > 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// @brief Get the distance from the origin at which a direction crosses a segment of the outline.
+  static double get_outline_distance(
+      const Vector2 &p_a, const Vector2 &p_b, const Vector2 &p_direction
+  ) {
+    Vector2 side = p_b - p_a;
+    double denominator = p_direction.cross(side);
+    return Math::abs(denominator) > CMP_EPSILON ? p_a.cross(side) / denominator : p_a.length();
+  }
+
+  /// @brief Get the distance from a point to a segment.
+  static double distance_to_segment(const Vector &p_point, const Vector &p_a, const Vector &p_b) {
+    Vector segment = p_b - p_a;
+    double length_squared = segment.length_squared();
+    double t = length_squared > 0 ? CLAMP((p_point - p_a).dot(segment) / length_squared, 0.0, 1.0)
+                                  : 0.0;
+    return p_point.distance_to(p_a + segment * t);
+  }
+
+  /// @brief Simplify a polyline with Douglas-Peucker, keeping its ends.
+  /// @param p_points The points of the polyline.
+  /// @param r_kept The indices of the points kept, in order.
+  void simplify_polyline(const LocalVector<Vector> &p_points, LocalVector<uint32_t> &r_kept) {
+    uint32_t count = p_points.size();
+    simplify_keep.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+      simplify_keep[i] = i == 0 || i == count - 1;
+    }
+
+    // The ranges are kept on a stack, so long walls don't recurse deeply.
+    simplify_stack.clear();
+    simplify_stack.push_back(0);
+    simplify_stack.push_back(count - 1);
+    while (!simplify_stack.is_empty()) {
+      uint32_t last = simplify_stack[simplify_stack.size() - 1];
+      uint32_t first = simplify_stack[simplify_stack.size() - 2];
+      simplify_stack.resize(simplify_stack.size() - 2);
+
+      double max_distance = 0;
+      uint32_t farthest = first;
+      for (uint32_t i = first + 1; i < last; i++) {
+        double distance = distance_to_segment(p_points[i], p_points[first], p_points[last]);
+        if (distance > max_distance) {
+          max_distance = distance;
+          farthest = i;
+        }
+      }
+      // Points exactly on the segment are dropped even without a tolerance.
+      if (farthest != first && max_distance > simplify_tolerance) {
+        simplify_keep[farthest] = 1;
+        simplify_stack.push_back(first);
+        simplify_stack.push_back(farthest);
+        simplify_stack.push_back(farthest);
+        simplify_stack.push_back(last);
+      }
+    }
+
+    r_kept.clear();
+    for (uint32_t i = 0; i < count; i++) {
+      if (simplify_keep[i]) {
+        r_kept.push_back(i);
+      }
+    }
+  }
+
+  /// @brief Build an indexed mesh of the view points of the last sweep, with their outline and
+  /// the start of their rays simplified. Without distance_from_origin, every ray starts at the
+  /// same vertex and the mesh is a fan.
+  void build_indexed_view() {
+    mesh_vertices.clear();
+    mesh_indices.clear();
+    mesh_vertices_unsimplified = 0;
+    uint32_t count = view_points_to.size();
+    if (count < 2) {
+      return;
+    }
+
+    simplify_polyline(view_points_to, outer_kept);
+    inner_kept.clear();
+    if (distance_from_origin > 0) {
+      simplify_polyline(view_points_from, inner_kept);
+      mesh_vertices_unsimplified = count * 2;
+    } else {
+      inner_kept.push_back(0);
+      mesh_vertices_unsimplified = count + 1;
+    }
+
+    // The outline first, then the start of the rays.
+    for (uint32_t i = 0; i < outer_kept.size(); i++) {
+      mesh_vertices.push_back(view_points_to[outer_kept[i]]);
+    }
+    int32_t inner_offset = outer_kept.size();
+    for (uint32_t i = 0; i < inner_kept.size(); i++) {
+      mesh_vertices.push_back(inner_kept.size() > 1 ? view_points_from[inner_kept[i]] : Vector());
+    }
+
+    // Zip both lines together by ray, with the winding of the triangle strip.
+    uint32_t outer = 0;
+    uint32_t inner = 0;
+    while (outer + 1 < outer_kept.size() || inner + 1 < inner_kept.size()) {
+      bool advance_outer = inner + 1 >= inner_kept.size() ||
+                           (outer + 1 < outer_kept.size() &&
+                            outer_kept[outer + 1] <= inner_kept[inner + 1]);
+      if (advance_outer) {
+        mesh_indices.push_back(outer);
+        mesh_indices.push_back(outer + 1);
+        mesh_indices.push_back(inner_offset + inner);
+        outer++;
+      } else {
+        mesh_indices.push_back(inner_offset + inner);
+        mesh_indices.push_back(outer);
+        mesh_indices.push_back(inner_offset + inner + 1);
+        inner++;
+      }
+    }
+  }
+
+  /// @brief Sample the distance of the view along every step of the sweep, for the distance
+  /// texture. The outline is straight between two view points, like the edges of the mesh.
+  /// @param p_angle The angle of the cone in degrees.
+  /// @param p_step_count The number of steps between the first and the last sample.
+  void build_distance_view(const double p_angle, const int p_step_count) {
+    view_distances.clear();
+    uint32_t count = view_points_to.size();
+    if (count < 2) {
+      return;
+    }
+
+    // The analytic sweeps don't go through the sweep generator, so set it up here.
+    sweep.set_cone(p_angle, p_step_count);
+    sweep.set_rotation(sweep_rotation);
+    distance_start_angle = Math::deg_to_rad(sweep.get_angle(sweep.get_direction(0)));
+
+    view_distances.resize(p_step_count + 1);
+    uint32_t segment = 0;
+    for (int i = 0; i <= p_step_count; i++) {
+      Vector2 direction = sweep.get_direction(i);
+      // The view points go by increasing angles, so the segment only moves forward.
+      while (segment + 2 < count &&
+             Traits::to_plane(view_points_to[segment + 1]).cross(direction) > 0) {
+        segment++;
+      }
+
+      // Intersect the step with the segment of the outline around it.
+      double distance = get_outline_distance(
+          Traits::to_plane(view_points_to[segment]), Traits::to_plane(view_points_to[segment + 1]),
+          direction
+      );
+      view_distances[i] = CLAMP(distance, 0.0, radius);
+    }
+  }
+
+  /// @brief Keep the distance view of the last sweep as the view of the last physics tick.
+  /// @param p_angle The angle of the cone in degrees.
+  void push_interpolation_tick(const double p_angle) {
+    interpolation_last = 1 - interpolation_last;
+    InterpolationTick &tick = interpolation_ticks[interpolation_last];
+    tick.distances = view_distances;
+    tick.origin = sweep_origin;
+    tick.rotation = sweep_rotation;
+    tick.angle = p_angle;
+    interpolation_tick_count = MIN(interpolation_tick_count + 1, 2);
+  }
+
+  /// @brief Keep the view of the last physics tick again, when the tick didn't sweep because
+  /// nothing changed, so the rendered frames stop blending it with an older one.
+  void repeat_interpolation_tick() {
+    if (interpolation_tick_count == 0) {
+      return;
+    }
+    interpolation_last = 1 - interpolation_last;
+    interpolation_ticks[interpolation_last] = interpolation_ticks[1 - interpolation_last];
+  }
+
+  /// @brief Forget the kept ticks, so the next view is drawn without blending it with an old one.
+  void reset_interpolation() { interpolation_tick_count = 0; }
+
+  /// @brief Blend the distance views of the last two physics ticks into interpolated_distances,
+  /// and the view points along their steps. The view is drawn one tick behind, like the
+  /// physics interpolation of the engine, so it never runs ahead of the last simulated step.
+  /// @param p_fraction How far the rendered frame is from the tick before the last one to the last.
+  /// @param r_origin The blended global position of the sweep.
+  /// @return Whether there is a view to draw, false before the first tick.
+  bool interpolate_view(const double p_fraction, Vector &r_origin) {
+    if (interpolation_tick_count == 0) {
+      return false;
+    }
+    const InterpolationTick &last = interpolation_ticks[interpolation_last];
+    const InterpolationTick &previous = interpolation_ticks[1 - interpolation_last];
+    uint32_t count = last.distances.size();
+    if (count < 2) {
+      interpolated_distances.clear();
+      return true;
+    }
+
+    // A cone which changed between the ticks doesn't have the same steps, so it isn't blended.
+    double fraction = CLAMP(p_fraction, 0.0, 1.0);
+    if (interpolation_tick_count < 2 || previous.angle != last.angle ||
+        previous.distances.size() != count) {
+      fraction = 1;
+    }
+    const InterpolationTick &from = fraction < 1 ? previous : last;
+    r_origin = from.origin.lerp(last.origin, fraction);
+    double rotation =
+        from.rotation + Math::wrapf(last.rotation - from.rotation, -180.0, 180.0) * fraction;
+
+    sweep.set_cone(last.angle, count - 1);
+    sweep.set_rotation(rotation);
+    distance_start_angle = Math::deg_to_rad(sweep.get_angle(sweep.get_direction(0)));
+
+    interpolated_distances.resize(count);
+    interpolated_from.resize(count);
+    interpolated_to.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+      float distance = Math::lerp(from.distances[i], last.distances[i], (float)fraction);
+      Vector direction = Traits::to_vector(sweep.get_direction(i));
+      interpolated_distances[i] = distance;
+      interpolated_from[i] = direction * distance_from_origin;
+      interpolated_to[i] = direction * MAX((double)distance, distance_from_origin);
+    }
+    return true;
+  }
+
+  /// @brief Rasterize the view points of the last sweep into the cells of a grid.
+  void rasterize_view(const LineOfSightGrid *p_grid) {
+    // The ends of the rays, then their starts backwards, outline the view.
+    grid_polygon.clear();
+    uint32_t count = view_points_to.size();
+    for (uint32_t i = 0; i < count; i++) {
+      grid_polygon.push_back(Traits::to_plane(sweep_origin + view_points_to[i]));
+    }
+    for (uint32_t i = count; i > 0; i--) {
+      grid_polygon.push_back(Traits::to_plane(sweep_origin + view_points_from[i - 1]));
+    }
+
+    grid_spans.clear();
+    if (count < 2) {
+      return;
+    }
+    p_grid->rasterize(grid_polygon, grid_crossings, grid_spans);
+  }
+
+  LineOfSightCore() {
+    edge_resolve_iterations = 5;
+    edge_distance_threshold = 0;
+    distance_from_origin = 0;
+    radius = 0;
+    collision_mask = UINT32_MAX;
+    adaptive_subdivisions = 0;
+
+    rays_cast = 0;
+    edges_resolved = 0;
+    bisection_rays = 0;
+
+    indexed_mesh = false;
+    simplify_tolerance = 0;
+    mesh_vertices_unsimplified = 0;
+    distance_start_angle = 0;
+    interpolation_last = 0;
+    interpolation_tick_count = 0;
+
+    use_ray_cache = false;
+    ray_cache_tolerance = 0;
+    ray_cache_hash = 0;
+    ray_cache_cursor = 0;
+    ray_cache_hits = 0;
+    ray_cache_misses = 0;
+
+    ray_query.instantiate();
+    space_state = nullptr;
+    occluder_index = nullptr;
+    tiles = nullptr;
+    shared_sweep = nullptr;
+    sweep_rotation = 0;
+    position_key = StringName("position");
+    collider_id_key = StringName("collider_id");
+    normal_key = StringName("normal");
+  }
+};
+
+#endif
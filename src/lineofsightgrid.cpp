@@ -0,0 +1,294 @@
+#include "lineofsightgrid.h"
+
+#include <godot_cpp/classes/rendering_server.hpp>
+#include <godot_cpp/core/class_db.hpp>
+#include <godot_cpp/core/math.hpp>
+
+#include <cstring>
+
+using namespace godot;
+
+void LineOfSightGrid::_bind_methods() {
+  ClassDB::bind_method(D_METHOD("get_size"), &LineOfSightGrid::get_size);
+  ClassDB::bind_method(D_METHOD("set_size", "p_size"), &LineOfSightGrid::set_size);
+  ClassDB::add_property(
+      "LineOfSightGrid", PropertyInfo(Variant::VECTOR2I, "size"), "set_size", "get_size"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_cell_size"), &LineOfSightGrid::get_cell_size);
+  ClassDB::bind_method(D_METHOD("set_cell_size", "p_cell_size"), &LineOfSightGrid::set_cell_size);
+  ClassDB::add_property(
+      "LineOfSightGrid",
+      PropertyInfo(Variant::FLOAT, "cell_size", PROPERTY_HINT_RANGE, "0.01,9999,0.01"),
+      "set_cell_size", "get_cell_size"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_origin"), &LineOfSightGrid::get_origin);
+  ClassDB::bind_method(D_METHOD("set_origin", "p_origin"), &LineOfSightGrid::set_origin);
+  ClassDB::add_property(
+      "LineOfSightGrid", PropertyInfo(Variant::VECTOR2, "origin"), "set_origin", "get_origin"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_cell_at", "p_point"), &LineOfSightGrid::get_cell_at);
+  ClassDB::bind_method(D_METHOD("get_cell", "p_cell"), &LineOfSightGrid::get_cell);
+  ClassDB::bind_method(
+      D_METHOD("is_cell_visible", "p_cell", "p_team_mask"), &LineOfSightGrid::is_cell_visible,
+      DEFVAL(0xFF)
+  );
+  ClassDB::bind_method(
+      D_METHOD("is_point_visible", "p_point", "p_team_mask"), &LineOfSightGrid::is_point_visible,
+      DEFVAL(0xFF)
+  );
+  ClassDB::bind_method(D_METHOD("get_texture"), &LineOfSightGrid::get_texture);
+  ClassDB::bind_method(D_METHOD("clear"), &LineOfSightGrid::clear);
+
+  ClassDB::bind_method(D_METHOD("_on_frame_pre_draw"), &LineOfSightGrid::_on_frame_pre_draw);
+}
+
+LineOfSightGrid::LineOfSightGrid() {
+  size = Vector2i(128, 128);
+  cell_size = 16;
+  origin = Vector2();
+  layout = 0;
+  reset_cells();
+
+  // Upload the cells changed during the frame once, right before it is drawn.
+  RenderingServer *rendering_server = RenderingServer::get_singleton();
+  if (rendering_server != nullptr) {
+    rendering_server->connect(
+        StringName("frame_pre_draw"), Callable(this, StringName("_on_frame_pre_draw"))
+    );
+  }
+}
+
+/// @brief Clear every cell and drop the spans of the nodes, which no longer match the grid.
+void LineOfSightGrid::reset_cells() {
+  cells.resize(size.x * size.y);
+  cells.fill(0);
+  contributions.clear();
+  pending_rect = Rect2i();
+  dirty_rect = Rect2i(Vector2i(), size);
+  layout++;
+
+  if (texture.is_valid()) {
+    image = Image::create(size.x, size.y, false, Image::FORMAT_R8);
+    texture->set_image(image);
+  }
+}
+
+void LineOfSightGrid::mark_pending(const Rect2i &p_rect) {
+  if (!p_rect.has_area()) {
+    return;
+  }
+  pending_rect = pending_rect.has_area() ? pending_rect.merge(p_rect) : p_rect;
+}
+
+/// @brief Compose the cells covered by the changed spans again.
+void LineOfSightGrid::compose() {
+  Rect2i rect = pending_rect.intersection(Rect2i(Vector2i(), size));
+  pending_rect = Rect2i();
+  if (!rect.has_area()) {
+    return;
+  }
+
+  // Only the cells which may have changed are cleared, not the whole grid.
+  uint8_t *data = cells.ptrw();
+  Vector2i end = rect.get_end();
+  for (int y = rect.position.y; y < end.y; y++) {
+    memset(data + y * size.x + rect.position.x, 0, rect.size.x);
+  }
+
+  for (const KeyValue<uint64_t, Contribution> &E : contributions) {
+    const Contribution &contribution = E.value;
+    if (!contribution.bounds.intersects(rect)) {
+      continue;
+    }
+    for (uint32_t i = 0; i < contribution.spans.size(); i++) {
+      const Span &span = contribution.spans[i];
+      if (span.y < rect.position.y || span.y >= end.y) {
+        continue;
+      }
+      int x_begin = MAX(span.x_begin, rect.position.x);
+      int x_end = MIN(span.x_end, end.x);
+      uint8_t *row = data + span.y * size.x;
+      for (int x = x_begin; x < x_end; x++) {
+        row[x] |= contribution.teams;
+      }
+    }
+  }
+
+  dirty_rect = dirty_rect.has_area() ? dirty_rect.merge(rect) : rect;
+}
+
+/// @brief Compose the pending cells and upload them if the texture is used and any changed.
+void LineOfSightGrid::update_texture() {
+  compose();
+  if (texture.is_null() || !dirty_rect.has_area()) {
+    return;
+  }
+
+  // Godot only uploads whole textures, so the dirty rect only saves the uploads of the frames
+  // where nothing changed.
+  image->set_data(size.x, size.y, false, Image::FORMAT_R8, cells);
+  texture->update(image);
+  dirty_rect = Rect2i();
+}
+
+void LineOfSightGrid::_on_frame_pre_draw() { update_texture(); }
+
+void LineOfSightGrid::set_size(const Vector2i &p_size) {
+  size = Vector2i(MAX(1, p_size.x), MAX(1, p_size.y));
+  reset_cells();
+  emit_changed();
+}
+
+Vector2i LineOfSightGrid::get_size() const { return size; }
+
+void LineOfSightGrid::set_cell_size(const double p_cell_size) {
+  cell_size = MAX(0.01, p_cell_size);
+  reset_cells();
+  emit_changed();
+}
+
+double LineOfSightGrid::get_cell_size() const { return cell_size; }
+
+void LineOfSightGrid::set_origin(const Vector2 &p_origin) {
+  origin = p_origin;
+  reset_cells();
+  emit_changed();
+}
+
+Vector2 LineOfSightGrid::get_origin() const { return origin; }
+
+/// @brief Get a number which changes when the spans of the nodes must be rasterized again.
+uint32_t LineOfSightGrid::get_layout() const { return layout; }
+
+/// @brief Get the cells whose center is inside a polygon. Safe to call from a worker thread.
+/// @param p_polygon The vertices of the polygon in global coordinates (X and Z in 3D).
+/// @param r_crossings A buffer reused between the calls.
+/// @param r_spans The covered cells, by row, appended to the spans already there.
+void LineOfSightGrid::rasterize(
+    const LocalVector<Vector2> &p_polygon, LocalVector<Crossing> &r_crossings,
+    LocalVector<Span> &r_spans
+) const {
+  r_crossings.clear();
+
+  // Find where every edge crosses the center line of the rows, in cell coordinates.
+  uint32_t count = p_polygon.size();
+  for (uint32_t i = 0; i < count; i++) {
+    Vector2 a = (p_polygon[i] - origin) / cell_size;
+    Vector2 b = (p_polygon[(i + 1) % count] - origin) / cell_size;
+    if (a.y == b.y) {
+      continue;
+    }
+    double y_min = MIN(a.y, b.y);
+    double y_max = MAX(a.y, b.y);
+    // The rows whose center is in [y_min, y_max), so a shared vertex is only counted once.
+    int row_begin = MAX(0, (int)Math::ceil(y_min - 0.5));
+    int row_end = MIN(size.y, (int)Math::ceil(y_max - 0.5));
+    double slope = (b.x - a.x) / (b.y - a.y);
+    for (int y = row_begin; y < row_end; y++) {
+      r_crossings.push_back({y, (float)(a.x + (y + 0.5 - a.y) * slope)});
+    }
+  }
+
+  if (r_crossings.is_empty()) {
+    return;
+  }
+  r_crossings.sort();
+
+  // The crossings of a row alternate between entering and leaving the polygon.
+  for (uint32_t i = 0; i + 1 < r_crossings.size(); i += 2) {
+    const Crossing &enter = r_crossings[i];
+    const Crossing &leave = r_crossings[i + 1];
+    int x_begin = MAX(0, (int)Math::ceil(enter.x - 0.5));
+    int x_end = MIN(size.x, (int)Math::ceil(leave.x - 0.5));
+    if (x_begin < x_end) {
+      r_spans.push_back({enter.y, x_begin, x_end});
+    }
+  }
+}
+
+/// @brief Replace the cells marked by a node. Must run on the main thread.
+/// @param p_owner The instance id of the node.
+/// @param p_teams The team bits set in the cells.
+/// @param p_spans The cells, rasterized with the current layout.
+void LineOfSightGrid::set_contribution(
+    const uint64_t p_owner, const int p_teams, const LocalVector<Span> &p_spans
+) {
+  if (p_spans.is_empty()) {
+    remove_contribution(p_owner);
+    return;
+  }
+
+  Contribution *contribution = contributions.getptr(p_owner);
+  if (contribution == nullptr) {
+    contribution = &contributions[p_owner];
+  } else {
+    mark_pending(contribution->bounds);
+  }
+
+  Vector2i min = Vector2i(p_spans[0].x_begin, p_spans[0].y);
+  Vector2i max = Vector2i(p_spans[0].x_end, p_spans[0].y + 1);
+  for (uint32_t i = 1; i < p_spans.size(); i++) {
+    min = Vector2i(MIN(min.x, p_spans[i].x_begin), MIN(min.y, p_spans[i].y));
+    max = Vector2i(MAX(max.x, p_spans[i].x_end), MAX(max.y, p_spans[i].y + 1));
+  }
+
+  contribution->teams = p_teams & 0xFF;
+  contribution->spans = p_spans;
+  contribution->bounds = Rect2i(min, max - min);
+  mark_pending(contribution->bounds);
+}
+
+/// @brief Clear the cells marked by a node. Must run on the main thread.
+void LineOfSightGrid::remove_contribution(const uint64_t p_owner) {
+  Contribution *contribution = contributions.getptr(p_owner);
+  if (contribution == nullptr) {
+    return;
+  }
+  mark_pending(contribution->bounds);
+  contributions.erase(p_owner);
+}
+
+/// @brief Get the cell containing a point in global coordinates (X and Z in 3D).
+Vector2i LineOfSightGrid::get_cell_at(const Vector2 &p_point) const {
+  Vector2 cell = (p_point - origin) / cell_size;
+  return Vector2i((int)Math::floor(cell.x), (int)Math::floor(cell.y));
+}
+
+/// @brief Get the bits of the teams which see a cell, 0 outside of the grid.
+int LineOfSightGrid::get_cell(const Vector2i &p_cell) {
+  if (p_cell.x < 0 || p_cell.y < 0 || p_cell.x >= size.x || p_cell.y >= size.y) {
+    return 0;
+  }
+  compose();
+  return cells[p_cell.y * size.x + p_cell.x];
+}
+
+/// @brief Whether a team of the mask sees a cell.
+bool LineOfSightGrid::is_cell_visible(const Vector2i &p_cell, const int p_team_mask) {
+  return (get_cell(p_cell) & p_team_mask) != 0;
+}
+
+/// @brief Whether a team of the mask sees the cell containing a point.
+bool LineOfSightGrid::is_point_visible(const Vector2 &p_point, const int p_team_mask) {
+  return is_cell_visible(get_cell_at(p_point), p_team_mask);
+}
+
+/// @brief Get a texture of the cells, whose red channel holds the team bits (`r * 255.0`).
+Ref<Texture2D> LineOfSightGrid::get_texture() {
+  if (texture.is_null()) {
+    image = Image::create(size.x, size.y, false, Image::FORMAT_R8);
+    texture = ImageTexture::create_from_image(image);
+    dirty_rect = Rect2i(Vector2i(), size);
+    update_texture();
+  }
+  return texture;
+}
+
+/// @brief Clear every cell, until the nodes sweep again.
+void LineOfSightGrid::clear() {
+  reset_cells();
+  emit_changed();
+}
@@ -0,0 +1,105 @@
+#ifndef LINEOFSIGHT_GRID_H
+#define LINEOFSIGHT_GRID_H
+
+#include <godot_cpp/classes/image.hpp>
+#include <godot_cpp/classes/image_texture.hpp>
+#include <godot_cpp/classes/resource.hpp>
+#include <godot_cpp/templates/hash_map.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+#include <godot_cpp/variant/packed_byte_array.hpp>
+#include <godot_cpp/variant/rect2i.hpp>
+#include <godot_cpp/variant/vector2.hpp>
+#include <godot_cpp/variant/vector2i.hpp>
+
+using namespace godot;
+
+/// @brief A grid of cells shared by line of sight nodes, which mark the cells they see.
+///
+/// Every cell holds one bit per team (8 teams). The nodes rasterize their view into runs of cells
+/// while they sweep, possibly on worker threads, then hand them to the grid when they commit. The
+/// grid only composes again the cells covered by the runs that changed, and refreshes its texture
+/// once per frame if any cell changed. 3D nodes use the X and Z coordinates.
+class LineOfSightGrid : public Resource {
+  GDCLASS(LineOfSightGrid, Resource)
+
+public:
+  // The cells [x_begin, x_end) of the row y.
+  struct Span {
+    int y;
+    int x_begin;
+    int x_end;
+  };
+
+  // A polygon edge crossing the center line of a row, used while rasterizing.
+  struct Crossing {
+    int y;
+    float x;
+
+    bool operator<(const Crossing &p_other) const {
+      return y != p_other.y ? y < p_other.y : x < p_other.x;
+    }
+  };
+
+private:
+  // The cells marked by one node.
+  struct Contribution {
+    uint8_t teams;            // The team bits set in the cells.
+    LocalVector<Span> spans;  // The cells, by runs.
+    Rect2i bounds;            // The cells covered by the spans.
+  };
+
+  Vector2i size;     // The number of cells along X and Y.
+  double cell_size;  // The size of a cell in world units.
+  Vector2 origin;    // The global position of the corner of the first cell.
+  uint32_t layout;   // Incremented when the cells no longer match the spans of the nodes.
+
+  PackedByteArray cells;                          // The team bits of every cell, row by row.
+  HashMap<uint64_t, Contribution> contributions;  // The cells marked by every node.
+  Rect2i pending_rect;                            // The cells to compose again.
+  Rect2i dirty_rect;                              // The cells changed since the last upload.
+
+  Ref<Image> image;           // The image holding the cells of the texture.
+  Ref<ImageTexture> texture;  // The texture, created when first requested.
+
+  void reset_cells();
+  void mark_pending(const Rect2i &p_rect);
+  void compose();
+  void update_texture();
+
+protected:
+  static void _bind_methods();
+
+public:
+  void set_size(const Vector2i &p_size);
+  Vector2i get_size() const;
+
+  void set_cell_size(const double p_cell_size);
+  double get_cell_size() const;
+
+  void set_origin(const Vector2 &p_origin);
+  Vector2 get_origin() const;
+
+  uint32_t get_layout() const;
+
+  void rasterize(
+      const LocalVector<Vector2> &p_polygon, LocalVector<Crossing> &r_crossings,
+      LocalVector<Span> &r_spans
+  ) const;
+  void set_contribution(
+      const uint64_t p_owner, const int p_teams, const LocalVector<Span> &p_spans
+  );
+  void remove_contribution(const uint64_t p_owner);
+
+  Vector2i get_cell_at(const Vector2 &p_point) const;
+  int get_cell(const Vector2i &p_cell);
+  bool is_cell_visible(const Vector2i &p_cell, const int p_team_mask);
+  bool is_point_visible(const Vector2 &p_point, const int p_team_mask);
+  Ref<Texture2D> get_texture();
+  void clear();
+
+  void _on_frame_pre_draw();
+
+  LineOfSightGrid();
+};
+
+#endif
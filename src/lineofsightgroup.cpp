@@ -0,0 +1,331 @@
+#include "lineofsightgroup.h"
+
+#include "lineofsightserver.h"
+
+#include <godot_cpp/classes/time.hpp>
+#include <godot_cpp/core/class_db.hpp>
+#include <godot_cpp/core/math.hpp>
+
+using namespace godot;
+
+/// @brief Start the sweep from the origin and the parameters of the leader of a cluster.
+void LineOfSightSharedSweep::begin(const LineOfSight2D &p_leader) { begin_shared_sweep(p_leader); }
+
+/// @brief Make the sweep reach as far as a member, and ignore the bodies it ignores.
+void LineOfSightSharedSweep::add(const LineOfSight2D &p_member) { add_to_shared_sweep(p_member); }
+
+/// @brief Cast the rays of the sweep, then measure the angles the members clip their views by.
+/// @param p_start The global rotation of the first step in degrees.
+/// @param p_angle The angle covered by the sweep in degrees.
+void LineOfSightSharedSweep::compute(
+    const double p_start, const double p_angle, const int p_step_count
+) {
+  begin_sweep(p_step_count);
+  sweep_rotation = p_start + p_angle / 2.0;
+  sweep_raycast(p_angle, p_step_count);
+  build_view_offsets();
+}
+
+int LineOfSightSharedSweep::get_rays_cast() const { return rays_cast; }
+
+int LineOfSightSharedSweep::get_edges_resolved() const { return edges_resolved; }
+
+int LineOfSightSharedSweep::get_bisection_rays() const { return bisection_rays; }
+
+void LineOfSightGroup::_bind_methods() {
+  ClassDB::bind_method(D_METHOD("get_origin_tolerance"), &LineOfSightGroup::get_origin_tolerance);
+  ClassDB::bind_method(
+      D_METHOD("set_origin_tolerance", "p_origin_tolerance"),
+      &LineOfSightGroup::set_origin_tolerance
+  );
+  ClassDB::add_property(
+      "LineOfSightGroup",
+      PropertyInfo(Variant::FLOAT, "origin_tolerance", PROPERTY_HINT_RANGE, "0,1024,0.1"),
+      "set_origin_tolerance", "get_origin_tolerance"
+  );
+
+  ClassDB::bind_method(D_METHOD("add_member", "p_member"), &LineOfSightGroup::add_member);
+  ClassDB::bind_method(D_METHOD("remove_member", "p_member"), &LineOfSightGroup::remove_member);
+  ClassDB::bind_method(D_METHOD("get_members"), &LineOfSightGroup::get_members);
+  ClassDB::bind_method(D_METHOD("can_see", "p_point"), &LineOfSightGroup::can_see);
+  ClassDB::bind_method(D_METHOD("get_stats"), &LineOfSightGroup::get_stats);
+  ClassDB::bind_method(
+      D_METHOD("_compute_cluster", "p_index"), &LineOfSightGroup::_compute_cluster
+  );
+}
+
+LineOfSightGroup::LineOfSightGroup() {
+  origin_tolerance = 0;
+  rays_cast = 0;
+  edges_resolved = 0;
+  shared_sweeps = 0;
+  members_shared = 0;
+}
+
+LineOfSightGroup::~LineOfSightGroup() {
+  // The members go back to their own update mode.
+  for (uint32_t i = 0; i < members.size(); i++) {
+    LineOfSight2D *member = Object::cast_to<LineOfSight2D>(ObjectDB::get_instance(members[i]));
+    if (member != nullptr && member->get_group_id() == get_instance_id()) {
+      member->set_group_id(0);
+    }
+  }
+  for (uint32_t i = 0; i < sweeps.size(); i++) {
+    memdelete(sweeps[i]);
+  }
+}
+
+void LineOfSightGroup::set_origin_tolerance(const double p_origin_tolerance) {
+  origin_tolerance = MAX(0.0, p_origin_tolerance);
+}
+
+double LineOfSightGroup::get_origin_tolerance() const { return origin_tolerance; }
+
+/// @brief Let the group compute the view of a node every physics frame, instead of its update mode.
+void LineOfSightGroup::add_member(LineOfSight2D *p_member) {
+  ERR_FAIL_NULL(p_member);
+  uint64_t group_id = p_member->get_group_id();
+  ERR_FAIL_COND_MSG(
+      group_id != 0 && group_id != get_instance_id(), "The node is already in another group."
+  );
+
+  uint64_t id = p_member->get_instance_id();
+  if (members.find(id) == -1) {
+    members.push_back(id);
+  }
+  // Out of the tree, the group hands the node back to its own update mode until it enters.
+  if (is_inside_tree()) {
+    p_member->set_group_id(get_instance_id());
+  }
+}
+
+/// @brief Give a node back to its own update mode.
+void LineOfSightGroup::remove_member(LineOfSight2D *p_member) {
+  ERR_FAIL_NULL(p_member);
+  members.erase(p_member->get_instance_id());
+  if (p_member->get_group_id() == get_instance_id()) {
+    p_member->set_group_id(0);
+  }
+}
+
+TypedArray<LineOfSight2D> LineOfSightGroup::get_members() const {
+  TypedArray<LineOfSight2D> nodes;
+  for (uint32_t i = 0; i < members.size(); i++) {
+    nodes.push_back(Object::cast_to<LineOfSight2D>(ObjectDB::get_instance(members[i])));
+  }
+  return nodes;
+}
+
+/// @brief Check whether any member sees a point. The members building a view are checked against
+/// their last view without casting rays, the others cast a ray.
+/// @param p_point The global position of the point.
+bool LineOfSightGroup::can_see(const Vector2 &p_point) {
+  for (uint32_t i = 0; i < members.size(); i++) {
+    LineOfSight2D *member = Object::cast_to<LineOfSight2D>(ObjectDB::get_instance(members[i]));
+    if (member == nullptr || !member->is_inside_tree()) {
+      continue;
+    }
+    bool visible = member->is_sweep_needed() ? member->is_point_in_view(p_point)
+                                             : member->is_point_visible(p_point);
+    if (visible) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// @brief Get the counters of the last update, summed over the members.
+Dictionary LineOfSightGroup::get_stats() const {
+  Dictionary stats;
+  stats["rays"] = rays_cast;
+  stats["edges"] = edges_resolved;
+  stats["shared_sweeps"] = shared_sweeps;
+  stats["members_shared"] = members_shared;
+  return stats;
+}
+
+/// @brief Whether a member can clip its view from the sweep of a leader: it must query the same
+/// occluders with rays, and stand close enough for the view of the leader to stand for its own.
+bool LineOfSightGroup::can_share_sweep(
+    const LineOfSight2D *p_leader, const LineOfSight2D *p_member
+) const {
+  // The other modes don't cast rays, and the tiles of a member are only read by itself.
+  if (p_member->get_mode() != LineOfSight2D::MODE_RAYCAST || p_member->get_use_tile_map()) {
+    return false;
+  }
+  return p_member->get_collision_mask() == p_leader->get_collision_mask() &&
+         p_member->get_use_occluder_index() == p_leader->get_use_occluder_index() &&
+         p_member->get_deterministic() == p_leader->get_deterministic() &&
+         p_member->get_world_2d() == p_leader->get_world_2d() &&
+         p_member->get_global_position().distance_to(p_leader->get_global_position()) <=
+             origin_tolerance;
+}
+
+/// @brief Set up the shared sweep of a cluster on the main thread, where the members can be read:
+/// it covers the shortest arc holding every cone, at the finest resolution of the members.
+void LineOfSightGroup::begin_cluster(const uint32_t p_index) {
+  Cluster &cluster = clusters[p_index];
+  LineOfSight2D **cluster_members = &clustered[cluster.first];
+  LineOfSightSharedSweep &shared_sweep = *sweeps[p_index];
+
+  double resolution = 0;
+  shared_sweep.begin(*cluster_members[0]);
+  for (uint32_t i = 0; i < cluster.count; i++) {
+    shared_sweep.add(*cluster_members[i]);
+    resolution = MAX(
+        resolution, cluster_members[i]->get_resolution() * cluster_members[i]->get_lod_scale()
+    );
+  }
+
+  // The shortest arc covering every cone starts where one of them starts.
+  cluster.arc_start = 0;
+  cluster.arc_angle = 360;
+  for (uint32_t i = 0; i < cluster.count; i++) {
+    LineOfSight2D *member = cluster_members[i];
+    double start = member->get_global_rotation_degrees() - member->get_angle() / 2.0;
+    double length = 0;
+    for (uint32_t j = 0; j < cluster.count; j++) {
+      LineOfSight2D *other = cluster_members[j];
+      double other_start = other->get_global_rotation_degrees() - other->get_angle() / 2.0;
+      length = MAX(length, Math::fposmod(other_start - start, 360.0) + other->get_angle());
+    }
+    if (i == 0 || length < cluster.arc_angle) {
+      cluster.arc_start = start;
+      cluster.arc_angle = MIN(length, 360.0);
+    }
+  }
+  cluster.step_count = MAX(1, (int)(cluster.arc_angle * resolution));
+}
+
+void LineOfSightGroup::_enter_tree() {
+  // The members left to their own update mode by _exit_tree() come back to the group.
+  for (uint32_t i = 0; i < members.size(); i++) {
+    LineOfSight2D *member = Object::cast_to<LineOfSight2D>(ObjectDB::get_instance(members[i]));
+    if (member != nullptr && member->get_group_id() == 0) {
+      member->set_group_id(get_instance_id());
+    }
+  }
+}
+
+void LineOfSightGroup::_exit_tree() {
+  // The group stops computing the views, so the members go back to their own update mode.
+  for (uint32_t i = 0; i < members.size(); i++) {
+    LineOfSight2D *member = Object::cast_to<LineOfSight2D>(ObjectDB::get_instance(members[i]));
+    if (member != nullptr && member->get_group_id() == get_instance_id()) {
+      member->set_group_id(0);
+    }
+  }
+}
+
+void LineOfSightGroup::_physics_process(double delta) {
+  rays_cast = 0;
+  edges_resolved = 0;
+  shared_sweeps = 0;
+  members_shared = 0;
+
+  // Every member is prepared first, so that the clusters only hold the members whose view changed.
+  pending.clear();
+  for (uint32_t i = 0; i < members.size(); i++) {
+    LineOfSight2D *member = Object::cast_to<LineOfSight2D>(ObjectDB::get_instance(members[i]));
+    if (member == nullptr || !member->is_inside_tree()) {
+      continue;
+    }
+    if (member->prepare_line_of_sight()) {
+      pending.push_back(member);
+    }
+  }
+
+  // The first pending member leads a cluster, which gathers every member it can share a sweep with.
+  clustered.clear();
+  clusters.clear();
+  while (!pending.is_empty()) {
+    LineOfSight2D *leader = pending[0];
+    pending.remove_at(0);
+    Cluster cluster = {};
+    cluster.first = clustered.size();
+    clustered.push_back(leader);
+    if (can_share_sweep(leader, leader)) {
+      uint32_t i = 0;
+      while (i < pending.size()) {
+        if (can_share_sweep(leader, pending[i])) {
+          clustered.push_back(pending[i]);
+          pending.remove_at(i);
+        } else {
+          i++;
+        }
+      }
+    }
+    cluster.count = clustered.size() - cluster.first;
+    clusters.push_back(cluster);
+  }
+  if (clusters.is_empty()) {
+    return;
+  }
+
+  while (sweeps.size() < clusters.size()) {
+    sweeps.push_back(memnew(LineOfSightSharedSweep));
+  }
+  for (uint32_t i = 0; i < clusters.size(); i++) {
+    if (clusters[i].count > 1) {
+      begin_cluster(i);
+    }
+  }
+
+  LineOfSightServer::get_singleton()->run_tasks(
+      Callable(this, StringName("_compute_cluster")), clusters.size(), String("LineOfSightGroup")
+  );
+
+  for (uint32_t i = 0; i < clusters.size(); i++) {
+    rays_cast += clusters[i].rays_cast;
+    edges_resolved += clusters[i].edges_resolved;
+    if (clusters[i].count > 1) {
+      shared_sweeps++;
+      members_shared += clusters[i].count;
+    }
+  }
+}
+
+/// @brief Compute the views of the members of a cluster, with one sweep between them. Called from
+/// the worker threads.
+/// @param p_index The index of the cluster.
+void LineOfSightGroup::_compute_cluster(const int p_index) {
+  Cluster &cluster = clusters[p_index];
+  LineOfSight2D **cluster_members = &clustered[cluster.first];
+  LineOfSightServer *server = LineOfSightServer::get_singleton();
+
+  if (cluster.count == 1) {
+    LineOfSight2D *member = cluster_members[0];
+    std::unique_lock<std::mutex> lock =
+        server->lock_physics_queries(member->uses_physics_queries());
+    member->compute_line_of_sight();
+    cluster.rays_cast = member->get_rays_cast();
+    cluster.edges_resolved = member->get_edges_resolved();
+    return;
+  }
+
+  uint64_t start_time = Time::get_singleton()->get_ticks_usec();
+
+  // The members clip their views from the sweep of the leader, which queries the same occluders.
+  LineOfSightSharedSweep &shared_sweep = *sweeps[p_index];
+  {
+    std::unique_lock<std::mutex> lock =
+        server->lock_physics_queries(cluster_members[0]->uses_physics_queries());
+    shared_sweep.compute(cluster.arc_start, cluster.arc_angle, cluster.step_count);
+  }
+  for (uint32_t i = 0; i < cluster.count; i++) {
+    cluster_members[i]->set_shared_sweep(&shared_sweep);
+    cluster_members[i]->compute_line_of_sight();
+    cluster_members[i]->set_shared_sweep(nullptr);
+  }
+  cluster.rays_cast = shared_sweep.get_rays_cast();
+  cluster.edges_resolved = shared_sweep.get_edges_resolved();
+
+  // The members report their own clipping, the rays of the shared sweep are reported once.
+  uint64_t time_usec = Time::get_singleton()->get_ticks_usec() - start_time;
+  server->add_to_counter(LineOfSightServer::COUNTER_TIME_USEC, time_usec);
+  server->add_to_counter(LineOfSightServer::COUNTER_RAYS, shared_sweep.get_rays_cast());
+  server->add_to_counter(LineOfSightServer::COUNTER_EDGES, shared_sweep.get_edges_resolved());
+  server->add_to_counter(
+      LineOfSightServer::COUNTER_BISECTION_RAYS, shared_sweep.get_bisection_rays()
+  );
+}
@@ -0,0 +1,93 @@
+#ifndef LINEOFSIGHT_GROUP_H
+#define LINEOFSIGHT_GROUP_H
+
+#include "lineofsight2d.h"
+
+#include <godot_cpp/classes/node.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/typed_array.hpp>
+#include <godot_cpp/variant/vector2.hpp>
+
+using namespace godot;
+
+/// @brief A sweep cast once for several 2D views standing close together, which clip their own
+/// cone from it.
+class LineOfSightSharedSweep : public LineOfSightCore<LineOfSight2DTraits> {
+public:
+  void begin(const LineOfSight2D &p_leader);
+  void add(const LineOfSight2D &p_member);
+  void compute(const double p_start, const double p_angle, const int p_step_count);
+
+  int get_rays_cast() const;
+  int get_edges_resolved() const;
+  int get_bisection_rays() const;
+};
+
+/// @brief Updates several LineOfSight2D nodes together, casting one sweep for the members standing
+/// close together instead of one per member.
+///
+/// Every physics frame the members are prepared, then gathered into clusters around a leader: the
+/// members within the origin tolerance of it, querying the same occluders. A cluster casts a single
+/// sweep from the leader, covering the cones of all of its members, and every member clips its view
+/// from it. The members then see from the origin of the leader, which is exact for members standing
+/// on the same spot and an approximation within the tolerance otherwise. A member alone in its
+/// cluster casts its own sweep. The clusters are computed on the worker threads of the
+/// LineOfSightServer.
+///
+/// The group doesn't merge the views of its members into one region: can_see() checks a point
+/// against each of them.
+class LineOfSightGroup : public Node {
+  GDCLASS(LineOfSightGroup, Node)
+
+  // Members whose views are computed together on a worker thread.
+  struct Cluster {
+    uint32_t first;      // The index of the leader in clustered.
+    uint32_t count;      // The number of members.
+    double arc_start;    // The global rotation of the first step of the shared sweep in degrees.
+    double arc_angle;    // The angle covered by the shared sweep in degrees.
+    int step_count;      // The number of steps of the shared sweep.
+    int rays_cast;       // The number of rays cast for the cluster.
+    int edges_resolved;  // The number of edges resolved for the cluster.
+  };
+
+  double origin_tolerance;        // How far a member may stand from the leader of its cluster.
+  LocalVector<uint64_t> members;  // The instance ids of the members.
+
+  LocalVector<LineOfSight2D *> pending;          // The members whose view must be computed.
+  LocalVector<LineOfSight2D *> clustered;        // The pending members, ordered by cluster.
+  LocalVector<Cluster> clusters;                 // The clusters of the current frame.
+  LocalVector<LineOfSightSharedSweep *> sweeps;  // The sweep of each cluster, grown as needed.
+
+  int rays_cast;       // The number of rays cast by the last update.
+  int edges_resolved;  // The number of edges resolved by the last update.
+  int shared_sweeps;   // The number of sweeps shared by several members in the last update.
+  int members_shared;  // The number of members which clipped their view from a shared sweep.
+
+  bool can_share_sweep(const LineOfSight2D *p_leader, const LineOfSight2D *p_member) const;
+  void begin_cluster(const uint32_t p_index);
+
+protected:
+  static void _bind_methods();
+
+public:
+  void set_origin_tolerance(const double p_origin_tolerance);
+  double get_origin_tolerance() const;
+
+  void add_member(LineOfSight2D *p_member);
+  void remove_member(LineOfSight2D *p_member);
+  TypedArray<LineOfSight2D> get_members() const;
+
+  bool can_see(const Vector2 &p_point);
+  Dictionary get_stats() const;
+
+  LineOfSightGroup();
+  ~LineOfSightGroup();
+
+  void _enter_tree() override;
+  void _exit_tree() override;
+  void _physics_process(double delta) override;
+  void _compute_cluster(const int p_index);
+};
+
+#endif
@@ -0,0 +1,885 @@
+#include "lineofsightserver.h"
+
+#include "lineofsight2d.h"
+#include "lineofsight3d.h"
+
+#include <godot_cpp/classes/camera2d.hpp>
+#include <godot_cpp/classes/camera3d.hpp>
+#include <godot_cpp/classes/collision_polygon2d.hpp>
+#include <godot_cpp/classes/collision_shape2d.hpp>
+#include <godot_cpp/classes/collision_shape3d.hpp>
+#include <godot_cpp/classes/performance.hpp>
+#include <godot_cpp/classes/physics_body2d.hpp>
+#include <godot_cpp/classes/physics_body3d.hpp>
+#include <godot_cpp/classes/viewport.hpp>
+#include <godot_cpp/classes/worker_thread_pool.hpp>
+#include <godot_cpp/core/class_db.hpp>
+
+using namespace godot;
+
+LineOfSightServer *LineOfSightServer::singleton = nullptr;
+
+void LineOfSightServer::_bind_methods() {
+  ClassDB::bind_method(
+      D_METHOD("get_parallel_physics_queries"), &LineOfSightServer::get_parallel_physics_queries
+  );
+  ClassDB::bind_method(
+      D_METHOD("set_parallel_physics_queries", "p_parallel_physics_queries"),
+      &LineOfSightServer::set_parallel_physics_queries
+  );
+  ClassDB::add_property(
+      "LineOfSightServer", PropertyInfo(Variant::BOOL, "parallel_physics_queries"),
+      "set_parallel_physics_queries", "get_parallel_physics_queries"
+  );
+
+  ClassDB::bind_method(
+      D_METHOD("get_time_budget_usec"), &LineOfSightServer::get_time_budget_usec
+  );
+  ClassDB::bind_method(
+      D_METHOD("set_time_budget_usec", "p_time_budget_usec"),
+      &LineOfSightServer::set_time_budget_usec
+  );
+  ClassDB::add_property(
+      "LineOfSightServer", PropertyInfo(Variant::INT, "time_budget_usec"), "set_time_budget_usec",
+      "get_time_budget_usec"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_ray_budget"), &LineOfSightServer::get_ray_budget);
+  ClassDB::bind_method(
+      D_METHOD("set_ray_budget", "p_ray_budget"), &LineOfSightServer::set_ray_budget
+  );
+  ClassDB::add_property(
+      "LineOfSightServer", PropertyInfo(Variant::INT, "ray_budget"), "set_ray_budget",
+      "get_ray_budget"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_focus_mode"), &LineOfSightServer::get_focus_mode);
+  ClassDB::bind_method(
+      D_METHOD("set_focus_mode", "p_focus_mode"), &LineOfSightServer::set_focus_mode
+  );
+  ClassDB::add_property(
+      "LineOfSightServer",
+      PropertyInfo(Variant::INT, "focus_mode", PROPERTY_HINT_ENUM, "None,Camera,Node"),
+      "set_focus_mode", "get_focus_mode"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_focus_node"), &LineOfSightServer::get_focus_node);
+  ClassDB::bind_method(
+      D_METHOD("set_focus_node", "p_focus_node"), &LineOfSightServer::set_focus_node
+  );
+  ClassDB::add_property(
+      "LineOfSightServer",
+      PropertyInfo(Variant::OBJECT, "focus_node", PROPERTY_HINT_NODE_TYPE, "Node"),
+      "set_focus_node", "get_focus_node"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_lod_distance"), &LineOfSightServer::get_lod_distance);
+  ClassDB::bind_method(
+      D_METHOD("set_lod_distance", "p_lod_distance"), &LineOfSightServer::set_lod_distance
+  );
+  ClassDB::add_property(
+      "LineOfSightServer", PropertyInfo(Variant::FLOAT, "lod_distance"), "set_lod_distance",
+      "get_lod_distance"
+  );
+
+  ClassDB::bind_method(D_METHOD("get_lod_min_scale"), &LineOfSightServer::get_lod_min_scale);
+  ClassDB::bind_method(
+      D_METHOD("set_lod_min_scale", "p_lod_min_scale"), &LineOfSightServer::set_lod_min_scale
+  );
+  ClassDB::add_property(
+      "LineOfSightServer",
+      PropertyInfo(Variant::FLOAT, "lod_min_scale", PROPERTY_HINT_RANGE, "0.01,1,0.01"),
+      "set_lod_min_scale", "get_lod_min_scale"
+  );
+
+  BIND_ENUM_CONSTANT(FOCUS_NONE);
+  BIND_ENUM_CONSTANT(FOCUS_CAMERA);
+  BIND_ENUM_CONSTANT(FOCUS_NODE);
+
+  ClassDB::bind_method(D_METHOD("get_occluder_layers"), &LineOfSightServer::get_occluder_layers);
+  ClassDB::bind_method(
+      D_METHOD("set_occluder_layers", "p_occluder_layers"), &LineOfSightServer::set_occluder_layers
+  );
+  ClassDB::add_property(
+      "LineOfSightServer",
+      PropertyInfo(Variant::INT, "occluder_layers", PROPERTY_HINT_LAYERS_2D_PHYSICS),
+      "set_occluder_layers", "get_occluder_layers"
+  );
+
+  ClassDB::bind_method(
+      D_METHOD("get_occluder_cell_size_2d"), &LineOfSightServer::get_occluder_cell_size_2d
+  );
+  ClassDB::bind_method(
+      D_METHOD("set_occluder_cell_size_2d", "p_cell_size"),
+      &LineOfSightServer::set_occluder_cell_size_2d
+  );
+  ClassDB::add_property(
+      "LineOfSightServer", PropertyInfo(Variant::FLOAT, "occluder_cell_size_2d"),
+      "set_occluder_cell_size_2d", "get_occluder_cell_size_2d"
+  );
+
+  ClassDB::bind_method(
+      D_METHOD("get_occluder_cell_size_3d"), &LineOfSightServer::get_occluder_cell_size_3d
+  );
+  ClassDB::bind_method(
+      D_METHOD("set_occluder_cell_size_3d", "p_cell_size"),
+      &LineOfSightServer::set_occluder_cell_size_3d
+  );
+  ClassDB::add_property(
+      "LineOfSightServer", PropertyInfo(Variant::FLOAT, "occluder_cell_size_3d"),
+      "set_occluder_cell_size_3d", "get_occluder_cell_size_3d"
+  );
+
+  ClassDB::bind_method(
+      D_METHOD("rebuild_occluder_index"), &LineOfSightServer::rebuild_occluder_index
+  );
+  ClassDB::bind_method(
+      D_METHOD("get_occluder_body_count"), &LineOfSightServer::get_occluder_body_count
+  );
+  ClassDB::bind_method(
+      D_METHOD("intersect_occluder_ray_2d", "p_from", "p_to", "p_collision_mask"),
+      &LineOfSightServer::intersect_occluder_ray_2d, DEFVAL(UINT32_MAX)
+  );
+  ClassDB::bind_method(D_METHOD("get_occluder_kernel"), &LineOfSightServer::get_occluder_kernel);
+
+  ClassDB::bind_method(D_METHOD("get_agent_count"), &LineOfSightServer::get_agent_count);
+  ClassDB::bind_method(
+      D_METHOD("get_frame_counter", "p_counter"), &LineOfSightServer::get_frame_counter
+  );
+  ClassDB::bind_method(
+      D_METHOD("get_ray_cache_hit_rate"), &LineOfSightServer::get_ray_cache_hit_rate
+  );
+  ClassDB::bind_method(D_METHOD("get_frame_stats"), &LineOfSightServer::get_frame_stats);
+  ClassDB::bind_method(D_METHOD("update"), &LineOfSightServer::update);
+
+  ClassDB::bind_method(
+      D_METHOD("get_distance_shader_2d"), &LineOfSightServer::get_distance_shader_2d
+  );
+  ClassDB::bind_method(
+      D_METHOD("get_distance_shader_3d"), &LineOfSightServer::get_distance_shader_3d
+  );
+
+  ClassDB::bind_method(D_METHOD("_on_physics_frame"), &LineOfSightServer::_on_physics_frame);
+  ClassDB::bind_method(D_METHOD("_on_process_frame"), &LineOfSightServer::_on_process_frame);
+  ClassDB::bind_method(D_METHOD("_compute_agent", "p_index"), &LineOfSightServer::_compute_agent);
+  ClassDB::bind_method(D_METHOD("_on_node_added", "p_node"), &LineOfSightServer::_on_node_added);
+  ClassDB::bind_method(
+      D_METHOD("_on_node_removed", "p_node"), &LineOfSightServer::_on_node_removed
+  );
+
+  BIND_ENUM_CONSTANT(COUNTER_TIME_USEC);
+  BIND_ENUM_CONSTANT(COUNTER_RAYS);
+  BIND_ENUM_CONSTANT(COUNTER_EDGES);
+  BIND_ENUM_CONSTANT(COUNTER_BISECTION_RAYS);
+  BIND_ENUM_CONSTANT(COUNTER_VERTICES);
+  BIND_ENUM_CONSTANT(COUNTER_NODES_UPDATED);
+  BIND_ENUM_CONSTANT(COUNTER_NODES_SKIPPED);
+  BIND_ENUM_CONSTANT(COUNTER_RAY_CACHE_HITS);
+  BIND_ENUM_CONSTANT(COUNTER_RAY_CACHE_MISSES);
+  BIND_ENUM_CONSTANT(COUNTER_VERTICES_UNSIMPLIFIED);
+}
+
+// The names of the counters, used by the monitors and the stats.
+static const char *counter_names[LineOfSightServer::COUNTER_MAX] = {
+    "time_usec",        "rays",           "edges",
+    "bisection_rays",   "vertices",       "nodes_updated",
+    "nodes_skipped",    "ray_cache_hits", "ray_cache_misses",
+    "vertices_unsimplified",
+};
+
+// The uniforms and the test shared by the distance shaders. The texture holds the distance of the
+// view along every step of the sweep, and the outline is straight between two steps.
+static const char *distance_shader_view = R"(
+uniform sampler2D distances : filter_nearest;
+uniform float start_angle;
+uniform float sweep_angle;
+uniform float min_distance;
+
+bool is_in_view(vec2 point) {
+  int count = textureSize(distances, 0).x;
+  float steps = float(count - 1);
+  float offset_angle = mod(atan(point.y, point.x) - start_angle, TAU);
+  float position = offset_angle / sweep_angle * steps;
+  if (count < 2 || position > steps || length(point) < min_distance) {
+    return false;
+  }
+
+  int i = min(int(position), count - 2);
+  float step_angle = sweep_angle / steps;
+  float angle_a = start_angle + float(i) * step_angle;
+  float angle_b = angle_a + step_angle;
+  vec2 a = vec2(cos(angle_a), sin(angle_a)) * texelFetch(distances, ivec2(i, 0), 0).r;
+  vec2 b = vec2(cos(angle_b), sin(angle_b)) * texelFetch(distances, ivec2(i + 1, 0), 0).r;
+
+  // The point is seen if it is on the same side of the outline as the origin.
+  vec2 side = b - a;
+  float point_side = side.x * (point.y - a.y) - side.y * (point.x - a.x);
+  float origin_side = side.y * a.x - side.x * a.y;
+  return point_side * origin_side > 0.0;
+}
+)";
+
+static const char *distance_shader_2d_header = "shader_type canvas_item;\n";
+static const char *distance_shader_2d_code = R"(
+varying vec2 plane_position;
+
+void vertex() {
+  plane_position = VERTEX;
+}
+
+void fragment() {
+  if (!is_in_view(plane_position)) {
+    discard;
+  }
+}
+)";
+
+// The 3D sweeps turn in the XZ plane.
+static const char *distance_shader_3d_header = "shader_type spatial;\n"
+                                               "render_mode unshaded, cull_disabled;\n";
+static const char *distance_shader_3d_code = R"(
+uniform vec4 color : source_color = vec4(1.0);
+
+varying vec2 plane_position;
+
+void vertex() {
+  plane_position = VERTEX.xz;
+}
+
+void fragment() {
+  if (!is_in_view(plane_position)) {
+    discard;
+  }
+  ALBEDO = color.rgb;
+}
+)";
+
+/// @brief Join the header of a distance shader, the shared view test and the rest of the shader.
+static String build_distance_shader_code(const char *p_header, const char *p_code) {
+  return String(p_header) + distance_shader_view + p_code;
+}
+
+LineOfSightServer *LineOfSightServer::get_singleton() { return singleton; }
+
+LineOfSightServer::LineOfSightServer() {
+  singleton = this;
+  tree = nullptr;
+  // The default physics servers share their query buffers, so don't query them concurrently.
+  parallel_physics_queries = false;
+  time_budget_usec = 2000;
+  ray_budget = 0;
+  focus_mode = FOCUS_NONE;
+  focus_node = 0;
+  lod_distance = 0;
+  lod_min_scale = 0.25;
+  occluder_layers = 1;
+  occluder_index_users_2d = 0;
+  occluder_index_users_3d = 0;
+
+  for (int i = 0; i < COUNTER_MAX; i++) {
+    frame_counters[i] = 0;
+    last_frame_counters[i] = 0;
+  }
+  monitors_registered = false;
+}
+
+LineOfSightServer::~LineOfSightServer() {
+  unregister_monitors();
+  if (singleton == this) {
+    singleton = nullptr;
+  }
+}
+
+/// @brief Start following the frames of the given tree. Called by every node entering a tree.
+/// @param p_tree The tree of the node.
+void LineOfSightServer::connect_tree(SceneTree *p_tree) {
+  if (tree == p_tree || p_tree == nullptr) {
+    return;
+  }
+
+  // The monitors are added once the engine is running, when the first node enters a tree.
+  register_monitors();
+
+  Callable physics_callable = Callable(this, StringName("_on_physics_frame"));
+  Callable process_callable = Callable(this, StringName("_on_process_frame"));
+  Callable added_callable = Callable(this, StringName("_on_node_added"));
+  Callable removed_callable = Callable(this, StringName("_on_node_removed"));
+  if (tree != nullptr && tree->is_connected(StringName("physics_frame"), physics_callable)) {
+    tree->disconnect(StringName("physics_frame"), physics_callable);
+    tree->disconnect(StringName("process_frame"), process_callable);
+    tree->disconnect(StringName("node_added"), added_callable);
+    tree->disconnect(StringName("node_removed"), removed_callable);
+  }
+  tree = p_tree;
+  tree->connect(StringName("physics_frame"), physics_callable);
+  tree->connect(StringName("process_frame"), process_callable);
+  tree->connect(StringName("node_added"), added_callable);
+  tree->connect(StringName("node_removed"), removed_callable);
+  rebuild_occluder_index();
+}
+
+/// @brief Add a Performance monitor for every counter, under the LineOfSight category.
+void LineOfSightServer::register_monitors() {
+  Performance *performance = Performance::get_singleton();
+  if (monitors_registered || performance == nullptr) {
+    return;
+  }
+
+  Callable callable = Callable(this, StringName("get_frame_counter"));
+  for (int i = 0; i < COUNTER_MAX; i++) {
+    Array arguments;
+    arguments.push_back(i);
+    performance->add_custom_monitor(
+        StringName(String("LineOfSight/") + counter_names[i]), callable, arguments
+    );
+  }
+  performance->add_custom_monitor(
+      StringName("LineOfSight/ray_cache_hit_rate"),
+      Callable(this, StringName("get_ray_cache_hit_rate"))
+  );
+  monitors_registered = true;
+}
+
+void LineOfSightServer::unregister_monitors() {
+  Performance *performance = Performance::get_singleton();
+  if (!monitors_registered || performance == nullptr) {
+    return;
+  }
+
+  for (int i = 0; i < COUNTER_MAX; i++) {
+    performance->remove_custom_monitor(StringName(String("LineOfSight/") + counter_names[i]));
+  }
+  performance->remove_custom_monitor(StringName("LineOfSight/ray_cache_hit_rate"));
+  monitors_registered = false;
+}
+
+void LineOfSightServer::register_agent_2d(LineOfSight2D *p_agent) {
+  unregister_agent_2d(p_agent);
+  if (p_agent->get_update_mode() == LineOfSight2D::UPDATE_SCHEDULED) {
+    scheduled.push_back({p_agent, nullptr, 0, 0});
+  } else {
+    agents_2d.push_back(p_agent);
+  }
+  connect_tree(p_agent->get_tree());
+}
+
+void LineOfSightServer::unregister_agent_2d(LineOfSight2D *p_agent) {
+  agents_2d.erase(p_agent);
+  for (uint32_t i = 0; i < scheduled.size(); i++) {
+    if (scheduled[i].agent_2d == p_agent) {
+      scheduled.remove_at_unordered(i);
+      break;
+    }
+  }
+  p_agent->set_lod_scale(1);
+}
+
+void LineOfSightServer::register_agent_3d(LineOfSight3D *p_agent) {
+  unregister_agent_3d(p_agent);
+  if (p_agent->get_update_mode() == LineOfSight3D::UPDATE_SCHEDULED) {
+    scheduled.push_back({nullptr, p_agent, 0, 0});
+  } else {
+    agents_3d.push_back(p_agent);
+  }
+  connect_tree(p_agent->get_tree());
+}
+
+void LineOfSightServer::unregister_agent_3d(LineOfSight3D *p_agent) {
+  agents_3d.erase(p_agent);
+  for (uint32_t i = 0; i < scheduled.size(); i++) {
+    if (scheduled[i].agent_3d == p_agent) {
+      scheduled.remove_at_unordered(i);
+      break;
+    }
+  }
+  p_agent->set_lod_scale(1);
+}
+
+/// @brief Compute the line of sight of every registered node.
+///
+/// Everything touching the scene tree is read on the calling thread first, then the sweeps are
+/// spread over the worker threads. The meshes are committed later by each node.
+void LineOfSightServer::update() {
+  pending_2d.clear();
+  pending_3d.clear();
+  refresh_occluder_index();
+
+  // Nodes whose last sweep is still valid are skipped.
+  for (uint32_t i = 0; i < agents_2d.size(); i++) {
+    if (agents_2d[i]->prepare_line_of_sight()) {
+      pending_2d.push_back(agents_2d[i]);
+    }
+  }
+  for (uint32_t i = 0; i < agents_3d.size(); i++) {
+    if (agents_3d[i]->prepare_line_of_sight()) {
+      pending_3d.push_back(agents_3d[i]);
+    }
+  }
+  schedule_agents();
+
+  int pending_count = pending_2d.size() + pending_3d.size();
+  if (pending_count == 0) {
+    return;
+  }
+
+  run_tasks(
+      Callable(this, StringName("_compute_agent")), pending_count, String("LineOfSightServer")
+  );
+}
+
+/// @brief Run a task on the worker threads once per index, and wait for all of them.
+/// @param p_task The method called with the index.
+/// @param p_count The number of indices.
+/// @param p_description The name of the task in the profiler.
+void LineOfSightServer::run_tasks(
+    const Callable &p_task, const int p_count, const String &p_description
+) {
+  WorkerThreadPool *pool = WorkerThreadPool::get_singleton();
+  int64_t group_id = pool->add_group_task(p_task, p_count, -1, true, p_description);
+  pool->wait_for_group_task_completion(group_id);
+}
+
+/// @brief Serialize a sweep run on a worker thread with the other sweeps querying the physics
+/// servers, unless the backend takes concurrent queries. Hold the lock for the whole sweep.
+/// @param p_uses_physics_queries Whether the sweep queries the physics servers.
+std::unique_lock<std::mutex> LineOfSightServer::lock_physics_queries(
+    const bool p_uses_physics_queries
+) {
+  if (!parallel_physics_queries && p_uses_physics_queries) {
+    return std::unique_lock<std::mutex>(physics_mutex);
+  }
+  return std::unique_lock<std::mutex>();
+}
+
+/// @brief Pick the scheduled nodes to update this frame, most urgent first, within the budget.
+///
+/// The cost of a node is estimated from its last update. A node waiting for several frames grows
+/// more urgent, so every node is eventually updated, but the far ones less often. The nodes which
+/// are not updated keep their last mesh.
+void LineOfSightServer::schedule_agents() {
+  if (scheduled.is_empty()) {
+    return;
+  }
+
+  Object *focus = focus_mode == FOCUS_NODE ? ObjectDB::get_instance(focus_node) : nullptr;
+  for (uint32_t i = 0; i < scheduled.size(); i++) {
+    ScheduledAgent &agent = scheduled[i];
+    double distance = get_focus_distance(agent, focus);
+    double priority = agent.agent_2d != nullptr ? agent.agent_2d->get_update_priority()
+                                                : agent.agent_3d->get_update_priority();
+
+    // Lower the resolution of the far nodes.
+    double lod_scale = 1;
+    if (lod_distance > 0 && distance > lod_distance) {
+      lod_scale = MAX(lod_min_scale, lod_distance / distance);
+    }
+    if (agent.agent_2d != nullptr) {
+      agent.agent_2d->set_lod_scale(lod_scale);
+    } else {
+      agent.agent_3d->set_lod_scale(lod_scale);
+    }
+
+    double falloff = lod_distance > 0 ? 1.0 + distance / lod_distance : 1.0;
+    agent.urgency = (agent.frames_waiting + 1) * priority / falloff;
+  }
+  scheduled.sort();
+
+  int64_t time_spent = 0;
+  int64_t rays_spent = 0;
+  bool swept = false;
+  for (uint32_t i = 0; i < scheduled.size(); i++) {
+    ScheduledAgent &agent = scheduled[i];
+    // The first node to sweep is always updated, even when it doesn't fit in the budget on its own.
+    bool over_time = time_budget_usec > 0 && time_spent >= time_budget_usec;
+    bool over_rays = ray_budget > 0 && rays_spent >= ray_budget;
+    if (swept && (over_time || over_rays)) {
+      agent.frames_waiting++;
+      continue;
+    }
+
+    // Only the nodes which sweep are charged, the ones skipped by incremental mode cost nothing.
+    agent.frames_waiting = 0;
+    if (agent.agent_2d != nullptr) {
+      if (agent.agent_2d->prepare_line_of_sight()) {
+        pending_2d.push_back(agent.agent_2d);
+        time_spent += agent.agent_2d->get_update_time_usec();
+        rays_spent += agent.agent_2d->get_rays_cast();
+        swept = true;
+      }
+    } else if (agent.agent_3d->prepare_line_of_sight()) {
+      pending_3d.push_back(agent.agent_3d);
+      time_spent += agent.agent_3d->get_update_time_usec();
+      rays_spent += agent.agent_3d->get_rays_cast();
+      swept = true;
+    }
+  }
+}
+
+/// @brief Get the distance from a scheduled node to the focus of the scheduling.
+/// @param p_focus The focus node of FOCUS_NODE, if it still exists.
+/// @return The distance, or 0 when there is nothing to measure it from.
+double LineOfSightServer::get_focus_distance(const ScheduledAgent &p_agent, Object *p_focus) const {
+  if (p_agent.agent_2d != nullptr) {
+    Node2D *target = nullptr;
+    if (focus_mode == FOCUS_CAMERA) {
+      target = p_agent.agent_2d->get_viewport()->get_camera_2d();
+    } else if (focus_mode == FOCUS_NODE) {
+      target = Object::cast_to<Node2D>(p_focus);
+    }
+    if (target == nullptr) {
+      return 0;
+    }
+    return p_agent.agent_2d->get_global_position().distance_to(target->get_global_position());
+  }
+
+  Node3D *target = nullptr;
+  if (focus_mode == FOCUS_CAMERA) {
+    target = p_agent.agent_3d->get_viewport()->get_camera_3d();
+  } else if (focus_mode == FOCUS_NODE) {
+    target = Object::cast_to<Node3D>(p_focus);
+  }
+  if (target == nullptr) {
+    return 0;
+  }
+  return p_agent.agent_3d->get_global_position().distance_to(target->get_global_position());
+}
+
+void LineOfSightServer::_on_physics_frame() { update(); }
+
+/// @brief Mark the body of a node, or the body of a collision shape, to be indexed again.
+void LineOfSightServer::mark_body_dirty(Node *p_node) {
+  if (occluder_index_users_2d == 0 && occluder_index_users_3d == 0) {
+    return;
+  }
+
+  Node *body = p_node;
+  if (Object::cast_to<CollisionShape2D>(p_node) != nullptr ||
+      Object::cast_to<CollisionPolygon2D>(p_node) != nullptr ||
+      Object::cast_to<CollisionShape3D>(p_node) != nullptr) {
+    body = p_node->get_parent();
+  }
+  bool is_body = Object::cast_to<PhysicsBody2D>(body) != nullptr ||
+                 Object::cast_to<PhysicsBody3D>(body) != nullptr;
+  if (is_body && dirty_bodies.find(body->get_instance_id()) == -1) {
+    dirty_bodies.push_back(body->get_instance_id());
+  }
+}
+
+void LineOfSightServer::_on_node_added(Node *p_node) { mark_body_dirty(p_node); }
+
+void LineOfSightServer::_on_node_removed(Node *p_node) { mark_body_dirty(p_node); }
+
+/// @brief Close the counters of the frame, which then show up in the monitors.
+void LineOfSightServer::_on_process_frame() {
+  for (int i = 0; i < COUNTER_MAX; i++) {
+    last_frame_counters[i] = frame_counters[i].exchange(0, std::memory_order_relaxed);
+  }
+}
+
+/// @brief Compute the sweep of a single node. Called from the worker threads.
+/// @param p_index The index of the node, 2D nodes first.
+void LineOfSightServer::_compute_agent(const int p_index) {
+  int count_2d = pending_2d.size();
+  if (p_index < count_2d) {
+    LineOfSight2D *agent = pending_2d[p_index];
+    std::unique_lock<std::mutex> lock = lock_physics_queries(agent->uses_physics_queries());
+    agent->compute_line_of_sight();
+  } else {
+    LineOfSight3D *agent = pending_3d[p_index - count_2d];
+    std::unique_lock<std::mutex> lock = lock_physics_queries(agent->uses_physics_queries());
+    agent->compute_line_of_sight();
+  }
+}
+
+void LineOfSightServer::set_parallel_physics_queries(const bool p_parallel_physics_queries) {
+  parallel_physics_queries = p_parallel_physics_queries;
+}
+
+bool LineOfSightServer::get_parallel_physics_queries() const { return parallel_physics_queries; }
+
+void LineOfSightServer::set_time_budget_usec(const int64_t p_time_budget_usec) {
+  time_budget_usec = MAX(0, p_time_budget_usec);
+}
+
+int64_t LineOfSightServer::get_time_budget_usec() const { return time_budget_usec; }
+
+void LineOfSightServer::set_ray_budget(const int64_t p_ray_budget) {
+  ray_budget = MAX(0, p_ray_budget);
+}
+
+int64_t LineOfSightServer::get_ray_budget() const { return ray_budget; }
+
+void LineOfSightServer::set_focus_mode(const FocusMode p_focus_mode) { focus_mode = p_focus_mode; }
+
+LineOfSightServer::FocusMode LineOfSightServer::get_focus_mode() const { return focus_mode; }
+
+void LineOfSightServer::set_focus_node(Node *p_focus_node) {
+  focus_node = p_focus_node != nullptr ? p_focus_node->get_instance_id() : 0;
+}
+
+Node *LineOfSightServer::get_focus_node() const {
+  return Object::cast_to<Node>(ObjectDB::get_instance(focus_node));
+}
+
+void LineOfSightServer::set_lod_distance(const double p_lod_distance) {
+  lod_distance = MAX(0.0, p_lod_distance);
+}
+
+double LineOfSightServer::get_lod_distance() const { return lod_distance; }
+
+void LineOfSightServer::set_lod_min_scale(const double p_lod_min_scale) {
+  lod_min_scale = CLAMP(p_lod_min_scale, 0.01, 1.0);
+}
+
+double LineOfSightServer::get_lod_min_scale() const { return lod_min_scale; }
+
+void LineOfSightServer::set_occluder_layers(const uint32_t p_occluder_layers) {
+  if (occluder_layers != p_occluder_layers) {
+    occluder_layers = p_occluder_layers;
+    rebuild_occluder_index();
+  }
+}
+
+uint32_t LineOfSightServer::get_occluder_layers() const { return occluder_layers; }
+
+void LineOfSightServer::set_occluder_cell_size_2d(const double p_cell_size) {
+  occluder_index_2d.set_cell_size(p_cell_size);
+}
+
+double LineOfSightServer::get_occluder_cell_size_2d() const {
+  return occluder_index_2d.get_cell_size();
+}
+
+void LineOfSightServer::set_occluder_cell_size_3d(const double p_cell_size) {
+  occluder_index_3d.set_cell_size(p_cell_size);
+}
+
+double LineOfSightServer::get_occluder_cell_size_3d() const {
+  return occluder_index_3d.get_cell_size();
+}
+
+/// @brief Start maintaining the 2D index for a node. The index is built by the first node.
+void LineOfSightServer::acquire_occluder_index_2d() {
+  occluder_index_users_2d++;
+  if (occluder_index_users_2d == 1) {
+    rebuild_occluder_index();
+  }
+}
+
+/// @brief Stop maintaining the 2D index for a node. The index is freed with the last node.
+void LineOfSightServer::release_occluder_index_2d() {
+  occluder_index_users_2d = MAX(0, occluder_index_users_2d - 1);
+  if (occluder_index_users_2d == 0) {
+    occluder_index_2d.clear();
+    indexed_bodies_2d.clear();
+  }
+}
+
+void LineOfSightServer::acquire_occluder_index_3d() {
+  occluder_index_users_3d++;
+  if (occluder_index_users_3d == 1) {
+    rebuild_occluder_index();
+  }
+}
+
+void LineOfSightServer::release_occluder_index_3d() {
+  occluder_index_users_3d = MAX(0, occluder_index_users_3d - 1);
+  if (occluder_index_users_3d == 0) {
+    occluder_index_3d.clear();
+    indexed_bodies_3d.clear();
+  }
+}
+
+const OccluderIndex2D *LineOfSightServer::get_occluder_index_2d() const {
+  return &occluder_index_2d;
+}
+
+const OccluderIndex3D *LineOfSightServer::get_occluder_index_3d() const {
+  return &occluder_index_3d;
+}
+
+/// @brief Index the physics bodies of the whole tree again, e.g. after changing their layers.
+void LineOfSightServer::rebuild_occluder_index() {
+  occluder_index_2d.clear();
+  occluder_index_3d.clear();
+  indexed_bodies_2d.clear();
+  indexed_bodies_3d.clear();
+  dirty_bodies.clear();
+
+  bool used = occluder_index_users_2d > 0 || occluder_index_users_3d > 0;
+  if (used && tree != nullptr && tree->get_root() != nullptr) {
+    index_tree(tree->get_root());
+  }
+}
+
+int LineOfSightServer::get_occluder_body_count() const {
+  return occluder_index_2d.get_body_count() + occluder_index_3d.get_body_count();
+}
+
+/// @brief Cast a ray against the 2D occluder index, as the nodes using it do.
+/// @return The hit "position", like PhysicsDirectSpaceState2D.intersect_ray(), or an empty
+/// dictionary if nothing was hit.
+Dictionary LineOfSightServer::intersect_occluder_ray_2d(
+    const Vector2 &p_from, const Vector2 &p_to, const uint32_t p_collision_mask
+) const {
+  Dictionary result;
+  Vector2 position;
+  if (occluder_index_2d.intersect_ray(p_from, p_to, p_collision_mask, {}, position)) {
+    result[StringName("position")] = position;
+  }
+  return result;
+}
+
+/// @brief Get the name of the kernel testing the 2D segments: "avx2", "sse2" or "scalar".
+String LineOfSightServer::get_occluder_kernel() const {
+  return String(OccluderIndex2D::get_kernel_name());
+}
+
+void LineOfSightServer::index_tree(Node *p_node) {
+  index_body(p_node);
+  for (int i = 0; i < p_node->get_child_count(); i++) {
+    index_tree(p_node->get_child(i));
+  }
+}
+
+/// @brief Add the shapes of a physics body to the index, if it is on the occluder layers.
+/// @param p_body Any node, ignored when it isn't a physics body.
+void LineOfSightServer::index_body(Node *p_body) {
+  if (PhysicsBody2D *body = Object::cast_to<PhysicsBody2D>(p_body)) {
+    if (occluder_index_users_2d == 0 || (body->get_collision_layer() & occluder_layers) == 0) {
+      return;
+    }
+
+    body_segments.clear();
+    for (int i = 0; i < body->get_child_count(); i++) {
+      Node *child = body->get_child(i);
+      CollisionShape2D *collision_shape = Object::cast_to<CollisionShape2D>(child);
+      if (collision_shape != nullptr && !collision_shape->is_disabled()) {
+        VisibilityPolygon2D::get_shape_segments(
+            collision_shape->get_shape(), collision_shape->get_global_transform(), body_segments
+        );
+      }
+      CollisionPolygon2D *collision_polygon = Object::cast_to<CollisionPolygon2D>(child);
+      if (collision_polygon != nullptr && !collision_polygon->is_disabled()) {
+        bool closed = collision_polygon->get_build_mode() == CollisionPolygon2D::BUILD_SOLIDS;
+        VisibilityPolygon2D::get_polyline_segments(
+            collision_polygon->get_polygon(), collision_polygon->get_global_transform(), closed,
+            body_segments
+        );
+      }
+    }
+
+    occluder_index_2d.set_body(body->get_instance_id(), body->get_collision_layer(), body_segments);
+    indexed_bodies_2d.push_back({body->get_instance_id(), body->get_global_transform()});
+  } else if (PhysicsBody3D *body = Object::cast_to<PhysicsBody3D>(p_body)) {
+    if (occluder_index_users_3d == 0 || (body->get_collision_layer() & occluder_layers) == 0) {
+      return;
+    }
+
+    body_triangles.clear();
+    for (int i = 0; i < body->get_child_count(); i++) {
+      CollisionShape3D *collision_shape = Object::cast_to<CollisionShape3D>(body->get_child(i));
+      if (collision_shape != nullptr && !collision_shape->is_disabled()) {
+        OccluderIndex3D::get_shape_triangles(
+            collision_shape->get_shape(), collision_shape->get_global_transform(), body_triangles
+        );
+      }
+    }
+
+    occluder_index_3d.set_body(
+        body->get_instance_id(), body->get_collision_layer(), body_triangles
+    );
+    indexed_bodies_3d.push_back({body->get_instance_id(), body->get_global_transform()});
+  }
+}
+
+void LineOfSightServer::unindex_body(const uint64_t p_body) {
+  occluder_index_2d.remove_body(p_body);
+  occluder_index_3d.remove_body(p_body);
+  for (uint32_t i = 0; i < indexed_bodies_2d.size(); i++) {
+    if (indexed_bodies_2d[i].id == p_body) {
+      indexed_bodies_2d.remove_at_unordered(i);
+      break;
+    }
+  }
+  for (uint32_t i = 0; i < indexed_bodies_3d.size(); i++) {
+    if (indexed_bodies_3d[i].id == p_body) {
+      indexed_bodies_3d.remove_at_unordered(i);
+      break;
+    }
+  }
+}
+
+/// @brief Bring the occluder index up to date with the scene. Runs before the sweeps.
+///
+/// Only the bodies which moved, or whose shapes were added or removed, are indexed again.
+void LineOfSightServer::refresh_occluder_index() {
+  for (uint32_t i = 0; i < indexed_bodies_2d.size(); i++) {
+    Node2D *body = Object::cast_to<Node2D>(ObjectDB::get_instance(indexed_bodies_2d[i].id));
+    if (body == nullptr || body->get_global_transform() != indexed_bodies_2d[i].transform) {
+      dirty_bodies.push_back(indexed_bodies_2d[i].id);
+    }
+  }
+  for (uint32_t i = 0; i < indexed_bodies_3d.size(); i++) {
+    Node3D *body = Object::cast_to<Node3D>(ObjectDB::get_instance(indexed_bodies_3d[i].id));
+    if (body == nullptr || body->get_global_transform() != indexed_bodies_3d[i].transform) {
+      dirty_bodies.push_back(indexed_bodies_3d[i].id);
+    }
+  }
+  for (uint32_t i = 0; i < dirty_bodies.size(); i++) {
+    unindex_body(dirty_bodies[i]);
+    Node *body = Object::cast_to<Node>(ObjectDB::get_instance(dirty_bodies[i]));
+    if (body != nullptr && body->is_inside_tree()) {
+      index_body(body);
+    }
+  }
+  dirty_bodies.clear();
+}
+
+int LineOfSightServer::get_agent_count() const {
+  return agents_2d.size() + agents_3d.size() + scheduled.size();
+}
+
+/// @brief Get a counter summed over every node during the last complete frame.
+int64_t LineOfSightServer::get_frame_counter(const Counter p_counter) const {
+  ERR_FAIL_INDEX_V(p_counter, COUNTER_MAX, 0);
+  return last_frame_counters[p_counter];
+}
+
+/// @brief Get the share of the rays predicted by the ray caches during the last complete frame.
+double LineOfSightServer::get_ray_cache_hit_rate() const {
+  int64_t hits = last_frame_counters[COUNTER_RAY_CACHE_HITS];
+  int64_t lookups = hits + last_frame_counters[COUNTER_RAY_CACHE_MISSES];
+  return lookups > 0 ? (double)hits / lookups : 0.0;
+}
+
+Dictionary LineOfSightServer::get_frame_stats() const {
+  Dictionary stats;
+  for (int i = 0; i < COUNTER_MAX; i++) {
+    stats[counter_names[i]] = last_frame_counters[i];
+  }
+  return stats;
+}
+
+/// @brief Get the shader drawing the cone of a 2D node from its distance texture. It is created
+/// once and shared by every node. Must run on the main thread.
+Ref<Shader> LineOfSightServer::get_distance_shader_2d() {
+  if (distance_shader_2d.is_null()) {
+    distance_shader_2d.instantiate();
+    distance_shader_2d->set_code(
+        build_distance_shader_code(distance_shader_2d_header, distance_shader_2d_code)
+    );
+  }
+  return distance_shader_2d;
+}
+
+/// @brief Get the shader drawing the cone of a 3D node from its distance texture.
+Ref<Shader> LineOfSightServer::get_distance_shader_3d() {
+  if (distance_shader_3d.is_null()) {
+    distance_shader_3d.instantiate();
+    distance_shader_3d->set_code(
+        build_distance_shader_code(distance_shader_3d_header, distance_shader_3d_code)
+    );
+  }
+  return distance_shader_3d;
+}
@@ -0,0 +1,211 @@
+#ifndef LINEOFSIGHT_SERVER_H
+#define LINEOFSIGHT_SERVER_H
+
+#include "occluderindex2d.h"
+#include "occluderindex3d.h"
+
+#include <godot_cpp/classes/object.hpp>
+#include <godot_cpp/classes/scene_tree.hpp>
+#include <godot_cpp/classes/shader.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+
+#include <atomic>
+#include <mutex>
+
+using namespace godot;
+
+class LineOfSight2D;
+class LineOfSight3D;
+
+/// @brief Computes the line of sight of every registered node in parallel.
+///
+/// The sweeps are run on the WorkerThreadPool at the start of each physics frame, when the space
+/// states can be queried. Each node then commits its own mesh on the main thread in _process().
+///
+/// The sweeps querying the physics servers hold physics_mutex by default, so the raycast sweeps
+/// only scale over the cores with parallel_physics_queries, on a backend known to take concurrent
+/// queries, or with use_occluder_index or use_tile_map, whose rays run in the library.
+class LineOfSightServer : public Object {
+  GDCLASS(LineOfSightServer, Object)
+
+public:
+  enum Counter {
+    COUNTER_TIME_USEC,              // The time spent in the sweeps and the mesh updates.
+    COUNTER_RAYS,                   // The rays cast.
+    COUNTER_EDGES,                  // The edges resolved by find_edge().
+    COUNTER_BISECTION_RAYS,         // The rays cast while resolving the edges.
+    COUNTER_VERTICES,               // The vertices written to the meshes.
+    COUNTER_NODES_UPDATED,          // The nodes whose sweep was computed.
+    COUNTER_NODES_SKIPPED,          // The nodes whose sweep was skipped.
+    COUNTER_RAY_CACHE_HITS,         // The rays predicted by the ray caches.
+    COUNTER_RAY_CACHE_MISSES,       // The rays the ray caches couldn't predict.
+    COUNTER_VERTICES_UNSIMPLIFIED,  // The vertices of the meshes before simplifying them.
+    COUNTER_MAX,
+  };
+
+  enum FocusMode {
+    FOCUS_NONE,    // Schedule the nodes by priority only.
+    FOCUS_CAMERA,  // Favour the nodes close to the camera of their viewport.
+    FOCUS_NODE,    // Favour the nodes close to the focus node (e.g. the player).
+  };
+
+private:
+  // A node updated when it fits in the budget, with its scheduling state.
+  struct ScheduledAgent {
+    LineOfSight2D *agent_2d;  // The node, if it is a 2D one.
+    LineOfSight3D *agent_3d;  // The node, if it is a 3D one.
+    int64_t frames_waiting;   // The physics frames since its last update.
+    double urgency;           // The order of the node in the current frame.
+
+    // Sort the most urgent nodes first.
+    bool operator<(const ScheduledAgent &p_other) const { return urgency > p_other.urgency; }
+  };
+
+  // A body of the occluder index, with the transform its shapes were indexed at.
+  struct IndexedBody2D {
+    uint64_t id;            // The instance id of the body.
+    Transform2D transform;  // The global transform of the body.
+  };
+
+  struct IndexedBody3D {
+    uint64_t id;            // The instance id of the body.
+    Transform3D transform;  // The global transform of the body.
+  };
+
+  static LineOfSightServer *singleton;
+
+  LocalVector<LineOfSight2D *> agents_2d;   // The 2D nodes updated by the server.
+  LocalVector<LineOfSight3D *> agents_3d;   // The 3D nodes updated by the server.
+  LocalVector<LineOfSight2D *> pending_2d;  // The 2D nodes whose sweep must be computed.
+  LocalVector<LineOfSight3D *> pending_3d;  // The 3D nodes whose sweep must be computed.
+  LocalVector<ScheduledAgent> scheduled;    // The nodes updated within the budget.
+
+  SceneTree *tree;                // The tree whose physics frames drive the updates.
+  bool parallel_physics_queries;  // Whether the physics backend supports concurrent queries.
+  int64_t time_budget_usec;       // The estimated time of the scheduled updates per frame.
+  int64_t ray_budget;             // The estimated rays of the scheduled updates per frame.
+  FocusMode focus_mode;           // What the scheduled nodes are prioritised by.
+  uint64_t focus_node;            // The instance id of the node of FOCUS_NODE.
+  double lod_distance;            // The distance beyond which the resolution is lowered.
+  double lod_min_scale;           // The lowest factor applied to the resolution.
+  std::mutex physics_mutex;       // Serializes the physics queries when they are not parallel.
+
+  OccluderIndex2D occluder_index_2d;             // The occluders shared by the 2D nodes.
+  OccluderIndex3D occluder_index_3d;             // The occluders shared by the 3D nodes.
+  LocalVector<IndexedBody2D> indexed_bodies_2d;  // The bodies of the 2D index.
+  LocalVector<IndexedBody3D> indexed_bodies_3d;  // The bodies of the 3D index.
+  LocalVector<uint64_t> dirty_bodies;            // The bodies added, removed or reshaped.
+  uint32_t occluder_layers;                      // The collision layers of the indexed bodies.
+  int occluder_index_users_2d;                   // The 2D nodes using the index.
+  int occluder_index_users_3d;                   // The 3D nodes using the index.
+
+  LocalVector<OccluderIndex2D::Segment> body_segments;    // The segments of the indexed body.
+  LocalVector<OccluderIndex3D::Triangle> body_triangles;  // The triangles of the indexed body.
+
+  std::atomic<int64_t> frame_counters[COUNTER_MAX];  // The counters of the current frame.
+  int64_t last_frame_counters[COUNTER_MAX];          // The counters of the last complete frame.
+  bool monitors_registered;                          // Whether the monitors were added.
+
+  Ref<Shader> distance_shader_2d;  // The shader drawing the distance textures of the 2D nodes.
+  Ref<Shader> distance_shader_3d;  // The shader drawing the distance textures of the 3D nodes.
+
+  void register_monitors();
+  void unregister_monitors();
+
+  void schedule_agents();
+
+  void refresh_occluder_index();
+  void index_tree(Node *p_node);
+  void index_body(Node *p_body);
+  void unindex_body(const uint64_t p_body);
+  void mark_body_dirty(Node *p_node);
+  double get_focus_distance(const ScheduledAgent &p_agent, Object *p_focus) const;
+
+protected:
+  static void _bind_methods();
+
+public:
+  static LineOfSightServer *get_singleton();
+
+  LineOfSightServer();
+  ~LineOfSightServer();
+
+  void register_agent_2d(LineOfSight2D *p_agent);
+  void unregister_agent_2d(LineOfSight2D *p_agent);
+  void register_agent_3d(LineOfSight3D *p_agent);
+  void unregister_agent_3d(LineOfSight3D *p_agent);
+
+  void set_parallel_physics_queries(const bool p_parallel_physics_queries);
+  bool get_parallel_physics_queries() const;
+
+  void set_time_budget_usec(const int64_t p_time_budget_usec);
+  int64_t get_time_budget_usec() const;
+
+  void set_ray_budget(const int64_t p_ray_budget);
+  int64_t get_ray_budget() const;
+
+  void set_focus_mode(const FocusMode p_focus_mode);
+  FocusMode get_focus_mode() const;
+
+  void set_focus_node(Node *p_focus_node);
+  Node *get_focus_node() const;
+
+  void set_lod_distance(const double p_lod_distance);
+  double get_lod_distance() const;
+
+  void set_lod_min_scale(const double p_lod_min_scale);
+  double get_lod_min_scale() const;
+
+  void set_occluder_layers(const uint32_t p_occluder_layers);
+  uint32_t get_occluder_layers() const;
+
+  void set_occluder_cell_size_2d(const double p_cell_size);
+  double get_occluder_cell_size_2d() const;
+
+  void set_occluder_cell_size_3d(const double p_cell_size);
+  double get_occluder_cell_size_3d() const;
+
+  void acquire_occluder_index_2d();
+  void release_occluder_index_2d();
+  void acquire_occluder_index_3d();
+  void release_occluder_index_3d();
+  const OccluderIndex2D *get_occluder_index_2d() const;
+  const OccluderIndex3D *get_occluder_index_3d() const;
+  void rebuild_occluder_index();
+  int get_occluder_body_count() const;
+  Dictionary intersect_occluder_ray_2d(
+      const Vector2 &p_from, const Vector2 &p_to, const uint32_t p_collision_mask
+  ) const;
+  String get_occluder_kernel() const;
+
+  int get_agent_count() const;
+
+  void connect_tree(SceneTree *p_tree);
+
+  void run_tasks(const Callable &p_task, const int p_count, const String &p_description);
+  std::unique_lock<std::mutex> lock_physics_queries(const bool p_uses_physics_queries);
+
+  /// @brief Add to a counter of the current frame. Safe to call from any thread.
+  _FORCE_INLINE_ void add_to_counter(const Counter p_counter, const int64_t p_value) {
+    frame_counters[p_counter].fetch_add(p_value, std::memory_order_relaxed);
+  }
+  int64_t get_frame_counter(const Counter p_counter) const;
+  double get_ray_cache_hit_rate() const;
+  Dictionary get_frame_stats() const;
+
+  Ref<Shader> get_distance_shader_2d();
+  Ref<Shader> get_distance_shader_3d();
+
+  void update();
+
+  void _on_physics_frame();
+  void _on_process_frame();
+  void _on_node_added(Node *p_node);
+  void _on_node_removed(Node *p_node);
+  void _compute_agent(const int p_index);
+};
+
+VARIANT_ENUM_CAST(LineOfSightServer::Counter);
+VARIANT_ENUM_CAST(LineOfSightServer::FocusMode);
+
+#endif
@@ -0,0 +1,441 @@
+#include "occluderindex2d.h"
+
+#include <godot_cpp/core/error_macros.hpp>
+#include <godot_cpp/core/math.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define OCCLUDER_INDEX_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 is enabled per function and checked at runtime, so the library still loads on older CPUs.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define OCCLUDER_INDEX_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace godot;
+
+// The number of buckets the cells are hashed into, a power of two.
+static const int BUCKET_COUNT = 4096;
+
+// A ray tested against the segments of a bucket, with the closest hit found so far.
+struct SegmentRay {
+  float from_x;
+  float from_y;
+  float direction_x;
+  float direction_y;
+  uint32_t mask;                        // The collision layers which occlude the ray.
+  const LocalVector<uint64_t> *exclude;  // The bodies which don't occlude the ray.
+  float best_t;                         // The fraction of the ray at the closest hit.
+};
+
+typedef void (*SegmentKernel)(const OccluderIndex2D::Bucket &p_bucket, SegmentRay &r_ray);
+
+/// @brief Keep a hit found by a kernel if it is the closest one and its body isn't excluded.
+static _FORCE_INLINE_ void accept_hit(
+    const OccluderIndex2D::Bucket &p_bucket, const uint32_t p_position, const float p_t,
+    SegmentRay &r_ray
+) {
+  if (p_t < r_ray.best_t && r_ray.exclude->find(p_bucket.bodies[p_position]) == -1) {
+    r_ray.best_t = p_t;
+  }
+}
+
+/// @brief Test the segments of a bucket one by one, from the given position.
+static void test_segment_range(
+    const OccluderIndex2D::Bucket &p_bucket, const uint32_t p_begin, SegmentRay &r_ray
+) {
+  for (uint32_t i = p_begin; i < p_bucket.segments.size(); i++) {
+    if ((p_bucket.layers[i] & r_ray.mask) == 0) {
+      continue;
+    }
+
+    float edge_x = p_bucket.edge_x[i];
+    float edge_y = p_bucket.edge_y[i];
+    float denominator = r_ray.direction_x * edge_y - r_ray.direction_y * edge_x;
+    if (Math::abs(denominator) <= (float)CMP_EPSILON) {
+      continue;
+    }
+    float offset_x = p_bucket.a_x[i] - r_ray.from_x;
+    float offset_y = p_bucket.a_y[i] - r_ray.from_y;
+    float t = (offset_x * edge_y - offset_y * edge_x) / denominator;
+    float u = (offset_x * r_ray.direction_y - offset_y * r_ray.direction_x) / denominator;
+    if (t >= 0 && t <= 1 && u >= 0 && u <= 1) {
+      accept_hit(p_bucket, i, t, r_ray);
+    }
+  }
+}
+
+/// @brief Test the segments of a bucket one by one. The reference of the vector kernels.
+static void test_segments_scalar(const OccluderIndex2D::Bucket &p_bucket, SegmentRay &r_ray) {
+  test_segment_range(p_bucket, 0, r_ray);
+}
+
+#ifdef OCCLUDER_INDEX_SSE2
+/// @brief Test the segments of a bucket four at a time.
+static void test_segments_sse2(const OccluderIndex2D::Bucket &p_bucket, SegmentRay &r_ray) {
+  const __m128 from_x = _mm_set1_ps(r_ray.from_x);
+  const __m128 from_y = _mm_set1_ps(r_ray.from_y);
+  const __m128 direction_x = _mm_set1_ps(r_ray.direction_x);
+  const __m128 direction_y = _mm_set1_ps(r_ray.direction_y);
+  const __m128i mask = _mm_set1_epi32((int)r_ray.mask);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1);
+  const __m128 epsilon = _mm_set1_ps((float)CMP_EPSILON);
+  const __m128 sign = _mm_set1_ps(-0.0f);
+
+  uint32_t count = p_bucket.segments.size();
+  uint32_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 edge_x = _mm_loadu_ps(p_bucket.edge_x.ptr() + i);
+    __m128 edge_y = _mm_loadu_ps(p_bucket.edge_y.ptr() + i);
+    __m128 offset_x = _mm_sub_ps(_mm_loadu_ps(p_bucket.a_x.ptr() + i), from_x);
+    __m128 offset_y = _mm_sub_ps(_mm_loadu_ps(p_bucket.a_y.ptr() + i), from_y);
+
+    __m128 denominator =
+        _mm_sub_ps(_mm_mul_ps(direction_x, edge_y), _mm_mul_ps(direction_y, edge_x));
+    __m128 t = _mm_div_ps(
+        _mm_sub_ps(_mm_mul_ps(offset_x, edge_y), _mm_mul_ps(offset_y, edge_x)), denominator
+    );
+    __m128 u = _mm_div_ps(
+        _mm_sub_ps(_mm_mul_ps(offset_x, direction_y), _mm_mul_ps(offset_y, direction_x)),
+        denominator
+    );
+
+    __m128 valid = _mm_cmpgt_ps(_mm_andnot_ps(sign, denominator), epsilon);
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmple_ps(t, one)));
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+    valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(r_ray.best_t)));
+
+    // Drop the segments of the bodies on other layers.
+    __m128i layers = _mm_loadu_si128((const __m128i *)(p_bucket.layers.ptr() + i));
+    __m128i masked = _mm_cmpeq_epi32(_mm_and_si128(layers, mask), _mm_setzero_si128());
+    valid = _mm_andnot_ps(_mm_castsi128_ps(masked), valid);
+
+    int lanes = _mm_movemask_ps(valid);
+    if (lanes != 0) {
+      float ts[4];
+      _mm_storeu_ps(ts, t);
+      for (int lane = 0; lane < 4; lane++) {
+        if (lanes & (1 << lane)) {
+          accept_hit(p_bucket, i + lane, ts[lane], r_ray);
+        }
+      }
+    }
+  }
+
+  test_segment_range(p_bucket, i, r_ray);
+}
+#endif
+
+#ifdef OCCLUDER_INDEX_AVX2
+/// @brief Test the segments of a bucket eight at a time.
+__attribute__((target("avx2"))) static void test_segments_avx2(
+    const OccluderIndex2D::Bucket &p_bucket, SegmentRay &r_ray
+) {
+  const __m256 from_x = _mm256_set1_ps(r_ray.from_x);
+  const __m256 from_y = _mm256_set1_ps(r_ray.from_y);
+  const __m256 direction_x = _mm256_set1_ps(r_ray.direction_x);
+  const __m256 direction_y = _mm256_set1_ps(r_ray.direction_y);
+  const __m256i mask = _mm256_set1_epi32((int)r_ray.mask);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1);
+  const __m256 epsilon = _mm256_set1_ps((float)CMP_EPSILON);
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+
+  uint32_t count = p_bucket.segments.size();
+  uint32_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 edge_x = _mm256_loadu_ps(p_bucket.edge_x.ptr() + i);
+    __m256 edge_y = _mm256_loadu_ps(p_bucket.edge_y.ptr() + i);
+    __m256 offset_x = _mm256_sub_ps(_mm256_loadu_ps(p_bucket.a_x.ptr() + i), from_x);
+    __m256 offset_y = _mm256_sub_ps(_mm256_loadu_ps(p_bucket.a_y.ptr() + i), from_y);
+
+    __m256 denominator =
+        _mm256_sub_ps(_mm256_mul_ps(direction_x, edge_y), _mm256_mul_ps(direction_y, edge_x));
+    __m256 t = _mm256_div_ps(
+        _mm256_sub_ps(_mm256_mul_ps(offset_x, edge_y), _mm256_mul_ps(offset_y, edge_x)),
+        denominator
+    );
+    __m256 u = _mm256_div_ps(
+        _mm256_sub_ps(_mm256_mul_ps(offset_x, direction_y), _mm256_mul_ps(offset_y, direction_x)),
+        denominator
+    );
+
+    __m256 valid = _mm256_cmp_ps(_mm256_andnot_ps(sign, denominator), epsilon, _CMP_GT_OQ);
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, one, _CMP_LE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(r_ray.best_t), _CMP_LT_OQ));
+
+    // Drop the segments of the bodies on other layers.
+    __m256i layers = _mm256_loadu_si256((const __m256i *)(p_bucket.layers.ptr() + i));
+    __m256i masked = _mm256_cmpeq_epi32(_mm256_and_si256(layers, mask), _mm256_setzero_si256());
+    valid = _mm256_andnot_ps(_mm256_castsi256_ps(masked), valid);
+
+    int lanes = _mm256_movemask_ps(valid);
+    if (lanes != 0) {
+      float ts[8];
+      _mm256_storeu_ps(ts, t);
+      for (int lane = 0; lane < 8; lane++) {
+        if (lanes & (1 << lane)) {
+          accept_hit(p_bucket, i + lane, ts[lane], r_ray);
+        }
+      }
+    }
+  }
+
+  test_segment_range(p_bucket, i, r_ray);
+}
+#endif
+
+struct SegmentKernelInfo {
+  SegmentKernel kernel;
+  const char *name;
+};
+
+/// @brief Pick the widest kernel supported by the CPU running the library.
+static SegmentKernelInfo select_segment_kernel() {
+#ifdef OCCLUDER_INDEX_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {test_segments_avx2, "avx2"};
+  }
+#endif
+#ifdef OCCLUDER_INDEX_SSE2
+  return {test_segments_sse2, "sse2"};
+#else
+  return {test_segments_scalar, "scalar"};
+#endif
+}
+
+static const SegmentKernelInfo segment_kernel = select_segment_kernel();
+
+/// @brief Get the name of the kernel testing the segments: "avx2", "sse2" or "scalar".
+const char *OccluderIndex2D::get_kernel_name() { return segment_kernel.name; }
+
+void OccluderIndex2D::Bucket::push_back(
+    const Segment &p_segment, const uint32_t p_layer, const uint64_t p_body,
+    const uint32_t p_index
+) {
+  a_x.push_back(p_segment.a.x);
+  a_y.push_back(p_segment.a.y);
+  edge_x.push_back(p_segment.b.x - p_segment.a.x);
+  edge_y.push_back(p_segment.b.y - p_segment.a.y);
+  layers.push_back(p_layer);
+  bodies.push_back(p_body);
+  segments.push_back(p_index);
+}
+
+void OccluderIndex2D::Bucket::remove_at_unordered(const uint32_t p_position) {
+  a_x.remove_at_unordered(p_position);
+  a_y.remove_at_unordered(p_position);
+  edge_x.remove_at_unordered(p_position);
+  edge_y.remove_at_unordered(p_position);
+  layers.remove_at_unordered(p_position);
+  bodies.remove_at_unordered(p_position);
+  segments.remove_at_unordered(p_position);
+}
+
+void OccluderIndex2D::Bucket::clear() {
+  a_x.clear();
+  a_y.clear();
+  edge_x.clear();
+  edge_y.clear();
+  layers.clear();
+  bodies.clear();
+  segments.clear();
+}
+
+OccluderIndex2D::OccluderIndex2D() {
+  cell_size = 64;
+  buckets.resize(BUCKET_COUNT);
+}
+
+uint32_t OccluderIndex2D::get_bucket(const int p_x, const int p_y) const {
+  uint32_t hash = ((uint32_t)p_x * 73856093u) ^ ((uint32_t)p_y * 19349663u);
+  return hash & (BUCKET_COUNT - 1);
+}
+
+/// @brief Visit the cells crossed by a segment, in order from its start.
+/// @param p_visit Called with the cell coordinates and the fraction of the segment at which it
+/// leaves the cell. The walk stops when it returns false.
+template <class F>
+void OccluderIndex2D::walk_cells(const Vector2 &p_from, const Vector2 &p_to, F p_visit) const {
+  Vector2 from = p_from / cell_size;
+  Vector2 to = p_to / cell_size;
+  Vector2 delta = to - from;
+
+  int x = (int)Math::floor(from.x);
+  int y = (int)Math::floor(from.y);
+  int end_x = (int)Math::floor(to.x);
+  int end_y = (int)Math::floor(to.y);
+  int step_x = delta.x > 0 ? 1 : -1;
+  int step_y = delta.y > 0 ? 1 : -1;
+
+  // The fraction of the segment between two cell borders, and up to the next border.
+  double t_delta_x = delta.x != 0 ? Math::abs(1.0 / delta.x) : Math_INF;
+  double t_delta_y = delta.y != 0 ? Math::abs(1.0 / delta.y) : Math_INF;
+  double t_max_x = delta.x != 0 ? (step_x > 0 ? x + 1 - from.x : from.x - x) * t_delta_x : Math_INF;
+  double t_max_y = delta.y != 0 ? (step_y > 0 ? y + 1 - from.y : from.y - y) * t_delta_y : Math_INF;
+
+  // Bound the walk by the number of cells, so rounding errors can't make it run away.
+  int steps = Math::abs(end_x - x) + Math::abs(end_y - y);
+  for (int i = 0; i <= steps; i++) {
+    if (!p_visit(x, y, MIN(1.0, MIN(t_max_x, t_max_y)))) {
+      return;
+    }
+    if (t_max_x < t_max_y) {
+      x += step_x;
+      t_max_x += t_delta_x;
+    } else {
+      y += step_y;
+      t_max_y += t_delta_y;
+    }
+  }
+}
+
+void OccluderIndex2D::insert_segment(const uint32_t p_index) {
+  const IndexedSegment &segment = segments[p_index];
+  walk_cells(segment.a, segment.b, [&](int p_x, int p_y, double /*p_t_exit*/) {
+    buckets[get_bucket(p_x, p_y)].push_back(
+        Segment(segment.a, segment.b), segment.layer, segment.body, p_index
+    );
+    return true;
+  });
+}
+
+void OccluderIndex2D::remove_segment(const uint32_t p_index) {
+  const IndexedSegment &segment = segments[p_index];
+  walk_cells(segment.a, segment.b, [&](int p_x, int p_y, double /*p_t_exit*/) {
+    Bucket &bucket = buckets[get_bucket(p_x, p_y)];
+    int64_t position = bucket.segments.find(p_index);
+    if (position != -1) {
+      bucket.remove_at_unordered(position);
+    }
+    return true;
+  });
+}
+
+void OccluderIndex2D::clear() {
+  segments.clear();
+  free_segments.clear();
+  bodies.clear();
+  for (uint32_t i = 0; i < buckets.size(); i++) {
+    buckets[i].clear();
+  }
+}
+
+/// @brief Change the size of the cells, which rebuilds the grid.
+void OccluderIndex2D::set_cell_size(const double p_cell_size) {
+  if (p_cell_size <= 0 || p_cell_size == cell_size) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < buckets.size(); i++) {
+    buckets[i].clear();
+  }
+  cell_size = p_cell_size;
+  for (uint32_t i = 0; i < segments.size(); i++) {
+    if (segments[i].body != 0) {
+      insert_segment(i);
+    }
+  }
+}
+
+double OccluderIndex2D::get_cell_size() const { return cell_size; }
+
+/// @brief Add a body, or replace the segments of a body already in the index.
+/// @param p_body The instance id of the body.
+/// @param p_layer The collision layer of the body.
+/// @param p_segments The segments of the body, in global coordinates.
+void OccluderIndex2D::set_body(
+    const uint64_t p_body, const uint32_t p_layer, const LocalVector<Segment> &p_segments
+) {
+  remove_body(p_body);
+
+  LocalVector<uint32_t> &body_segments = bodies[p_body];
+  body_segments.reserve(p_segments.size());
+  for (uint32_t i = 0; i < p_segments.size(); i++) {
+    uint32_t index;
+    if (free_segments.is_empty()) {
+      index = segments.size();
+      segments.push_back(IndexedSegment());
+    } else {
+      index = free_segments[free_segments.size() - 1];
+      free_segments.resize(free_segments.size() - 1);
+    }
+
+    IndexedSegment &segment = segments[index];
+    segment.a = p_segments[i].a;
+    segment.b = p_segments[i].b;
+    segment.body = p_body;
+    segment.layer = p_layer;
+    insert_segment(index);
+    body_segments.push_back(index);
+  }
+}
+
+void OccluderIndex2D::remove_body(const uint64_t p_body) {
+  LocalVector<uint32_t> *body_segments = bodies.getptr(p_body);
+  if (body_segments == nullptr) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < body_segments->size(); i++) {
+    uint32_t index = (*body_segments)[i];
+    remove_segment(index);
+    segments[index].body = 0;
+    free_segments.push_back(index);
+  }
+  bodies.erase(p_body);
+}
+
+bool OccluderIndex2D::has_body(const uint64_t p_body) const { return bodies.has(p_body); }
+
+int OccluderIndex2D::get_body_count() const { return bodies.size(); }
+
+int OccluderIndex2D::get_segment_count() const { return segments.size() - free_segments.size(); }
+
+/// @brief Find the first segment hit by a ray.
+/// @param p_mask The collision layers which occlude the ray.
+/// @param p_exclude The instance ids of the bodies which don't occlude the ray.
+/// @param r_point The point at which the ray hit a segment.
+/// @return Whether a segment was hit.
+bool OccluderIndex2D::intersect_ray(
+    const Vector2 &p_from, const Vector2 &p_to, const uint32_t p_mask,
+    const LocalVector<uint64_t> &p_exclude, Vector2 &r_point
+) const {
+  SegmentRay ray;
+  ray.from_x = p_from.x;
+  ray.from_y = p_from.y;
+  ray.direction_x = p_to.x - p_from.x;
+  ray.direction_y = p_to.y - p_from.y;
+  ray.mask = p_mask;
+  ray.exclude = &p_exclude;
+  ray.best_t = Math_INF;
+
+  walk_cells(p_from, p_to, [&](int p_x, int p_y, double p_t_exit) {
+    const Bucket &bucket = buckets[get_bucket(p_x, p_y)];
+#ifdef DEV_ENABLED
+    // Check the vector kernel against the scalar one.
+    SegmentRay reference = ray;
+    test_segments_scalar(bucket, reference);
+    segment_kernel.kernel(bucket, ray);
+    DEV_ASSERT(Math::is_equal_approx(reference.best_t, ray.best_t));
+#else
+    segment_kernel.kernel(bucket, ray);
+#endif
+
+    // A hit in a later cell could be closer than this one, until the ray leaves the cell.
+    return ray.best_t > p_t_exit;
+  });
+
+  if (ray.best_t == Math_INF) {
+    return false;
+  }
+  r_point = p_from + (p_to - p_from) * ray.best_t;
+  return true;
+}
@@ -0,0 +1,91 @@
+#ifndef OCCLUDER_INDEX_2D_H
+#define OCCLUDER_INDEX_2D_H
+
+#include "visibilitypolygon2d.h"
+
+#include <godot_cpp/templates/hash_map.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+#include <godot_cpp/variant/vector2.hpp>
+
+using namespace godot;
+
+/// @brief A spatial hash of occluder segments, queried with rays instead of the physics server.
+///
+/// Every segment is stored in the cells of a uniform grid that it crosses. A ray walks the cells it
+/// crosses in order and stops at the first cell holding a hit, so it only tests the segments close
+/// to it. The segments of a body are replaced as a whole when the body moves. Queries don't modify
+/// the index and can run concurrently.
+///
+/// The segments of a cell are tested several at once with SSE2 or AVX2, picked when the library is
+/// loaded, with a scalar fallback on the other CPUs.
+class OccluderIndex2D {
+public:
+  typedef VisibilityPolygon2D::Segment Segment;
+
+  // The segments of the cells sharing a hash, stored by component so that they can be loaded
+  // straight into vector registers.
+  struct Bucket {
+    LocalVector<float> a_x;          // The x coordinate of the first end (a) of each segment.
+    LocalVector<float> a_y;          // The y coordinate of the first end (a) of each segment.
+    LocalVector<float> edge_x;       // The x component of the vector from a to b.
+    LocalVector<float> edge_y;       // The y component of the vector from a to b.
+    LocalVector<uint32_t> layers;    // The collision layer of the body of each segment.
+    LocalVector<uint64_t> bodies;    // The instance id of the body of each segment.
+    LocalVector<uint32_t> segments;  // The index of each segment in the index.
+
+    void push_back(
+        const Segment &p_segment, const uint32_t p_layer, const uint64_t p_body,
+        const uint32_t p_index
+    );
+    void remove_at_unordered(const uint32_t p_position);
+    void clear();
+  };
+
+  static const char *get_kernel_name();
+
+private:
+  // A segment with the body it belongs to.
+  struct IndexedSegment {
+    Vector2 a;       // The first end of the segment, in global coordinates.
+    Vector2 b;       // The second end of the segment, in global coordinates.
+    uint64_t body;   // The instance id of the body, 0 if the slot is free.
+    uint32_t layer;  // The collision layer of the body.
+  };
+
+  double cell_size;                                 // The size of the cells of the grid.
+  LocalVector<IndexedSegment> segments;             // The segments, with free slots.
+  LocalVector<uint32_t> free_segments;              // The free slots of the segments.
+  HashMap<uint64_t, LocalVector<uint32_t>> bodies;  // The segments of every body.
+  LocalVector<Bucket> buckets;                      // The segments of the cells, by cell hash.
+
+  uint32_t get_bucket(const int p_x, const int p_y) const;
+  void insert_segment(const uint32_t p_index);
+  void remove_segment(const uint32_t p_index);
+
+  template <class F>
+  void walk_cells(const Vector2 &p_from, const Vector2 &p_to, F p_visit) const;
+
+public:
+  void clear();
+
+  void set_cell_size(const double p_cell_size);
+  double get_cell_size() const;
+
+  void set_body(
+      const uint64_t p_body, const uint32_t p_layer, const LocalVector<Segment> &p_segments
+  );
+  void remove_body(const uint64_t p_body);
+  bool has_body(const uint64_t p_body) const;
+
+  int get_body_count() const;
+  int get_segment_count() const;
+
+  bool intersect_ray(
+      const Vector2 &p_from, const Vector2 &p_to, const uint32_t p_mask,
+      const LocalVector<uint64_t> &p_exclude, Vector2 &r_point
+  ) const;
+
+  OccluderIndex2D();
+};
+
+#endif
@@ -0,0 +1,308 @@
+#include "occluderindex3d.h"
+
+#include <godot_cpp/classes/box_shape3d.hpp>
+#include <godot_cpp/classes/capsule_shape3d.hpp>
+#include <godot_cpp/classes/concave_polygon_shape3d.hpp>
+#include <godot_cpp/classes/convex_polygon_shape3d.hpp>
+#include <godot_cpp/classes/cylinder_shape3d.hpp>
+#include <godot_cpp/classes/sphere_shape3d.hpp>
+#include <godot_cpp/core/math.hpp>
+
+using namespace godot;
+
+// The number of buckets the cells are hashed into, a power of two.
+static const int BUCKET_COUNT = 4096;
+
+OccluderIndex3D::OccluderIndex3D() {
+  cell_size = 4;
+  buckets.resize(BUCKET_COUNT);
+}
+
+uint32_t OccluderIndex3D::get_bucket(const int p_x, const int p_y, const int p_z) const {
+  uint32_t hash =
+      ((uint32_t)p_x * 73856093u) ^ ((uint32_t)p_y * 19349663u) ^ ((uint32_t)p_z * 83492791u);
+  return hash & (BUCKET_COUNT - 1);
+}
+
+/// @brief Visit the cells crossed by a segment, in order from its start.
+/// @param p_visit Called with the cell coordinates and the fraction of the segment at which it
+/// leaves the cell. The walk stops when it returns false.
+template <class F>
+void OccluderIndex3D::walk_cells(const Vector3 &p_from, const Vector3 &p_to, F p_visit) const {
+  Vector3 from = p_from / cell_size;
+  Vector3 to = p_to / cell_size;
+  Vector3 delta = to - from;
+
+  int cell[3];
+  int steps = 0;
+  int step[3];
+  double t_delta[3];
+  double t_max[3];
+  for (int axis = 0; axis < 3; axis++) {
+    cell[axis] = (int)Math::floor(from[axis]);
+    step[axis] = delta[axis] > 0 ? 1 : -1;
+    steps += Math::abs((int)Math::floor(to[axis]) - cell[axis]);
+
+    // The fraction of the segment between two cell borders, and up to the next border.
+    if (delta[axis] != 0) {
+      t_delta[axis] = Math::abs(1.0 / delta[axis]);
+      double border = step[axis] > 0 ? cell[axis] + 1 - from[axis] : from[axis] - cell[axis];
+      t_max[axis] = border * t_delta[axis];
+    } else {
+      t_delta[axis] = Math_INF;
+      t_max[axis] = Math_INF;
+    }
+  }
+
+  // Bound the walk by the number of cells, so rounding errors can't make it run away.
+  for (int i = 0; i <= steps; i++) {
+    int axis = t_max[0] < t_max[1] ? (t_max[0] < t_max[2] ? 0 : 2) : (t_max[1] < t_max[2] ? 1 : 2);
+    if (!p_visit(cell[0], cell[1], cell[2], MIN(1.0, t_max[axis]))) {
+      return;
+    }
+    cell[axis] += step[axis];
+    t_max[axis] += t_delta[axis];
+  }
+}
+
+/// @brief Visit the cells covered by the bounding box of a triangle.
+template <class F>
+void OccluderIndex3D::visit_triangle_cells(const IndexedTriangle &p_triangle, F p_visit) const {
+  Vector3 min = p_triangle.a.min(p_triangle.b).min(p_triangle.c) / cell_size;
+  Vector3 max = p_triangle.a.max(p_triangle.b).max(p_triangle.c) / cell_size;
+  for (int x = (int)Math::floor(min.x); x <= (int)Math::floor(max.x); x++) {
+    for (int y = (int)Math::floor(min.y); y <= (int)Math::floor(max.y); y++) {
+      for (int z = (int)Math::floor(min.z); z <= (int)Math::floor(max.z); z++) {
+        p_visit(get_bucket(x, y, z));
+      }
+    }
+  }
+}
+
+void OccluderIndex3D::insert_triangle(const uint32_t p_index) {
+  visit_triangle_cells(triangles[p_index], [&](uint32_t p_bucket) {
+    buckets[p_bucket].push_back(p_index);
+  });
+}
+
+void OccluderIndex3D::remove_triangle(const uint32_t p_index) {
+  visit_triangle_cells(triangles[p_index], [&](uint32_t p_bucket) {
+    LocalVector<uint32_t> &bucket = buckets[p_bucket];
+    int64_t position = bucket.find(p_index);
+    if (position != -1) {
+      bucket.remove_at_unordered(position);
+    }
+  });
+}
+
+/// @brief Add the 12 triangles of a box.
+/// @param p_center The center of the box in local coordinates.
+/// @param p_half_size The half extents of the box.
+/// @param p_xform The transform from local to global coordinates.
+void OccluderIndex3D::add_box(
+    const Vector3 &p_center, const Vector3 &p_half_size, const Transform3D &p_xform,
+    LocalVector<Triangle> &r_triangles
+) {
+  Vector3 corners[8];
+  for (int i = 0; i < 8; i++) {
+    Vector3 sign = Vector3(i & 1 ? 1 : -1, i & 2 ? 1 : -1, i & 4 ? 1 : -1);
+    corners[i] = p_xform.xform(p_center + p_half_size * sign);
+  }
+
+  // The four corners of each face, by index in the corners.
+  static const int faces[6][4] = {
+      {0, 1, 3, 2}, {4, 6, 7, 5}, {0, 4, 5, 1}, {2, 3, 7, 6}, {0, 2, 6, 4}, {1, 5, 7, 3},
+  };
+  for (int i = 0; i < 6; i++) {
+    const int *face = faces[i];
+    r_triangles.push_back(Triangle(corners[face[0]], corners[face[1]], corners[face[2]]));
+    r_triangles.push_back(Triangle(corners[face[0]], corners[face[2]], corners[face[3]]));
+  }
+}
+
+/// @brief Get the triangles of a collision shape.
+///
+/// Boxes and concave meshes are exact. The other shapes are approximated by their bounding box.
+/// @param p_shape The shape to triangulate.
+/// @param p_xform The global transform of the shape.
+/// @param r_triangles The triangles are appended to this list, in global coordinates.
+void OccluderIndex3D::get_shape_triangles(
+    const Ref<Shape3D> &p_shape, const Transform3D &p_xform, LocalVector<Triangle> &r_triangles
+) {
+  if (BoxShape3D *box = Object::cast_to<BoxShape3D>(p_shape.ptr())) {
+    add_box(Vector3(), box->get_size() / 2.0, p_xform, r_triangles);
+  } else if (Object::cast_to<ConcavePolygonShape3D>(p_shape.ptr()) != nullptr) {
+    ConcavePolygonShape3D *concave = Object::cast_to<ConcavePolygonShape3D>(p_shape.ptr());
+    PackedVector3Array faces = concave->get_faces();
+    for (int i = 0; i + 2 < faces.size(); i += 3) {
+      r_triangles.push_back(Triangle(
+          p_xform.xform(faces[i]), p_xform.xform(faces[i + 1]), p_xform.xform(faces[i + 2])
+      ));
+    }
+  } else if (ConvexPolygonShape3D *convex = Object::cast_to<ConvexPolygonShape3D>(p_shape.ptr())) {
+    PackedVector3Array points = convex->get_points();
+    if (points.size() == 0) {
+      return;
+    }
+    Vector3 min = points[0];
+    Vector3 max = points[0];
+    for (int i = 1; i < points.size(); i++) {
+      min = min.min(points[i]);
+      max = max.max(points[i]);
+    }
+    add_box((min + max) / 2.0, (max - min) / 2.0, p_xform, r_triangles);
+  } else if (SphereShape3D *sphere = Object::cast_to<SphereShape3D>(p_shape.ptr())) {
+    double sphere_radius = sphere->get_radius();
+    add_box(Vector3(), Vector3(sphere_radius, sphere_radius, sphere_radius), p_xform, r_triangles);
+  } else if (CapsuleShape3D *capsule = Object::cast_to<CapsuleShape3D>(p_shape.ptr())) {
+    double capsule_radius = capsule->get_radius();
+    Vector3 half_size = Vector3(capsule_radius, capsule->get_height() / 2.0, capsule_radius);
+    add_box(Vector3(), half_size, p_xform, r_triangles);
+  } else if (CylinderShape3D *cylinder = Object::cast_to<CylinderShape3D>(p_shape.ptr())) {
+    double cylinder_radius = cylinder->get_radius();
+    Vector3 half_size = Vector3(cylinder_radius, cylinder->get_height() / 2.0, cylinder_radius);
+    add_box(Vector3(), half_size, p_xform, r_triangles);
+  }
+}
+
+void OccluderIndex3D::clear() {
+  triangles.clear();
+  free_triangles.clear();
+  bodies.clear();
+  for (uint32_t i = 0; i < buckets.size(); i++) {
+    buckets[i].clear();
+  }
+}
+
+/// @brief Change the size of the cells, which rebuilds the grid.
+void OccluderIndex3D::set_cell_size(const double p_cell_size) {
+  if (p_cell_size <= 0 || p_cell_size == cell_size) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < buckets.size(); i++) {
+    buckets[i].clear();
+  }
+  cell_size = p_cell_size;
+  for (uint32_t i = 0; i < triangles.size(); i++) {
+    if (triangles[i].body != 0) {
+      insert_triangle(i);
+    }
+  }
+}
+
+double OccluderIndex3D::get_cell_size() const { return cell_size; }
+
+/// @brief Add a body, or replace the triangles of a body already in the index.
+/// @param p_body The instance id of the body.
+/// @param p_layer The collision layer of the body.
+/// @param p_triangles The triangles of the body, in global coordinates.
+void OccluderIndex3D::set_body(
+    const uint64_t p_body, const uint32_t p_layer, const LocalVector<Triangle> &p_triangles
+) {
+  remove_body(p_body);
+
+  LocalVector<uint32_t> &body_triangles = bodies[p_body];
+  body_triangles.reserve(p_triangles.size());
+  for (uint32_t i = 0; i < p_triangles.size(); i++) {
+    uint32_t index;
+    if (free_triangles.is_empty()) {
+      index = triangles.size();
+      triangles.push_back(IndexedTriangle());
+    } else {
+      index = free_triangles[free_triangles.size() - 1];
+      free_triangles.resize(free_triangles.size() - 1);
+    }
+
+    IndexedTriangle &triangle = triangles[index];
+    triangle.a = p_triangles[i].a;
+    triangle.b = p_triangles[i].b;
+    triangle.c = p_triangles[i].c;
+    triangle.body = p_body;
+    triangle.layer = p_layer;
+    insert_triangle(index);
+    body_triangles.push_back(index);
+  }
+}
+
+void OccluderIndex3D::remove_body(const uint64_t p_body) {
+  LocalVector<uint32_t> *body_triangles = bodies.getptr(p_body);
+  if (body_triangles == nullptr) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < body_triangles->size(); i++) {
+    uint32_t index = (*body_triangles)[i];
+    remove_triangle(index);
+    triangles[index].body = 0;
+    free_triangles.push_back(index);
+  }
+  bodies.erase(p_body);
+}
+
+bool OccluderIndex3D::has_body(const uint64_t p_body) const { return bodies.has(p_body); }
+
+int OccluderIndex3D::get_body_count() const { return bodies.size(); }
+
+int OccluderIndex3D::get_triangle_count() const {
+  return triangles.size() - free_triangles.size();
+}
+
+/// @brief Find the first triangle hit by a ray. Both faces of the triangles are hit.
+/// @param p_mask The collision layers which occlude the ray.
+/// @param p_exclude The instance ids of the bodies which don't occlude the ray.
+/// @param r_point The point at which the ray hit a triangle.
+/// @return Whether a triangle was hit.
+bool OccluderIndex3D::intersect_ray(
+    const Vector3 &p_from, const Vector3 &p_to, const uint32_t p_mask,
+    const LocalVector<uint64_t> &p_exclude, Vector3 &r_point
+) const {
+  Vector3 direction = p_to - p_from;
+  double best_t = Math_INF;
+
+  walk_cells(p_from, p_to, [&](int p_x, int p_y, int p_z, double p_t_exit) {
+    const LocalVector<uint32_t> &bucket = buckets[get_bucket(p_x, p_y, p_z)];
+    for (uint32_t i = 0; i < bucket.size(); i++) {
+      const IndexedTriangle &triangle = triangles[bucket[i]];
+      if ((triangle.layer & p_mask) == 0) {
+        continue;
+      }
+
+      // Moller-Trumbore intersection.
+      Vector3 edge_1 = triangle.b - triangle.a;
+      Vector3 edge_2 = triangle.c - triangle.a;
+      Vector3 p = direction.cross(edge_2);
+      double determinant = edge_1.dot(p);
+      if (Math::is_zero_approx(determinant)) {
+        continue;
+      }
+      Vector3 offset = p_from - triangle.a;
+      double u = offset.dot(p) / determinant;
+      if (u < 0 || u > 1) {
+        continue;
+      }
+      Vector3 q = offset.cross(edge_1);
+      double v = direction.dot(q) / determinant;
+      if (v < 0 || u + v > 1) {
+        continue;
+      }
+      double t = edge_2.dot(q) / determinant;
+      if (t < 0 || t > 1 || t >= best_t) {
+        continue;
+      }
+      if (p_exclude.find(triangle.body) != -1) {
+        continue;
+      }
+      best_t = t;
+    }
+
+    // A hit in a later cell could be closer than this one, until the ray leaves the cell.
+    return best_t > p_t_exit;
+  });
+
+  if (best_t == Math_INF) {
+    return false;
+  }
+  r_point = p_from + direction * best_t;
+  return true;
+}
@@ -0,0 +1,94 @@
+#ifndef OCCLUDER_INDEX_3D_H
+#define OCCLUDER_INDEX_3D_H
+
+#include <godot_cpp/classes/shape3d.hpp>
+#include <godot_cpp/templates/hash_map.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+#include <godot_cpp/variant/transform3d.hpp>
+#include <godot_cpp/variant/vector3.hpp>
+
+using namespace godot;
+
+/// @brief A spatial hash of occluder triangles, queried with rays instead of the physics server.
+///
+/// The 3D counterpart of OccluderIndex2D. Every triangle is stored in the cells of a uniform grid
+/// covered by its bounding box, and a ray walks the cells it crosses in order, stopping at the
+/// first cell holding a hit. Queries don't modify the index and can run concurrently.
+class OccluderIndex3D {
+public:
+  struct Triangle {
+    Vector3 a;  // The first corner of the triangle, in global coordinates.
+    Vector3 b;  // The second corner of the triangle, in global coordinates.
+    Vector3 c;  // The third corner of the triangle, in global coordinates.
+
+    Triangle() {
+      a = Vector3();
+      b = Vector3();
+      c = Vector3();
+    }
+
+    Triangle(Vector3 p_a, Vector3 p_b, Vector3 p_c) {
+      a = p_a;
+      b = p_b;
+      c = p_c;
+    }
+  };
+
+private:
+  // A triangle with the body it belongs to.
+  struct IndexedTriangle {
+    Vector3 a;       // The first corner of the triangle, in global coordinates.
+    Vector3 b;       // The second corner of the triangle, in global coordinates.
+    Vector3 c;       // The third corner of the triangle, in global coordinates.
+    uint64_t body;   // The instance id of the body, 0 if the slot is free.
+    uint32_t layer;  // The collision layer of the body.
+  };
+
+  double cell_size;                                 // The size of the cells of the grid.
+  LocalVector<IndexedTriangle> triangles;           // The triangles, with free slots.
+  LocalVector<uint32_t> free_triangles;             // The free slots of the triangles.
+  HashMap<uint64_t, LocalVector<uint32_t>> bodies;  // The triangles of every body.
+  LocalVector<LocalVector<uint32_t>> buckets;       // The triangles of the cells, by cell hash.
+
+  uint32_t get_bucket(const int p_x, const int p_y, const int p_z) const;
+  void insert_triangle(const uint32_t p_index);
+  void remove_triangle(const uint32_t p_index);
+
+  template <class F>
+  void walk_cells(const Vector3 &p_from, const Vector3 &p_to, F p_visit) const;
+  template <class F>
+  void visit_triangle_cells(const IndexedTriangle &p_triangle, F p_visit) const;
+
+  static void add_box(
+      const Vector3 &p_center, const Vector3 &p_half_size, const Transform3D &p_xform,
+      LocalVector<Triangle> &r_triangles
+  );
+
+public:
+  static void get_shape_triangles(
+      const Ref<Shape3D> &p_shape, const Transform3D &p_xform, LocalVector<Triangle> &r_triangles
+  );
+
+  void clear();
+
+  void set_cell_size(const double p_cell_size);
+  double get_cell_size() const;
+
+  void set_body(
+      const uint64_t p_body, const uint32_t p_layer, const LocalVector<Triangle> &p_triangles
+  );
+  void remove_body(const uint64_t p_body);
+  bool has_body(const uint64_t p_body) const;
+
+  int get_body_count() const;
+  int get_triangle_count() const;
+
+  bool intersect_ray(
+      const Vector3 &p_from, const Vector3 &p_to, const uint32_t p_mask,
+      const LocalVector<uint64_t> &p_exclude, Vector3 &r_point
+  ) const;
+
+  OccluderIndex3D();
+};
+
+#endif
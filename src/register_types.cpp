@@ -2,13 +2,19 @@
 
 #include "lineofsight2d.h"
 #include "lineofsight3d.h"
+#include "lineofsightgrid.h"
+#include "lineofsightgroup.h"
+#include "lineofsightserver.h"
 
 #include <gdextension_interface.h>
+#include <godot_cpp/classes/engine.hpp>
 #include <godot_cpp/core/defs.hpp>
 #include <godot_cpp/godot.hpp>
 
 using namespace godot;
 
+static LineOfSightServer *line_of_sight_server = nullptr;
+
 void initialize_line_of_sight_module(ModuleInitializationLevel p_level) {
   if (p_level != MODULE_INITIALIZATION_LEVEL_SCENE) {
     return;
@@ -16,12 +22,22 @@ void initialize_line_of_sight_module(ModuleInitializationLevel p_level) {
 
   ClassDB::register_class<LineOfSight2D>();
   ClassDB::register_class<LineOfSight3D>();
+  ClassDB::register_class<LineOfSightServer>();
+  ClassDB::register_class<LineOfSightGrid>();
+  ClassDB::register_class<LineOfSightGroup>();
+
+  line_of_sight_server = memnew(LineOfSightServer);
+  Engine::get_singleton()->register_singleton("LineOfSightServer", line_of_sight_server);
 }
 
 void uninitialize_line_of_sight_module(ModuleInitializationLevel p_level) {
   if (p_level != MODULE_INITIALIZATION_LEVEL_SCENE) {
     return;
   }
+
+  Engine::get_singleton()->unregister_singleton("LineOfSightServer");
+  memdelete(line_of_sight_server);
+  line_of_sight_server = nullptr;
 }
 
 extern "C" {
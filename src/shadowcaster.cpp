@@ -0,0 +1,116 @@
+#include "shadowcaster.h"
+
+using namespace godot;
+
+/// @brief Get the cell at a depth and a column of a quadrant.
+static Vector2i transform_cell(
+    const int p_quadrant, const Vector2i &p_origin, const int p_depth, const int p_column
+) {
+  switch (p_quadrant) {
+    case 0:
+      return Vector2i(p_origin.x + p_column, p_origin.y - p_depth);
+    case 1:
+      return Vector2i(p_origin.x + p_depth, p_origin.y + p_column);
+    case 2:
+      return Vector2i(p_origin.x + p_column, p_origin.y + p_depth);
+    default:
+      return Vector2i(p_origin.x - p_depth, p_origin.y + p_column);
+  }
+}
+
+// Orders the cells row by row.
+struct RowOrder {
+  _FORCE_INLINE_ bool operator()(const Vector2i &p_a, const Vector2i &p_b) const {
+    return p_a.y != p_b.y ? p_a.y < p_b.y : p_a.x < p_b.x;
+  }
+};
+
+/// @brief Divide and round towards negative infinity.
+static int floor_div(const int p_a, const int p_b) {
+  int quotient = p_a / p_b;
+  return (p_a % p_b != 0 && (p_a < 0) != (p_b < 0)) ? quotient - 1 : quotient;
+}
+
+/// @brief Compute the cells visible from a cell, including the occupied cells that are seen.
+/// @param p_radius The distance up to which cells are visible, in cells.
+/// @param r_cells The visible cells, which may contain duplicates on the diagonals.
+void ShadowCaster::compute(
+    const TileOccupancy &p_occupancy, const Vector2i &p_origin, const int p_radius,
+    LocalVector<Vector2i> &r_cells
+) {
+  r_cells.clear();
+  r_cells.push_back(p_origin);
+  int radius_squared = p_radius * p_radius;
+
+  for (int quadrant = 0; quadrant < 4; quadrant++) {
+    rows.clear();
+    rows.push_back({1, -1, 1, 1, 1});
+
+    while (!rows.is_empty()) {
+      Row row = rows[rows.size() - 1];
+      rows.resize(rows.size() - 1);
+      if (row.depth > p_radius) {
+        continue;
+      }
+
+      // Round the slopes so that a cell is in the row if its center is between them, with the
+      // ties rounded towards the inside of the row.
+      int min_column =
+          floor_div(2 * row.depth * row.start_num + row.start_den, 2 * row.start_den);
+      int max_column = -floor_div(row.end_den - 2 * row.depth * row.end_num, 2 * row.end_den);
+      // 0 before the first cell, 1 after an empty cell and 2 after an occupied one.
+      int previous = 0;
+
+      for (int column = min_column; column <= max_column; column++) {
+        Vector2i cell = transform_cell(quadrant, p_origin, row.depth, column);
+        bool occupied = p_occupancy.is_occupied(cell);
+        // Empty cells are only seen if their center is, so the result is symmetric.
+        bool symmetric = column * row.start_den >= row.depth * row.start_num &&
+                         column * row.end_den <= row.depth * row.end_num;
+        bool in_radius = row.depth * row.depth + column * column <= radius_squared;
+        if ((occupied || symmetric) && in_radius) {
+          r_cells.push_back(cell);
+        }
+
+        // The slope of the left edge of the cell is (2 * column - 1) / (2 * depth).
+        if (previous == 2 && !occupied) {
+          row.start_num = 2 * column - 1;
+          row.start_den = 2 * row.depth;
+        }
+        if (previous == 1 && occupied) {
+          rows.push_back(
+              {row.depth + 1, row.start_num, row.start_den, 2 * column - 1, 2 * row.depth}
+          );
+        }
+        previous = occupied ? 2 : 1;
+      }
+
+      if (previous == 1) {
+        rows.push_back({row.depth + 1, row.start_num, row.start_den, row.end_num, row.end_den});
+      }
+    }
+  }
+}
+
+/// @brief Merge cells into runs of adjacent cells, dropping the duplicates.
+/// @param p_cells The cells, sorted in place.
+/// @param r_runs The runs, row by row.
+void ShadowCaster::merge_runs(LocalVector<Vector2i> &p_cells, LocalVector<Run> &r_runs) {
+  r_runs.clear();
+  if (p_cells.is_empty()) {
+    return;
+  }
+  p_cells.sort_custom<RowOrder>();
+
+  Run run = {p_cells[0].y, p_cells[0].x, p_cells[0].x + 1};
+  for (uint32_t i = 1; i < p_cells.size(); i++) {
+    const Vector2i &cell = p_cells[i];
+    if (cell.y == run.y && cell.x <= run.x_end) {
+      run.x_end = MAX(run.x_end, cell.x + 1);
+      continue;
+    }
+    r_runs.push_back(run);
+    run = {cell.y, cell.x, cell.x + 1};
+  }
+  r_runs.push_back(run);
+}
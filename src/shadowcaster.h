@@ -0,0 +1,47 @@
+#ifndef SHADOW_CASTER_H
+#define SHADOW_CASTER_H
+
+#include "tileoccupancy.h"
+
+#include <godot_cpp/templates/local_vector.hpp>
+#include <godot_cpp/variant/vector2i.hpp>
+
+using namespace godot;
+
+/// @brief Computes the cells visible from a cell with symmetric shadowcasting.
+///
+/// The four quadrants around the origin are scanned row by row, moving away from it, and every run
+/// of empty cells narrows the slopes seen through it. Each cell is visited at most once per
+/// quadrant, instead of once per ray, and a cell sees another if and only if the other sees it.
+class ShadowCaster {
+public:
+  // The cells [x_begin, x_end) of the row y.
+  struct Run {
+    int y;
+    int x_begin;
+    int x_end;
+  };
+
+private:
+  // A row of a quadrant, seen between two slopes. The slopes are fractions, so that the cells
+  // exactly on them are always rounded the same way.
+  struct Row {
+    int depth;      // The distance of the row from the origin, in cells.
+    int start_num;  // The numerator of the slope of the first cell seen in the row.
+    int start_den;  // Its denominator, always positive.
+    int end_num;    // The numerator of the slope of the last cell seen in the row.
+    int end_den;    // Its denominator, always positive.
+  };
+
+  LocalVector<Row> rows;  // The rows left to scan, reused by every computation.
+
+public:
+  void compute(
+      const TileOccupancy &p_occupancy, const Vector2i &p_origin, const int p_radius,
+      LocalVector<Vector2i> &r_cells
+  );
+
+  static void merge_runs(LocalVector<Vector2i> &p_cells, LocalVector<Run> &r_runs);
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include "sweepgenerator.h"
+
+#include "fixedtrig.h"
+
+#include <godot_cpp/core/math.hpp>
+
+using namespace godot;
+
+SweepGenerator::SweepGenerator() {
+  angle = 0;
+  step_count = -1;
+  rotation = Vector2(1, 0);
+  deterministic = false;
+}
+
+/// @brief Set the cone covered by the sweep, rebuilding the directions only if it changed.
+/// @param p_angle The angle of the cone in degrees.
+/// @param p_step_count The number of steps between the first and the last ray.
+void SweepGenerator::set_cone(const double p_angle, const int p_step_count) {
+  if (p_angle == angle && p_step_count == step_count) {
+    return;
+  }
+  angle = p_angle;
+  step_count = p_step_count;
+
+  double step_size = angle / step_count;
+  double start_angle = -angle / 2.0;
+  offsets.resize(step_count + 1);
+  for (int i = 0; i <= step_count; i++) {
+    // Every step is computed from its own angle, so the error doesn't build up along the cone.
+    double step_angle = start_angle + step_size * i;
+    offsets[i] = get_unit_vector(step_angle);
+  }
+}
+
+/// @brief Set the global rotation of the center of the cone, once per sweep.
+/// @param p_rotation The rotation in degrees.
+void SweepGenerator::set_rotation(const double p_rotation) {
+  rotation = get_unit_vector(p_rotation);
+}
+
+/// @brief Set whether the sines and cosines come from FixedTrig, rebuilding the cone if it changed.
+void SweepGenerator::set_deterministic(const bool p_deterministic) {
+  if (p_deterministic == deterministic) {
+    return;
+  }
+  deterministic = p_deterministic;
+  step_count = -1;
+}
+
+bool SweepGenerator::is_deterministic() const { return deterministic; }
+
+/// @brief Get the direction of an angle, as cos and sin of it.
+/// @param p_degrees The angle in degrees.
+Vector2 SweepGenerator::get_unit_vector(const double p_degrees) const {
+  if (deterministic) {
+    return FixedTrig::get_unit_vector(p_degrees);
+  }
+  double radians = Math::deg_to_rad(p_degrees);
+  return Vector2(Math::cos(radians), Math::sin(radians));
+}
+
+/// @brief Get the angle of a vector, like Vector2::angle() but in degrees.
+double SweepGenerator::get_angle(const Vector2 &p_vector) const {
+  if (deterministic) {
+    return FixedTrig::get_angle(p_vector);
+  }
+  return Math::rad_to_deg(p_vector.angle());
+}
+
+/// @brief Get the angle to turn by from a vector to another, like Vector2::angle_to() but in
+/// degrees.
+double SweepGenerator::get_angle_to(const Vector2 &p_from, const Vector2 &p_to) const {
+  return get_angle(Vector2(p_from.dot(p_to), p_from.cross(p_to)));
+}
+
+int SweepGenerator::get_step_count() const { return step_count; }
+
+/// @brief Whether the cone is a full circle, so that its last step points along its first one.
+bool SweepGenerator::is_full_circle() const { return angle >= 360.0; }
+
+/// @brief Get the direction halfway between two directions, turning from the first to the second
+/// by increasing angles.
+Vector2 SweepGenerator::get_bisector(
+    const Vector2 &p_min_direction, const Vector2 &p_max_direction
+) {
+  Vector2 sum = p_min_direction + p_max_direction;
+  double cross = p_min_direction.cross(p_max_direction);
+  if (sum.length_squared() < CMP_EPSILON) {
+    // Opposite directions: the bisector is a quarter turn from the first one.
+    return Vector2(-p_min_direction.y, p_min_direction.x);
+  }
+  // Past half a turn, the sum points to the other side.
+  return cross < 0 ? -sum.normalized() : sum.normalized();
+}
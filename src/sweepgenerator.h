@@ -0,0 +1,50 @@
+#ifndef SWEEP_GENERATOR_H
+#define SWEEP_GENERATOR_H
+
+#include <godot_cpp/templates/local_vector.hpp>
+#include <godot_cpp/variant/vector2.hpp>
+
+using namespace godot;
+
+/// @brief Generates the directions of the rays of a planar sweep, shared by the 2D and 3D nodes.
+///
+/// The directions of a cone are computed once and cached until its angle or its step count change.
+/// The rotation of the node is applied to them as a single complex multiply per ray, and the rays
+/// between two directions are found by adding them, so a sweep never evaluates a sine or a cosine.
+///
+/// A deterministic generator takes its sines and cosines from FixedTrig instead of the standard
+/// library, so its directions are the same on every platform.
+class SweepGenerator {
+  double angle;                  // The angle of the cached cone in degrees.
+  int step_count;                // The number of steps of the cached cone.
+  LocalVector<Vector2> offsets;  // The directions of the steps, relative to the cone center.
+  Vector2 rotation;              // The rotation of the sweep, as cos and sin of its angle.
+  bool deterministic;            // Whether the directions are computed in fixed point.
+
+public:
+  void set_cone(const double p_angle, const int p_step_count);
+  void set_rotation(const double p_rotation);
+
+  void set_deterministic(const bool p_deterministic);
+  bool is_deterministic() const;
+  Vector2 get_unit_vector(const double p_degrees) const;
+  double get_angle(const Vector2 &p_vector) const;
+  double get_angle_to(const Vector2 &p_from, const Vector2 &p_to) const;
+
+  int get_step_count() const;
+  bool is_full_circle() const;
+
+  /// @brief Get the global direction of a step of the sweep, from 0 to the step count.
+  _FORCE_INLINE_ Vector2 get_direction(const int p_step) const {
+    const Vector2 &offset = offsets[p_step];
+    return Vector2(
+        offset.x * rotation.x - offset.y * rotation.y, offset.x * rotation.y + offset.y * rotation.x
+    );
+  }
+
+  static Vector2 get_bisector(const Vector2 &p_min_direction, const Vector2 &p_max_direction);
+
+  SweepGenerator();
+};
+
+#endif
@@ -0,0 +1,255 @@
+#include "tileoccupancy.h"
+
+#include <godot_cpp/core/math.hpp>
+
+using namespace godot;
+
+TileOccupancy::TileOccupancy() {
+  rect = Rect2i();
+  words_per_row = 0;
+  tile_size = Vector2();
+}
+
+void TileOccupancy::clear() {
+  rect = Rect2i();
+  words_per_row = 0;
+  bits.clear();
+}
+
+/// @brief Cover other cells with the bitmap, keeping the cells used in both.
+void TileOccupancy::resize(const Rect2i &p_rect) {
+  Rect2i old_rect = rect;
+  int old_words_per_row = words_per_row;
+  LocalVector<uint64_t> old_bits = bits;
+
+  rect = p_rect;
+  words_per_row = (rect.size.x + 63) / 64;
+  bits.resize(words_per_row * rect.size.y);
+  for (uint32_t i = 0; i < bits.size(); i++) {
+    bits[i] = 0;
+  }
+
+  for (int y = 0; y < old_rect.size.y; y++) {
+    for (int x = 0; x < old_rect.size.x; x++) {
+      if ((old_bits[y * old_words_per_row + (x >> 6)] >> (x & 63)) & 1) {
+        set_occupied(old_rect.position + Vector2i(x, y), true);
+      }
+    }
+  }
+}
+
+/// @brief Read the used cells of a layer into the bitmap.
+void TileOccupancy::build(TileMap *p_tile_map, const int p_layer) {
+  clear();
+  if (p_layer < 0 || p_layer >= p_tile_map->get_layers_count()) {
+    return;
+  }
+
+  resize(p_tile_map->get_used_rect());
+  TypedArray<Vector2i> cells = p_tile_map->get_used_cells(p_layer);
+  for (int i = 0; i < cells.size(); i++) {
+    set_occupied(cells[i], true);
+  }
+}
+
+/// @brief Read some cells of a layer again, after they were edited.
+/// @param p_cells The cells which changed, in map coordinates.
+void TileOccupancy::update_cells(
+    TileMap *p_tile_map, const int p_layer, const TypedArray<Vector2i> &p_cells
+) {
+  if (p_layer < 0 || p_layer >= p_tile_map->get_layers_count()) {
+    return;
+  }
+  for (int i = 0; i < p_cells.size(); i++) {
+    Vector2i cell = p_cells[i];
+    set_occupied(cell, p_tile_map->get_cell_source_id(p_layer, cell) != -1);
+  }
+}
+
+/// @brief Set whether a cell is used, growing the bitmap if it is outside of it.
+void TileOccupancy::set_occupied(const Vector2i &p_cell, const bool p_occupied) {
+  if (!rect.has_point(p_cell)) {
+    if (!p_occupied) {
+      return;
+    }
+    Rect2i cell_rect = Rect2i(p_cell, Vector2i(1, 1));
+    resize(rect.has_area() ? rect.merge(cell_rect) : cell_rect);
+  }
+
+  int x = p_cell.x - rect.position.x;
+  int y = p_cell.y - rect.position.y;
+  uint64_t mask = uint64_t(1) << (x & 63);
+  uint64_t &word = bits[y * words_per_row + (x >> 6)];
+  word = p_occupied ? word | mask : word & ~mask;
+}
+
+Rect2i TileOccupancy::get_rect() const { return rect; }
+
+/// @brief Set where the cells are.
+/// @param p_transform The global transform of the tile map.
+/// @param p_tile_size The size of a tile of its tile set, zero without a tile set.
+void TileOccupancy::set_transform(const Transform2D &p_transform, const Vector2 &p_tile_size) {
+  tile_size = p_tile_size;
+  if (!has_tiles()) {
+    cell_transform = Transform2D();
+    inverse_transform = Transform2D();
+    return;
+  }
+  cell_transform = p_transform.scaled_local(tile_size);
+  inverse_transform = cell_transform.affine_inverse();
+}
+
+/// @brief Get the transform mapping cell coordinates to global coordinates.
+Transform2D TileOccupancy::get_cell_transform() const { return cell_transform; }
+
+Vector2 TileOccupancy::get_tile_size() const { return tile_size; }
+
+/// @brief Whether the cells have a size, so that they can be queried.
+bool TileOccupancy::has_tiles() const { return tile_size.x > 0 && tile_size.y > 0; }
+
+/// @brief Get the cell containing a point in global coordinates.
+Vector2i TileOccupancy::get_cell_at(const Vector2 &p_point) const {
+  Vector2 cell = inverse_transform.xform(p_point);
+  return Vector2i((int)Math::floor(cell.x), (int)Math::floor(cell.y));
+}
+
+/// @brief Cast a ray over the cells with a grid traversal (Amanatides and Woo), visiting the cells
+/// it crosses in order. A ray starting in a used cell ignores it, like a physics ray ignores the
+/// shape it starts in.
+/// @param p_from The start of the ray in global coordinates.
+/// @param p_to The end of the ray in global coordinates.
+/// @param r_fraction The fraction of the ray at which it enters the first used cell.
+/// @return Whether the ray hit a used cell.
+bool TileOccupancy::intersect_ray(
+    const Vector2 &p_from, const Vector2 &p_to, real_t &r_fraction
+) const {
+  if (bits.is_empty()) {
+    return false;
+  }
+  Vector2 from = inverse_transform.xform(p_from);
+  Vector2 delta = inverse_transform.xform(p_to) - from;
+
+  // Only the part of the ray over the bitmap can hit anything.
+  Vector2i end = rect.get_end();
+  double t_exit = 1.0;
+  if (delta.x != 0) {
+    double border = delta.x > 0 ? end.x : rect.position.x;
+    t_exit = MIN(t_exit, (border - from.x) / delta.x);
+  }
+  if (delta.y != 0) {
+    double border = delta.y > 0 ? end.y : rect.position.y;
+    t_exit = MIN(t_exit, (border - from.y) / delta.y);
+  }
+  if (t_exit <= 0) {
+    return false;
+  }
+
+  int x = (int)Math::floor(from.x);
+  int y = (int)Math::floor(from.y);
+  int step_x = delta.x > 0 ? 1 : -1;
+  int step_y = delta.y > 0 ? 1 : -1;
+  // The fractions of the ray at which it crosses the next column and the next row, and the
+  // fractions between two columns and between two rows.
+  double t_max_x = Math_INF;
+  double t_max_y = Math_INF;
+  double t_delta_x = Math_INF;
+  double t_delta_y = Math_INF;
+  if (delta.x != 0) {
+    t_max_x = delta.x > 0 ? (x + 1 - from.x) / delta.x : (from.x - x) / -delta.x;
+    t_delta_x = Math::abs(1.0 / delta.x);
+  }
+  if (delta.y != 0) {
+    t_max_y = delta.y > 0 ? (y + 1 - from.y) / delta.y : (from.y - y) / -delta.y;
+    t_delta_y = Math::abs(1.0 / delta.y);
+  }
+
+  while (true) {
+    double t;
+    if (t_max_x < t_max_y) {
+      t = t_max_x;
+      x += step_x;
+      t_max_x += t_delta_x;
+    } else {
+      t = t_max_y;
+      y += step_y;
+      t_max_y += t_delta_y;
+    }
+    if (t > t_exit) {
+      return false;
+    }
+    if (is_occupied(Vector2i(x, y))) {
+      r_fraction = t;
+      return true;
+    }
+  }
+}
+
+/// @brief Find the corner where the wall hit by a ray stops hiding what is behind it, by following
+/// the wall from the hit point while it faces the origin.
+/// @param p_origin The origin of the ray in global coordinates.
+/// @param p_point The point where the ray hit the wall.
+/// @param p_limit A point past which the corner isn't searched, on the side of p_turn.
+/// @param p_turn 1 to follow the wall by increasing angles around the origin, -1 to decrease them.
+/// @param r_corner The corner in global coordinates.
+/// @return Whether the corner is found, false if the wall turns or goes past the limit.
+bool TileOccupancy::find_corner(
+    const Vector2 &p_origin, const Vector2 &p_point, const Vector2 &p_limit, const int p_turn,
+    Vector2 &r_corner
+) const {
+  Vector2 origin = inverse_transform.xform(p_origin);
+  Vector2 point = inverse_transform.xform(p_point);
+  Vector2 limit = inverse_transform.xform(p_limit) - origin;
+  // A mirrored tile map turns the other way in cell coordinates.
+  int turn = cell_transform.basis_determinant() < 0 ? -p_turn : p_turn;
+
+  // The point is on the side of a cell facing the origin, along a column or a row.
+  double column_distance = Math::abs(point.x - Math::round(point.x));
+  double row_distance = Math::abs(point.y - Math::round(point.y));
+  Vector2i cell;
+  Vector2i normal;  // The side of the cell facing the origin.
+  Vector2i step;    // The direction of the wall, turning around the origin.
+  bool found = false;
+  for (int attempt = 0; attempt < 2 && !found; attempt++) {
+    if ((column_distance <= row_distance) == (attempt == 0)) {
+      int column = (int)Math::round(point.x);
+      normal = Vector2i(origin.x < column ? -1 : 1, 0);
+      cell = Vector2i(origin.x < column ? column : column - 1, (int)Math::floor(point.y));
+      step = Vector2i(0, (point.x > origin.x ? 1 : -1) * turn);
+    } else {
+      int row = (int)Math::round(point.y);
+      normal = Vector2i(0, origin.y < row ? -1 : 1);
+      cell = Vector2i((int)Math::floor(point.x), origin.y < row ? row : row - 1);
+      step = Vector2i((point.y > origin.y ? -1 : 1) * turn, 0);
+    }
+    found = is_occupied(cell) && !is_occupied(cell + normal);
+  }
+  if (!found) {
+    return false;
+  }
+
+  // The walls are rarely longer than this, past it bisecting the edge is cheaper.
+  for (int i = 0; i < 256; i++) {
+    // The end of the side of the cell, in the direction of the wall.
+    Vector2 corner = Vector2(cell) + Vector2(0.5, 0.5) + (Vector2(normal) + Vector2(step)) * 0.5;
+    Vector2 offset = corner - origin;
+    if (limit.cross(offset) * turn > 0) {
+      return false;
+    }
+
+    Vector2i next = cell + step;
+    if (!is_occupied(next)) {
+      // The side of the cell beyond the corner faces the origin, so the wall goes on around it.
+      if (offset.dot(Vector2(step)) < 0) {
+        return false;
+      }
+      r_corner = cell_transform.xform(corner);
+      return true;
+    }
+    if (is_occupied(next + normal)) {
+      // The wall turns towards the origin.
+      return false;
+    }
+    cell = next;
+  }
+  return false;
+}
@@ -0,0 +1,63 @@
+#ifndef TILE_OCCUPANCY_H
+#define TILE_OCCUPANCY_H
+
+#include <godot_cpp/classes/tile_map.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+#include <godot_cpp/variant/rect2i.hpp>
+#include <godot_cpp/variant/transform2d.hpp>
+#include <godot_cpp/variant/typed_array.hpp>
+#include <godot_cpp/variant/vector2.hpp>
+#include <godot_cpp/variant/vector2i.hpp>
+
+using namespace godot;
+
+/// @brief A bitmap of the cells used by a layer of a TileMap, which block the view.
+///
+/// Reading the TileMap goes through the engine for every cell, so the occupancy is cached with one
+/// bit per cell of the used rect. Cells outside of it are empty. Rays are cast over the bitmap by
+/// walking the cells they cross, and the corners of the walls they hit are found exactly. Queries
+/// don't modify the bitmap and can run concurrently.
+class TileOccupancy {
+  Rect2i rect;                    // The cells covered by the bitmap.
+  int words_per_row;              // The number of words of a row of the bitmap.
+  LocalVector<uint64_t> bits;     // The occupancy of the cells, row by row.
+  Transform2D cell_transform;     // Maps cell coordinates to global coordinates.
+  Transform2D inverse_transform;  // Maps global coordinates to cell coordinates.
+  Vector2 tile_size;              // The size of a tile of the tile map, zero without a tile set.
+
+  void resize(const Rect2i &p_rect);
+
+public:
+  void clear();
+  void build(TileMap *p_tile_map, const int p_layer);
+  void update_cells(TileMap *p_tile_map, const int p_layer, const TypedArray<Vector2i> &p_cells);
+  void set_occupied(const Vector2i &p_cell, const bool p_occupied);
+
+  Rect2i get_rect() const;
+
+  void set_transform(const Transform2D &p_transform, const Vector2 &p_tile_size);
+  Transform2D get_cell_transform() const;
+  Vector2 get_tile_size() const;
+  bool has_tiles() const;
+
+  /// @brief Whether a cell is used by the layer.
+  _FORCE_INLINE_ bool is_occupied(const Vector2i &p_cell) const {
+    int x = p_cell.x - rect.position.x;
+    int y = p_cell.y - rect.position.y;
+    if (x < 0 || y < 0 || x >= rect.size.x || y >= rect.size.y) {
+      return false;
+    }
+    return (bits[y * words_per_row + (x >> 6)] >> (x & 63)) & 1;
+  }
+
+  Vector2i get_cell_at(const Vector2 &p_point) const;
+  bool intersect_ray(const Vector2 &p_from, const Vector2 &p_to, real_t &r_fraction) const;
+  bool find_corner(
+      const Vector2 &p_origin, const Vector2 &p_point, const Vector2 &p_limit, const int p_turn,
+      Vector2 &r_corner
+  ) const;
+
+  TileOccupancy();
+};
+
+#endif
@@ -0,0 +1,331 @@
+#include "visibilitypolygon2d.h"
+
+#include <godot_cpp/classes/capsule_shape2d.hpp>
+#include <godot_cpp/classes/circle_shape2d.hpp>
+#include <godot_cpp/classes/concave_polygon_shape2d.hpp>
+#include <godot_cpp/classes/convex_polygon_shape2d.hpp>
+#include <godot_cpp/classes/rectangle_shape2d.hpp>
+#include <godot_cpp/classes/segment_shape2d.hpp>
+#include <godot_cpp/core/math.hpp>
+
+using namespace godot;
+
+// Offset applied on both sides of a segment endpoint to see past and onto its corner (radians).
+static const double CORNER_EPSILON = 0.00001;
+// Margin keeping a segment active slightly outside of its angular interval (radians).
+static const double EVENT_EPSILON = 0.0001;
+
+/// @brief Get the angle of a point relative to the start of the sweep, in [0, TAU).
+static double relative_angle(const Vector2 &p_point, double p_start_angle) {
+  return Math::fposmod(Math::atan2(p_point.y, p_point.x) - p_start_angle, Math_TAU);
+}
+
+/// @brief Intersect a ray starting at the origin with a segment.
+/// @return The distance along the ray, or -1 if the ray does not cross the segment.
+static double intersect_segment(const Vector2 &p_dir, const Vector2 &p_a, const Vector2 &p_b) {
+  Vector2 edge = p_b - p_a;
+  double denominator = p_dir.cross(edge);
+  if (Math::is_zero_approx(denominator)) {
+    return -1;
+  }
+
+  double t = p_a.cross(edge) / denominator;
+  double u = p_a.cross(p_dir) / denominator;
+  if (t < 0 || u < 0 || u > 1) {
+    return -1;
+  }
+  return t;
+}
+
+/// @brief Get the segments joining consecutive points of a polyline.
+/// @param p_points The points of the polyline in local coordinates.
+/// @param p_xform The transform from local to global coordinates.
+/// @param p_closed Whether the last point is joined back to the first one.
+/// @param r_segments The segments are appended to this list, in global coordinates.
+void VisibilityPolygon2D::get_polyline_segments(
+    const PackedVector2Array &p_points, const Transform2D &p_xform, bool p_closed,
+    LocalVector<Segment> &r_segments
+) {
+  int count = p_points.size();
+  if (count < 2) {
+    return;
+  }
+
+  int segment_count = p_closed ? count : count - 1;
+  for (int i = 0; i < segment_count; i++) {
+    Vector2 a = p_xform.xform(p_points[i]);
+    Vector2 b = p_xform.xform(p_points[(i + 1) % count]);
+    if (a != b) {
+      r_segments.push_back(Segment(a, b));
+    }
+  }
+}
+
+/// @brief Get the outline of a shape as segments. Round shapes are approximated.
+/// @param p_shape The shape to outline.
+/// @param p_xform The global transform of the shape.
+/// @param r_segments The segments are appended to this list, in global coordinates.
+void VisibilityPolygon2D::get_shape_segments(
+    const Ref<Shape2D> &p_shape, const Transform2D &p_xform, LocalVector<Segment> &r_segments
+) {
+  const int round_segments = 16;
+  PackedVector2Array points;
+
+  if (RectangleShape2D *rectangle = Object::cast_to<RectangleShape2D>(p_shape.ptr())) {
+    Vector2 half = rectangle->get_size() / 2.0;
+    points.push_back(Vector2(-half.x, -half.y));
+    points.push_back(Vector2(half.x, -half.y));
+    points.push_back(Vector2(half.x, half.y));
+    points.push_back(Vector2(-half.x, half.y));
+    get_polyline_segments(points, p_xform, true, r_segments);
+  } else if (CircleShape2D *circle = Object::cast_to<CircleShape2D>(p_shape.ptr())) {
+    for (int i = 0; i < round_segments; i++) {
+      double round_angle = Math_TAU * i / round_segments;
+      Vector2 direction = Vector2(Math::cos(round_angle), Math::sin(round_angle));
+      points.push_back(direction * circle->get_radius());
+    }
+    get_polyline_segments(points, p_xform, true, r_segments);
+  } else if (CapsuleShape2D *capsule = Object::cast_to<CapsuleShape2D>(p_shape.ptr())) {
+    double capsule_radius = capsule->get_radius();
+    double half_height = MAX(0.0, capsule->get_height() / 2.0 - capsule_radius);
+    for (int i = 0; i <= round_segments / 2; i++) {
+      double round_angle = Math_PI * i / (round_segments / 2);
+      Vector2 offset = Vector2(Math::cos(round_angle), Math::sin(round_angle)) * capsule_radius;
+      points.push_back(Vector2(0, half_height) + offset);
+    }
+    for (int i = 0; i <= round_segments / 2; i++) {
+      double round_angle = Math_PI + Math_PI * i / (round_segments / 2);
+      Vector2 offset = Vector2(Math::cos(round_angle), Math::sin(round_angle)) * capsule_radius;
+      points.push_back(Vector2(0, -half_height) + offset);
+    }
+    get_polyline_segments(points, p_xform, true, r_segments);
+  } else if (SegmentShape2D *segment = Object::cast_to<SegmentShape2D>(p_shape.ptr())) {
+    points.push_back(segment->get_a());
+    points.push_back(segment->get_b());
+    get_polyline_segments(points, p_xform, false, r_segments);
+  } else if (ConvexPolygonShape2D *convex = Object::cast_to<ConvexPolygonShape2D>(p_shape.ptr())) {
+    get_polyline_segments(convex->get_points(), p_xform, true, r_segments);
+  } else if (Object::cast_to<ConcavePolygonShape2D>(p_shape.ptr()) != nullptr) {
+    ConcavePolygonShape2D *concave = Object::cast_to<ConcavePolygonShape2D>(p_shape.ptr());
+    PackedVector2Array concave_segments = concave->get_segments();
+    for (int i = 0; i + 1 < concave_segments.size(); i += 2) {
+      Vector2 a = p_xform.xform(concave_segments[i]);
+      Vector2 b = p_xform.xform(concave_segments[i + 1]);
+      if (a != b) {
+        r_segments.push_back(Segment(a, b));
+      }
+    }
+  }
+}
+
+void VisibilityPolygon2D::clear() { segments.clear(); }
+
+void VisibilityPolygon2D::add_segment(const Vector2 &p_a, const Vector2 &p_b) {
+  if (p_a != p_b) {
+    segments.push_back(Segment(p_a, p_b));
+  }
+}
+
+/// @brief Add the segments joining consecutive points of a polyline.
+/// @param p_points The points of the polyline in local coordinates.
+/// @param p_xform The transform from local to global coordinates.
+/// @param p_closed Whether the last point is joined back to the first one.
+void VisibilityPolygon2D::add_polyline(
+    const PackedVector2Array &p_points, const Transform2D &p_xform, bool p_closed
+) {
+  get_polyline_segments(p_points, p_xform, p_closed, segments);
+}
+
+/// @brief Add the outline of a collision shape.
+/// @param p_shape The shape to add.
+/// @param p_xform The global transform of the shape.
+void VisibilityPolygon2D::add_shape(const Ref<Shape2D> &p_shape, const Transform2D &p_xform) {
+  get_shape_segments(p_shape, p_xform, segments);
+}
+
+int VisibilityPolygon2D::get_segment_count() const { return segments.size(); }
+
+void VisibilityPolygon2D::add_sweep_segment(
+    const Vector2 &p_a, const Vector2 &p_b, double p_min, double p_max
+) {
+  SweepSegment segment;
+  segment.a = p_a;
+  segment.b = p_b;
+  segment.angle_min = p_min;
+  segment.angle_max = p_max;
+  sweep_segments.push_back(segment);
+}
+
+/// @brief Add a critical sample where the segment enters or leaves the radius of the cone.
+void VisibilityPolygon2D::add_radius_crossings(
+    const SweepSegment &p_segment, double p_radius, double p_start_angle
+) {
+  Vector2 edge = p_segment.b - p_segment.a;
+  double a = edge.dot(edge);
+  double b = 2.0 * p_segment.a.dot(edge);
+  double c = p_segment.a.dot(p_segment.a) - p_radius * p_radius;
+  double discriminant = b * b - 4.0 * a * c;
+  if (discriminant < 0) {
+    return;
+  }
+
+  double root = Math::sqrt(discriminant);
+  double crossings[2] = {(-b - root) / (2.0 * a), (-b + root) / (2.0 * a)};
+  for (int i = 0; i < 2; i++) {
+    if (crossings[i] < 0 || crossings[i] > 1) {
+      continue;
+    }
+    double angle = relative_angle(p_segment.a + edge * crossings[i], p_start_angle);
+    if (angle >= p_segment.angle_min && angle <= p_segment.angle_max) {
+      samples.push_back({angle, true});
+    }
+  }
+}
+
+/// @brief Find the closest active segment in the given direction.
+/// @param p_origin The global position of the sweep origin.
+/// @param p_start_angle The absolute angle of the start of the sweep in radians.
+/// @param p_angle The angle of the ray relative to the start of the sweep in radians.
+VisibilityPolygon2D::Ray VisibilityPolygon2D::cast(
+    const Vector2 &p_origin, double p_start_angle, double p_angle, double p_distance_from_origin,
+    double p_radius
+) const {
+  double absolute_angle = p_start_angle + p_angle;
+  Vector2 dir = Vector2(Math::cos(absolute_angle), Math::sin(absolute_angle));
+
+  double closest = p_radius;
+  bool hit = false;
+  for (uint32_t i = 0; i < active.size(); i++) {
+    const SweepSegment &segment = sweep_segments[active[i]];
+    double t = intersect_segment(dir, segment.a, segment.b);
+    if (t >= p_distance_from_origin && t < closest) {
+      closest = t;
+      hit = true;
+    }
+  }
+
+  Vector2 from = p_origin + dir * p_distance_from_origin;
+  Vector2 point = p_origin + dir * closest;
+  double distance = hit ? closest - p_distance_from_origin : p_radius;
+  return Ray(hit, from, point, distance, Math::rad_to_deg(absolute_angle));
+}
+
+/// @brief Compute the visibility of a cone, ordered by angle.
+/// @param p_origin The global position of the cone.
+/// @param p_start_angle The angle of the first edge of the cone in degrees.
+/// @param p_angle The angle of the cone in degrees.
+/// @param p_step_size The angle between two samples of the outer arc in degrees.
+/// @param p_distance_from_origin The distance from the origin of the start of the rays.
+/// @param p_radius The radius of the cone.
+/// @param r_rays The rays describing the visibility polygon. Corners yield two rays.
+void VisibilityPolygon2D::compute(
+    const Vector2 &p_origin, double p_start_angle, double p_angle, double p_step_size,
+    double p_distance_from_origin, double p_radius, LocalVector<Ray> &r_rays
+) {
+  r_rays.clear();
+  sweep_segments.clear();
+  events.clear();
+  samples.clear();
+  active.clear();
+
+  double start = Math::deg_to_rad(p_start_angle);
+  double span = Math::deg_to_rad(p_angle);
+  double step = Math::deg_to_rad(p_step_size);
+  Vector2 start_dir = Vector2(Math::cos(start), Math::sin(start));
+
+  // Move the segments around the origin, drop the ones out of reach, and split the ones crossing
+  // the start of the sweep so every angular interval is contiguous in [0, TAU).
+  for (uint32_t i = 0; i < segments.size(); i++) {
+    Vector2 a = segments[i].a - p_origin;
+    Vector2 b = segments[i].b - p_origin;
+
+    Vector2 edge = b - a;
+    double u = CLAMP(-a.dot(edge) / edge.dot(edge), 0.0, 1.0);
+    if ((a + edge * u).length() > p_radius) {
+      continue;
+    }
+
+    double angle_a = relative_angle(a, start);
+    double angle_b = relative_angle(b, start);
+    if (Math::abs(angle_a - angle_b) <= Math_PI) {
+      add_sweep_segment(a, b, MIN(angle_a, angle_b), MAX(angle_a, angle_b));
+      continue;
+    }
+
+    double t = intersect_segment(start_dir, a, b);
+    if (t < 0) {
+      continue;
+    }
+    Vector2 split = start_dir * t;
+    if (angle_a > angle_b) {
+      add_sweep_segment(a, split, angle_a, Math_TAU);
+      add_sweep_segment(split, b, 0, angle_b);
+    } else {
+      add_sweep_segment(b, split, angle_b, Math_TAU);
+      add_sweep_segment(split, a, 0, angle_a);
+    }
+  }
+
+  // Regular samples draw the outer arc, critical samples resolve corners exactly.
+  int step_count = MAX(1, (int)Math::ceil(span / step));
+  for (int i = 0; i <= step_count; i++) {
+    samples.push_back({MIN(span, step * i), false});
+  }
+
+  for (uint32_t i = 0; i < sweep_segments.size(); i++) {
+    const SweepSegment &segment = sweep_segments[i];
+    if (segment.angle_min > span) {
+      continue;
+    }
+
+    events.push_back({segment.angle_min - EVENT_EPSILON, (int)i, true});
+    events.push_back({segment.angle_max + EVENT_EPSILON, (int)i, false});
+
+    if (segment.angle_min > 0) {
+      samples.push_back({segment.angle_min, true});
+    }
+    if (segment.angle_max < span) {
+      samples.push_back({segment.angle_max, true});
+    }
+    add_radius_crossings(segment, p_radius, start);
+  }
+
+  events.sort();
+  samples.sort();
+
+  uint32_t event_index = 0;
+  double last_angle = -1;
+  for (uint32_t i = 0; i < samples.size(); i++) {
+    const Sample &sample = samples[i];
+    if (sample.angle > span) {
+      break;
+    }
+
+    while (event_index < events.size() && events[event_index].angle <= sample.angle) {
+      const Event &event = events[event_index];
+      if (event.open) {
+        active.push_back(event.segment);
+      } else {
+        active.erase(event.segment);
+      }
+      event_index++;
+    }
+
+    if (!sample.critical) {
+      if (sample.angle - last_angle > CORNER_EPSILON) {
+        r_rays.push_back(cast(p_origin, start, sample.angle, p_distance_from_origin, p_radius));
+        last_angle = sample.angle;
+      }
+      continue;
+    }
+
+    // Look just before and just after the endpoint to get both sides of the corner.
+    double before = MAX(0.0, sample.angle - CORNER_EPSILON);
+    double after = MIN(span, sample.angle + CORNER_EPSILON);
+    if (before - last_angle > CORNER_EPSILON * 0.5) {
+      r_rays.push_back(cast(p_origin, start, before, p_distance_from_origin, p_radius));
+    }
+    r_rays.push_back(cast(p_origin, start, after, p_distance_from_origin, p_radius));
+    last_angle = after;
+  }
+}
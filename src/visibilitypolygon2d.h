@@ -0,0 +1,126 @@
+#ifndef VISIBILITY_POLYGON_2D_H
+#define VISIBILITY_POLYGON_2D_H
+
+#include <godot_cpp/classes/shape2d.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+#include <godot_cpp/variant/packed_vector2_array.hpp>
+#include <godot_cpp/variant/transform2d.hpp>
+#include <godot_cpp/variant/vector2.hpp>
+
+using namespace godot;
+
+/// @brief Computes the exact visibility polygon of a cone against a set of static segments.
+///
+/// Instead of sampling the cone with physics raycasts, the segments are swept by angle around the
+/// origin. Rays are only evaluated on both sides of every segment endpoint (which gives exact
+/// corners) and on the regular steps needed to draw the outer arc.
+class VisibilityPolygon2D {
+public:
+  struct Segment {
+    Vector2 a;  // The first end of the segment, in global coordinates.
+    Vector2 b;  // The second end of the segment, in global coordinates.
+
+    Segment() {
+      a = Vector2();
+      b = Vector2();
+    }
+
+    Segment(Vector2 p_a, Vector2 p_b) {
+      a = p_a;
+      b = p_b;
+    }
+  };
+
+  struct Ray {
+    bool hit;         // Whether the ray hit a segment.
+    Vector2 origin;   // The origin of the ray.
+    Vector2 point;    // The point at which the ray hit the segment (or its end).
+    double distance;  // The distance from the origin to the point.
+    double angle;     // The angle at which the ray was cast in degrees.
+
+    Ray() {
+      hit = false;
+      origin = Vector2();
+      point = Vector2();
+      distance = 0;
+      angle = 0;
+    }
+
+    Ray(bool p_hit, Vector2 p_origin, Vector2 p_point, double p_distance, double p_angle) {
+      hit = p_hit;
+      origin = p_origin;
+      point = p_point;
+      distance = p_distance;
+      angle = p_angle;
+    }
+  };
+
+private:
+  // A segment relative to the sweep origin, with the angular interval it covers.
+  struct SweepSegment {
+    Vector2 a;
+    Vector2 b;
+    double angle_min;
+    double angle_max;
+  };
+
+  // A segment entering or leaving the active set.
+  struct Event {
+    double angle;
+    int segment;
+    bool open;
+
+    bool operator<(const Event &p_other) const {
+      if (angle != p_other.angle) {
+        return angle < p_other.angle;
+      }
+      // Open before closing so a segment is never missing at its own endpoint.
+      return open && !p_other.open;
+    }
+  };
+
+  // An angle at which the visibility is evaluated.
+  struct Sample {
+    double angle;
+    bool critical;  // Critical samples are evaluated on both sides of the angle.
+
+    bool operator<(const Sample &p_other) const { return angle < p_other.angle; }
+  };
+
+  LocalVector<Segment> segments;
+
+  // Scratch buffers reused by every sweep.
+  LocalVector<SweepSegment> sweep_segments;
+  LocalVector<Event> events;
+  LocalVector<Sample> samples;
+  LocalVector<int> active;
+
+  void add_sweep_segment(const Vector2 &p_a, const Vector2 &p_b, double p_min, double p_max);
+  void add_radius_crossings(const SweepSegment &p_segment, double p_radius, double p_start_angle);
+  Ray cast(
+      const Vector2 &p_origin, double p_start_angle, double p_angle, double p_distance_from_origin,
+      double p_radius
+  ) const;
+
+public:
+  static void get_polyline_segments(
+      const PackedVector2Array &p_points, const Transform2D &p_xform, bool p_closed,
+      LocalVector<Segment> &r_segments
+  );
+  static void get_shape_segments(
+      const Ref<Shape2D> &p_shape, const Transform2D &p_xform, LocalVector<Segment> &r_segments
+  );
+
+  void clear();
+  void add_segment(const Vector2 &p_a, const Vector2 &p_b);
+  void add_polyline(const PackedVector2Array &p_points, const Transform2D &p_xform, bool p_closed);
+  void add_shape(const Ref<Shape2D> &p_shape, const Transform2D &p_xform);
+  int get_segment_count() const;
+
+  void compute(
+      const Vector2 &p_origin, double p_start_angle, double p_angle, double p_step_size,
+      double p_distance_from_origin, double p_radius, LocalVector<Ray> &r_rays
+  );
+};
+
+#endif